@@ -1,34 +1,42 @@
 #include <bev/linear_ringbuffer.hpp>
 #include <bev/io_buffer.hpp>
+#include <bev/typed_ringbuffer.hpp>
+#include <bev/binary_logger.hpp>
+#include <bev/byte_stream_buffer.hpp>
+#include <bev/bulk_copy.hpp>
 
 #include <iostream>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <vector>
 
 // Usage:
 //
 //    cat /dev/zero | ./benchmark (io_buffer|linear_ringbuffer) >/dev/null
+//    ./benchmark batch
+//    ./benchmark log
+//    ./benchmark copy
 
 std::atomic<int64_t> s_read_bytes;
 std::atomic<int64_t> s_write_bytes;
 
-void benchmark_linear_ringbuffer()
+// The same transfer loop for every kind of buffer.
+template<typename Buffer>
+void benchmark_buffer(Buffer& b, size_t block_size)
 {
-    bev::linear_ringbuffer b(64*1024);
     const int in = fileno(stdin);
     const int out = fileno(stdout);
 
     // TODO - Test if a version using select/poll/epoll would be faster.
     while (true) {
-        ssize_t n = ::read(in, b.write_head(), b.free_size());
+        ssize_t n = bev::read_some(in, b, block_size);
         if (n <= 0) break;
-        b.commit(n);
 
         s_read_bytes.fetch_add(n, std::memory_order_relaxed);
 
-        n = ::write(out, b.read_head(), b.size());
+        n = bev::write_some(out, b);
         if (n <= 0) break;
-        b.consume(n);
 
         s_write_bytes.fetch_add(n, std::memory_order_relaxed);
     }
@@ -36,26 +44,158 @@ void benchmark_linear_ringbuffer()
     perror("read or write:");
 }
 
+void benchmark_linear_ringbuffer()
+{
+    bev::linear_ringbuffer b(64*1024);
+    benchmark_buffer(b, b.capacity());
+}
+
 void benchmark_io_buffer()
 {
     bev::io_buffer b(64*1024);
-    const int in = fileno(stdin);
-    const int out = fileno(stdout);
-    constexpr int BLOCKSIZE = 32*1024;
+    benchmark_buffer(b, 32*1024);
+}
 
-    while (true) {
-        auto slab = b.prepare(BLOCKSIZE);
-        ssize_t n = ::read(in, slab.data, slab.size);
-        if (n <= 0) break;
-        b.commit(n);
+// Cost per event of passing fixed-size events from a producer thread to a
+// consumer thread, depending on how many events are claimed at once.
+void benchmark_batch(size_t batch_size)
+{
+    struct event {
+        uint64_t sequence;
+        uint64_t payload[7];
+    };
+
+    constexpr uint64_t EVENTS = 20*1000*1000;
+    bev::typed_ringbuffer<event> rb(64*1024);
+
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread producer([&] {
+        uint64_t sequence = 0;
+        while (sequence < EVENTS) {
+            size_t n = std::min<uint64_t>(rb.free_size(), EVENTS - sequence);
+            event* e = rb.write_head();
+            for (size_t i = 0; i < n; ++i) {
+                e[i].sequence = sequence++;
+            }
+            rb.commit(n);
+        }
+    });
+
+    uint64_t received = 0;
+    uint64_t checksum = 0;
+    while (received < EVENTS) {
+        auto batch = rb.claim_batch(batch_size);
+        for (size_t i = 0; i < batch.size; ++i) {
+            checksum += batch.data[i].sequence;
+        }
+        received += batch.size;
+        rb.release_batch(batch.size);
+    }
 
-        s_read_bytes.fetch_add(n, std::memory_order_relaxed);
+    producer.join();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
 
-        n = ::write(out, b.read_head(), b.size());
-        if (n <= 0) break;
-        b.consume(n);
+    if (checksum != EVENTS * (EVENTS - 1) / 2) {
+        std::cerr << "checksum mismatch\n";
+    }
+    std::cerr << "batch size " << batch_size << ": "
+              << static_cast<double>(ns) / EVENTS << " ns/event\n";
+}
 
-        s_write_bytes.fetch_add(n, std::memory_order_relaxed);
+// Cost of a log call on the hot thread, and of formatting the records
+// later on another thread. The calls are made in batches that fit into the
+// cache, and the cost of just taking the timestamp is shown separately since
+// it varies a lot between machines.
+void benchmark_log()
+{
+    constexpr int CALLS = 1000*1000;
+    constexpr int BATCH = 10*1000;
+    bev::binary_logger logger(4*1024*1024);
+    size_t length = 0;
+    auto sink = [&](const bev::log_site&, uint64_t, const std::string& text) {
+        length += text.size();
+    };
+
+    uint64_t sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < CALLS; ++i) {
+        sum += bev::detail::log_timestamp();
+    }
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    if (sum == 0) {
+        std::cerr << "timestamps are zero\n";
+    }
+    std::cerr << "timestamp: " << static_cast<double>(ns) / CALLS << " ns/call\n";
+
+    // The first round faults in the pages of the buffer.
+    for (int round = 0; round < 3; ++round) {
+        int64_t log_ns = 0;
+        int64_t format_ns = 0;
+        size_t n = 0;
+        for (int batch = 0; batch < CALLS / BATCH; ++batch) {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < BATCH; ++i) {
+                BEV_LOG(logger, "order %d filled at %.2f qty %u", i, 100.25, 7u);
+            }
+            auto logged = std::chrono::steady_clock::now();
+            std::thread formatter([&] { n += logger.drain(sink); });
+            formatter.join();
+            auto formatted = std::chrono::steady_clock::now();
+
+            log_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(logged - start).count();
+            format_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(formatted - logged).count();
+        }
+        std::cerr << "log: " << static_cast<double>(log_ns) / CALLS << " ns/call, "
+                  << "format: " << static_cast<double>(format_ns) / CALLS << " ns/record, "
+                  << n << " records, " << logger.dropped() << " dropped\n";
+    }
+}
+
+// Throughput of each copy kernel against plain `memcpy()`, for payload sizes
+// from cache-resident to far beyond the last-level cache.
+void benchmark_copy()
+{
+    struct kernel {
+        const char* name;
+        bev::copy_kernel kernel;
+    };
+    const kernel kernels[] = {
+        {"memcpy", bev::copy_kernel::libc},
+        {"erms", bev::copy_kernel::erms},
+        {"avx2", bev::copy_kernel::avx2},
+        {"stream", bev::copy_kernel::stream},
+    };
+    constexpr size_t MAX_SIZE = 64*1024*1024;
+    constexpr size_t BYTES_PER_RUN = 1024*1024*1024;
+
+    std::vector<char> src(MAX_SIZE, 'x');
+    std::vector<char> dst(MAX_SIZE, 'y');
+    std::cerr << "streaming threshold: " << bev::bulk_copy_streaming_threshold() / 1024 << " KiB\n";
+
+    for (size_t size : {4*1024, 64*1024, 256*1024, 1024*1024, 8*1024*1024, 64*1024*1024}) {
+        std::cerr << size / 1024 << " KiB:";
+        size_t const rounds = std::max<size_t>(BYTES_PER_RUN / size, 4);
+        for (const kernel& k : kernels) {
+            if (!bev::copy_kernel_supported(k.kernel)) {
+                std::cerr << "  " << k.name << " n/a";
+                continue;
+            }
+
+            bev::copy_with(k.kernel, dst.data(), src.data(), size);
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < rounds; ++i) {
+                bev::copy_with(k.kernel, dst.data(), src.data(), size);
+            }
+            auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            std::cerr << "  " << k.name << " " << static_cast<double>(size * rounds) / ns << " GB/s";
+        }
+
+        // What `put()` and `get()` pick for this size.
+        std::cerr << "  (bulk_copy uses " << kernels[static_cast<int>(bev::select_copy_kernel(size))].name << ")\n";
     }
 }
 
@@ -67,9 +207,29 @@ int main(int argc, char* argv[]) {
 
     if (argc <= 1) {
         std::cerr << "Usage: `cat <datasource> | ./benchmark (io_buffer|linear_ringbuffer) >/dev/null`\n";
+        std::cerr << "       `./benchmark batch`\n";
+        std::cerr << "       `./benchmark log`\n";
+        std::cerr << "       `./benchmark copy`\n";
         return 1;
     }
 
+    if (std::string(argv[1]) == "batch") {
+        for (size_t batch_size : {1, 8, 64, 512}) {
+            benchmark_batch(batch_size);
+        }
+        return 0;
+    }
+
+    if (std::string(argv[1]) == "log") {
+        benchmark_log();
+        return 0;
+    }
+
+    if (std::string(argv[1]) == "copy") {
+        benchmark_copy();
+        return 0;
+    }
+
     std::thread *iothread;
     if (std::string(argv[1]) == "io_buffer") {
         iothread = new std::thread(benchmark_io_buffer);
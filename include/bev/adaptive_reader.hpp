@@ -0,0 +1,167 @@
+#pragma once
+
+#include <bev/linear_ringbuffer.hpp>
+#include <bev/io_buffer.hpp>
+
+#include <algorithm>
+#include <cerrno>
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace bev {
+
+// # Adaptive Reader
+//
+// Fills a `linear_ringbuffer_` or an `io_buffer_view` from a file descriptor
+// with reads sized to the amount of data that is actually pending.
+//
+// Always asking `read()` for the whole free space is wasteful in two ways:
+// Connections exchanging many small messages touch large areas of the buffer
+// for nothing, and for an `io_buffer_view` every large `prepare()` risks a
+// `memmove()`. Conversely, waking up for every few bytes of a large burst
+// results in many small reads.
+//
+// With `use_fionread`, the reader asks the kernel how many bytes are pending
+// with `ioctl(FIONREAD)` and only requests that many, but at least
+// `min_read` bytes and at least 1 byte. With a nonzero `lowat`, the socket's `SO_RCVLOWAT` is
+// adjusted after every read so that `poll()` only reports the socket readable
+// once `lowat` bytes are available, or as much as still fits into the buffer
+// if that is less. The socket option is only changed when the desired value
+// differs from the current one.
+//
+//
+// # Usage
+//
+//     bev::adaptive_reader reader(socket, {true, 512, 16*1024});
+//     [wait for socket to become readable]
+//     ssize_t n = reader.read(rb); // Already committed.
+//
+// `read()` returns the result of the underlying `::read()` call, i.e. the
+// number of bytes committed, 0 on EOF or -1 with `errno` set. If the buffer
+// is full, `read()` returns -1 and sets `errno` to `ENOBUFS` without reading.
+//
+// Since a blocking read waits for `SO_RCVLOWAT` bytes as well, the socket
+// should be non-blocking when `lowat` is used.
+//
+// Failure to query `FIONREAD` or set `SO_RCVLOWAT`, e.g. because `fd` is not
+// a socket, silently disables the respective feature.
+//
+
+class adaptive_reader {
+public:
+	struct options {
+		bool use_fionread;
+		size_t min_read;
+		size_t lowat; // 0 leaves `SO_RCVLOWAT` alone.
+	};
+
+	// The file descriptor is not owned by the reader.
+	adaptive_reader(int fd, options opts) noexcept;
+
+	template<typename SizeT>
+	ssize_t read(linear_ringbuffer_<SizeT>& rb) noexcept;
+	ssize_t read(io_buffer_view& iob) noexcept;
+
+	// Amount of data that the next read would request, given `free` bytes
+	// of space in the buffer.
+	size_t read_size(size_t free) noexcept;
+
+private:
+	void update_lowat(size_t free) noexcept;
+
+	int fd_;
+	options options_;
+	int lowat_; // Last value set for `SO_RCVLOWAT`, 0 if unknown.
+};
+
+
+// Implementation.
+
+inline adaptive_reader::adaptive_reader(int fd, options opts) noexcept
+  : fd_(fd)
+  , options_(opts)
+  , lowat_(0)
+{}
+
+
+inline size_t adaptive_reader::read_size(size_t free) noexcept
+{
+	if (!options_.use_fionread) {
+		return free;
+	}
+
+	int pending = 0;
+	if (::ioctl(fd_, FIONREAD, &pending) < 0) {
+		options_.use_fionread = false;
+		return free;
+	}
+
+	// Ask for at least `min_read` bytes to also pick up data that arrives
+	// between the `ioctl()` and the `read()`, and never for 0 bytes, which
+	// would look like the end of the stream.
+	size_t const want = std::max({static_cast<size_t>(pending), options_.min_read, size_t(1)});
+	return std::min(want, free);
+}
+
+
+inline void adaptive_reader::update_lowat(size_t free) noexcept
+{
+	if (options_.lowat == 0) {
+		return;
+	}
+
+	int const desired = static_cast<int>(std::max<size_t>(1, std::min(options_.lowat, free)));
+	if (desired == lowat_) {
+		return;
+	}
+
+	if (::setsockopt(fd_, SOL_SOCKET, SO_RCVLOWAT, &desired, sizeof desired) < 0) {
+		options_.lowat = 0;
+		return;
+	}
+	lowat_ = desired;
+}
+
+
+template<typename SizeT>
+ssize_t adaptive_reader::read(linear_ringbuffer_<SizeT>& rb) noexcept
+{
+	size_t const free = rb.free_size();
+	if (free == 0) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	ssize_t n = ::read(fd_, rb.write_head(), this->read_size(free));
+	if (n > 0) {
+		rb.commit(n);
+	}
+
+	this->update_lowat(rb.free_size());
+	return n;
+}
+
+
+inline ssize_t adaptive_reader::read(io_buffer_view& iob) noexcept
+{
+	// `capacity()` is what could be prepared, including space that is only
+	// made available by moving the existing data.
+	size_t const free = iob.capacity();
+	if (free == 0) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	io_buffer_view::slab slab = iob.prepare(this->read_size(free));
+	ssize_t n = ::read(fd_, slab.data, slab.size);
+	if (n > 0) {
+		iob.commit(n);
+	}
+
+	this->update_lowat(iob.capacity());
+	return n;
+}
+
+} // namespace bev
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <bev/linear_ringbuffer.hpp>
+#include <bev/io_buffer.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+
+#if defined(BEV_USE_BOOST_ASIO)
+#include <boost/asio/buffer.hpp>
+#else
+#include <asio/buffer.hpp>
+#endif
+
+namespace bev {
+
+// # Asio Dynamic Buffer
+//
+// Adapters that let Asio read into and write from a `linear_ringbuffer_` or an
+// `io_buffer_view` directly, without copying through an intermediate buffer.
+// They model the `DynamicBuffer_v2` requirements, so they can be passed to
+// `async_read()`, `async_read_until()` and friends:
+//
+//     bev::linear_ringbuffer rb;
+//     asio::async_read_until(socket, bev::dynamic_buffer(rb), "\r\n\r\n",
+//         [&](std::error_code ec, std::size_t n) {
+//             [parse the header at `rb.read_head()`]
+//             rb.consume(n);
+//         });
+//
+//     asio::async_write(socket, asio::buffer(rb.read_head(), rb.size()), ...);
+//
+// Thanks to the mirrored mapping, `data()` of a ringbuffer is always a single
+// contiguous buffer. For an `io_buffer_view`, it is a sequence of two buffers,
+// because the view might be `wrapped()` after using `prepare_iov()`; the second
+// buffer is empty otherwise.
+//
+// The adapters only refer to the buffer, which must outlive all operations
+// using them. Standalone Asio is used by default, define `BEV_USE_BOOST_ASIO`
+// to use Boost.Asio instead.
+//
+//
+// # Errors and Exceptions
+//
+// `grow()` throws `std::length_error` if the buffer can't hold that much
+// more data. For an `io_buffer_view` with a `compaction_policy` that prevents
+// making room, this can happen before `max_size()` is reached.
+//
+//
+// # Concurrency
+//
+// Asio grows and shrinks the buffer while reading, which would expose
+// incomplete data to a concurrent reader of the ringbuffer. The buffer should
+// only be used from one thread, or strand, at a time.
+//
+
+namespace detail {
+
+#if defined(BEV_USE_BOOST_ASIO)
+namespace net = ::boost::asio;
+#else
+namespace net = ::asio;
+#endif
+
+
+// The amount of data and the most data the buffer can hold, which the two
+// buffers spell differently.
+template<typename SizeT>
+std::size_t data_size(const linear_ringbuffer_<SizeT>& rb) noexcept
+{
+	return rb.size();
+}
+
+
+inline std::size_t data_size(const io_buffer_view& iob) noexcept
+{
+	return iob.total_size();
+}
+
+
+template<typename SizeT>
+std::size_t total_capacity(const linear_ringbuffer_<SizeT>& rb) noexcept
+{
+	return rb.capacity();
+}
+
+
+inline std::size_t total_capacity(const io_buffer_view& iob) noexcept
+{
+	return iob.total_size() + iob.capacity();
+}
+
+
+// The bytes `[pos, pos+n)` of the data, as far as they exist.
+template<typename SizeT>
+net::mutable_buffer data_range(linear_ringbuffer_<SizeT>& rb, std::size_t pos, std::size_t n) noexcept
+{
+	std::size_t const size = rb.size();
+	pos = std::min<std::size_t>(pos, size);
+	return net::mutable_buffer(rb.read_head() + pos, std::min(n, size - pos));
+}
+
+
+inline std::array<net::mutable_buffer, 2> data_range(io_buffer_view& iob, std::size_t pos, std::size_t n) noexcept
+{
+	std::array<net::mutable_buffer, 2> result;
+	io_buffer_view::iovecs const data = iob.data_iov();
+	for (int i = 0; i < data.count; ++i) {
+		std::size_t const skip = std::min(pos, data.iov[i].iov_len);
+		std::size_t const len = std::min(n, data.iov[i].iov_len - skip);
+		result[i] = net::mutable_buffer(static_cast<char*>(data.iov[i].iov_base) + skip, len);
+		pos -= skip;
+		n -= len;
+	}
+	return result;
+}
+
+
+inline net::const_buffer to_const(const net::mutable_buffer& buffer) noexcept
+{
+	return buffer;
+}
+
+
+inline std::array<net::const_buffer, 2> to_const(const std::array<net::mutable_buffer, 2>& buffers) noexcept
+{
+	return {buffers[0], buffers[1]};
+}
+
+} // namespace detail
+
+
+template<typename Buffer>
+class asio_dynamic_buffer {
+public:
+	typedef decltype(detail::data_range(std::declval<Buffer&>(), 0, 0)) mutable_buffers_type;
+	typedef decltype(detail::to_const(std::declval<mutable_buffers_type>())) const_buffers_type;
+
+	explicit asio_dynamic_buffer(Buffer& buffer) noexcept;
+
+	std::size_t size() const noexcept;
+	std::size_t max_size() const noexcept;
+	std::size_t capacity() const noexcept;
+
+	// The bytes `[pos, pos+n)` of the data, as far as they exist.
+	const_buffers_type data(std::size_t pos, std::size_t n) const noexcept;
+	mutable_buffers_type data(std::size_t pos, std::size_t n) noexcept;
+
+	// Appends `n` bytes of uninitialized data.
+	void grow(std::size_t n);
+
+	// Removes `n` bytes from the end resp. the beginning.
+	void shrink(std::size_t n) noexcept;
+	void consume(std::size_t n) noexcept;
+
+private:
+	Buffer* buffer_;
+};
+
+
+template<typename SizeT>
+asio_dynamic_buffer<linear_ringbuffer_<SizeT>> dynamic_buffer(linear_ringbuffer_<SizeT>& rb) noexcept;
+
+inline asio_dynamic_buffer<io_buffer_view> dynamic_buffer(io_buffer_view& iob) noexcept;
+
+
+// Implementation.
+
+template<typename Buffer>
+asio_dynamic_buffer<Buffer>::asio_dynamic_buffer(Buffer& buffer) noexcept
+  : buffer_(&buffer)
+{}
+
+
+template<typename Buffer>
+std::size_t asio_dynamic_buffer<Buffer>::size() const noexcept
+{
+	return detail::data_size(*buffer_);
+}
+
+
+template<typename Buffer>
+std::size_t asio_dynamic_buffer<Buffer>::max_size() const noexcept
+{
+	return detail::total_capacity(*buffer_);
+}
+
+
+template<typename Buffer>
+std::size_t asio_dynamic_buffer<Buffer>::capacity() const noexcept
+{
+	// The storage never changes, so this is the same.
+	return detail::total_capacity(*buffer_);
+}
+
+
+template<typename Buffer>
+auto asio_dynamic_buffer<Buffer>::data(std::size_t pos, std::size_t n) noexcept -> mutable_buffers_type
+{
+	return detail::data_range(*buffer_, pos, n);
+}
+
+
+template<typename Buffer>
+auto asio_dynamic_buffer<Buffer>::data(std::size_t pos, std::size_t n) const noexcept -> const_buffers_type
+{
+	return detail::to_const(detail::data_range(*buffer_, pos, n));
+}
+
+
+template<typename Buffer>
+void asio_dynamic_buffer<Buffer>::grow(std::size_t n)
+{
+	if (n > this->max_size() - this->size()) {
+		throw std::length_error {"bev::asio_dynamic_buffer: too large"};
+	}
+
+	// For an `io_buffer_view`, this moves the contents to the front if needed.
+	auto const slab = buffer_->prepare(n);
+	if (slab.size < n) {
+		throw std::length_error {"bev::asio_dynamic_buffer: no room"};
+	}
+	buffer_->commit(n);
+}
+
+
+template<typename Buffer>
+void asio_dynamic_buffer<Buffer>::shrink(std::size_t n) noexcept
+{
+	buffer_->uncommit(std::min(n, this->size()));
+}
+
+
+template<typename Buffer>
+void asio_dynamic_buffer<Buffer>::consume(std::size_t n) noexcept
+{
+	buffer_->consume(std::min(n, this->size()));
+}
+
+
+template<typename SizeT>
+asio_dynamic_buffer<linear_ringbuffer_<SizeT>> dynamic_buffer(linear_ringbuffer_<SizeT>& rb) noexcept
+{
+	return asio_dynamic_buffer<linear_ringbuffer_<SizeT>>(rb);
+}
+
+
+inline asio_dynamic_buffer<io_buffer_view> dynamic_buffer(io_buffer_view& iob) noexcept
+{
+	return asio_dynamic_buffer<io_buffer_view>(iob);
+}
+
+} // namespace bev
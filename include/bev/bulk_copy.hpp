@@ -0,0 +1,296 @@
+#pragma once
+
+#include <bev/linear_ringbuffer.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace bev {
+
+// # Bulk Copy
+//
+// Copy kernels for large payloads, e.g. for `put()` and `get()` on a
+// `linear_ringbuffer_`, chosen by size and by what the CPU supports:
+//
+//  * Below `BULK_COPY_MIN` bytes, `memcpy()` is used, which is hard to beat
+//    for small copies.
+//  * Up to the streaming threshold, `rep movsb` on CPUs with ERMS ("enhanced
+//    rep movsb"), otherwise an AVX2 loop, otherwise `memcpy()`.
+//  * Beyond that, non-temporal stores with software prefetching of the
+//    source, so that a copy that can't fit into the cache anyway doesn't
+//    evict everything else from it first.
+//
+// The streaming threshold is half the size of the last-level cache, or 4 MiB
+// if that is unknown. Below that, regular stores are better even if another
+// core consumes the data, because it finds the data in the shared cache,
+// while streaming stores always send it to memory.
+//
+// Whether this beats `memcpy()`, which does similar things internally,
+// depends on the CPU and the C library, see `./benchmark copy`.
+//
+//
+// # Usage
+//
+//     bev::bulk_copy(dst, src, n);
+//     bev::copy_with(bev::copy_kernel::stream, dst, src, n); // For benchmarks.
+//
+//     bev::linear_ringbuffer rb;
+//     size_t written = bev::put(rb, payload, payload_size);
+//     size_t read = bev::get(rb, out, out_size);
+//
+//
+// # Concurrency
+//
+// All functions are thread-safe. The CPU is inspected once, on first use.
+//
+
+enum class copy_kernel {
+	libc,   // memcpy()
+	erms,   // rep movsb
+	avx2,   // 32-byte loads and stores
+	stream, // Non-temporal stores with prefetching
+};
+
+constexpr size_t BULK_COPY_MIN = 64*1024;
+
+// The source and destination must not overlap.
+inline void bulk_copy(void* dst, const void* src, size_t n) noexcept;
+
+// The kernel that `bulk_copy()` uses for `n` bytes.
+inline copy_kernel select_copy_kernel(size_t n) noexcept;
+
+// Copies with the given kernel, or with `memcpy()` if it is not supported.
+inline void copy_with(copy_kernel kernel, void* dst, const void* src, size_t n) noexcept;
+inline bool copy_kernel_supported(copy_kernel kernel) noexcept;
+
+inline size_t bulk_copy_streaming_threshold() noexcept;
+
+// Copies up to `n` bytes into resp. out of `rb` with `bulk_copy()`, and
+// commits resp. consumes them. Returns the number of bytes copied.
+template<typename SizeT>
+size_t put(linear_ringbuffer_<SizeT>& rb, const void* src, size_t n) noexcept;
+
+template<typename SizeT>
+size_t get(linear_ringbuffer_<SizeT>& rb, void* dst, size_t n) noexcept;
+
+
+// Implementation.
+
+namespace detail {
+
+struct copy_features {
+	bool erms;
+	bool avx2;
+	size_t streaming_threshold;
+};
+
+
+inline copy_features detect_copy_features() noexcept
+{
+	copy_features features {false, false, 4*1024*1024};
+#if defined(__x86_64__)
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		features.erms = ebx & (1u << 9);
+	}
+	features.avx2 = __builtin_cpu_supports("avx2");
+#endif
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+	long const llc = ::sysconf(_SC_LEVEL3_CACHE_SIZE);
+	if (llc > 0) {
+		features.streaming_threshold = static_cast<size_t>(llc) / 2;
+	}
+#endif
+	return features;
+}
+
+
+inline const copy_features& cpu_copy_features() noexcept
+{
+	static const copy_features features = detect_copy_features();
+	return features;
+}
+
+
+#if defined(__x86_64__)
+inline void copy_erms(void* dst, const void* src, size_t n) noexcept
+{
+	asm volatile("rep movsb"
+		: "+D"(dst), "+S"(src), "+c"(n)
+		:
+		: "memory");
+}
+
+
+__attribute__((target("avx2")))
+inline void copy_avx2(void* dst, const void* src, size_t n) noexcept
+{
+	auto d = static_cast<char*>(dst);
+	auto s = static_cast<const char*>(src);
+	for (; n >= 128; d += 128, s += 128, n -= 128) {
+		__m256i const a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s));
+		__m256i const b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 32));
+		__m256i const c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 64));
+		__m256i const e = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + 96));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(d), a);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(d + 32), b);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(d + 64), c);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(d + 96), e);
+	}
+	::memcpy(d, s, n);
+}
+
+
+inline void copy_stream(void* dst, const void* src, size_t n) noexcept
+{
+	// Far enough ahead to hide the memory latency.
+	constexpr size_t PREFETCH_DISTANCE = 512;
+
+	auto d = static_cast<char*>(dst);
+	auto s = static_cast<const char*>(src);
+
+	// Align the destination to a cache line.
+	size_t head = (64 - reinterpret_cast<uintptr_t>(d) % 64) % 64;
+	if (head > n) {
+		head = n;
+	}
+	::memcpy(d, s, head);
+	d += head;
+	s += head;
+	n -= head;
+
+	for (; n >= 64; d += 64, s += 64, n -= 64) {
+		_mm_prefetch(s + PREFETCH_DISTANCE, _MM_HINT_T0);
+		__m128i const a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+		__m128i const b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 16));
+		__m128i const c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 32));
+		__m128i const e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 48));
+		_mm_stream_si128(reinterpret_cast<__m128i*>(d), a);
+		_mm_stream_si128(reinterpret_cast<__m128i*>(d + 16), b);
+		_mm_stream_si128(reinterpret_cast<__m128i*>(d + 32), c);
+		_mm_stream_si128(reinterpret_cast<__m128i*>(d + 48), e);
+	}
+
+	// Make the streamed data visible before anything that follows, e.g. the
+	// release store in `commit()`.
+	_mm_sfence();
+	::memcpy(d, s, n);
+}
+#endif
+
+} // namespace detail
+
+
+inline bool copy_kernel_supported(copy_kernel kernel) noexcept
+{
+	switch (kernel) {
+#if defined(__x86_64__)
+	case copy_kernel::erms:
+		return detail::cpu_copy_features().erms;
+	case copy_kernel::avx2:
+		return detail::cpu_copy_features().avx2;
+	case copy_kernel::stream:
+		return true;
+#endif
+	case copy_kernel::libc:
+		return true;
+	default:
+		return false;
+	}
+}
+
+
+inline size_t bulk_copy_streaming_threshold() noexcept
+{
+	return detail::cpu_copy_features().streaming_threshold;
+}
+
+
+inline copy_kernel select_copy_kernel(size_t n) noexcept
+{
+	if (n < BULK_COPY_MIN) {
+		return copy_kernel::libc;
+	}
+
+#if defined(__x86_64__)
+	detail::copy_features const& features = detail::cpu_copy_features();
+	if (n >= features.streaming_threshold) {
+		return copy_kernel::stream;
+	}
+	if (features.erms) {
+		return copy_kernel::erms;
+	}
+	if (features.avx2) {
+		return copy_kernel::avx2;
+	}
+#endif
+	return copy_kernel::libc;
+}
+
+
+inline void copy_with(copy_kernel kernel, void* dst, const void* src, size_t n) noexcept
+{
+	if (!copy_kernel_supported(kernel)) {
+		kernel = copy_kernel::libc;
+	}
+
+	switch (kernel) {
+#if defined(__x86_64__)
+	case copy_kernel::erms:
+		detail::copy_erms(dst, src, n);
+		return;
+	case copy_kernel::avx2:
+		detail::copy_avx2(dst, src, n);
+		return;
+	case copy_kernel::stream:
+		detail::copy_stream(dst, src, n);
+		return;
+#endif
+	default:
+		::memcpy(dst, src, n);
+		return;
+	}
+}
+
+
+inline void bulk_copy(void* dst, const void* src, size_t n) noexcept
+{
+	if (n < BULK_COPY_MIN) {
+		::memcpy(dst, src, n);
+		return;
+	}
+	copy_with(select_copy_kernel(n), dst, src, n);
+}
+
+
+template<typename SizeT>
+size_t put(linear_ringbuffer_<SizeT>& rb, const void* src, size_t n) noexcept
+{
+	auto const s = rb.prepare(n < SizeT(-1) ? SizeT(n) : SizeT(-1));
+	bulk_copy(s.data, src, s.size);
+	rb.commit(s.size);
+	return s.size;
+}
+
+
+template<typename SizeT>
+size_t get(linear_ringbuffer_<SizeT>& rb, void* dst, size_t n) noexcept
+{
+	size_t const size = rb.size();
+	if (n > size) {
+		n = size;
+	}
+	bulk_copy(dst, rb.read_head(), n);
+	rb.consume(n);
+	return n;
+}
+
+} // namespace bev
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#include <sys/types.h>
+#include <unistd.h>
+
+#if defined(__cpp_concepts) && __has_include(<concepts>)
+#include <concepts>
+#define BEV_HAS_BYTE_STREAM_CONCEPT 1
+#endif
+
+namespace bev {
+
+// # Byte Stream Buffer
+//
+// The common interface of the byte buffers in this repository, so that
+// transfer loops, parsers and I/O engines can be written once as templates
+// and work with any of them, without virtual dispatch:
+//
+//     b.prepare(n)    -> slab with `.data` and `.size`, at most `n` bytes
+//     b.commit(n)
+//     b.consume(n)
+//     b.clear()
+//     b.read_head()   -> pointer to `b.size()` bytes of data
+//     b.write_head()
+//     b.size()
+//     b.free_size()
+//     b.capacity()
+//
+// This is modelled by `linear_ringbuffer_`, `io_buffer_view` and `io_buffer`,
+// `pooled_io_buffer` and `growable_io_buffer`. The ringbuffer exposes
+// `unsigned char` and the others `char`, so the free functions below return
+// both the free and the used area as `bytes`.
+//
+// With C++20, the requirements are available as concept `byte_stream_buffer`.
+// The trait `is_byte_stream_buffer` checks the same in C++17, and is what the
+// free functions are constrained with.
+//
+//
+// # Usage
+//
+//     template<typename Buffer>
+//     void echo(int fd, Buffer& b)
+//     {
+//         while (bev::read_some(fd, b, 64*1024) > 0) {
+//             bev::write_some(fd, b);
+//         }
+//     }
+//
+//
+// # Errors and Exceptions
+//
+// `read_some()` and `write_some()` return the result of `::read()` resp.
+// `::write()`, with `errno` set on error, and only commit resp. consume the
+// bytes that were actually transferred. The other functions are noexcept if
+// the corresponding member functions of the buffer are.
+//
+//
+// # Concurrency
+//
+// Same as for the underlying buffer.
+//
+
+struct bytes {
+	unsigned char* data;
+	size_t size;
+};
+
+
+template<typename Buffer, typename = void>
+struct is_byte_stream_buffer : std::false_type {};
+
+template<typename Buffer>
+struct is_byte_stream_buffer<Buffer, std::void_t<
+	decltype(static_cast<const void*>(std::declval<Buffer&>().prepare(size_t()).data)),
+	decltype(size_t(std::declval<Buffer&>().prepare(size_t()).size)),
+	decltype(std::declval<Buffer&>().commit(size_t())),
+	decltype(std::declval<Buffer&>().consume(size_t())),
+	decltype(std::declval<Buffer&>().clear()),
+	decltype(static_cast<const void*>(std::declval<Buffer&>().read_head())),
+	decltype(static_cast<const void*>(std::declval<Buffer&>().write_head())),
+	decltype(size_t(std::declval<const Buffer&>().size())),
+	decltype(size_t(std::declval<const Buffer&>().free_size())),
+	decltype(size_t(std::declval<const Buffer&>().capacity()))>>
+  : std::true_type {};
+
+
+#if defined(BEV_HAS_BYTE_STREAM_CONCEPT)
+template<typename Buffer>
+concept byte_stream_buffer = requires(Buffer& b, const Buffer& cb, size_t n) {
+	{ b.prepare(n).data } -> std::convertible_to<const void*>;
+	{ b.prepare(n).size } -> std::convertible_to<size_t>;
+	b.commit(n);
+	b.consume(n);
+	b.clear();
+	{ b.read_head() } -> std::convertible_to<const void*>;
+	{ b.write_head() } -> std::convertible_to<const void*>;
+	{ cb.size() } -> std::convertible_to<size_t>;
+	{ cb.free_size() } -> std::convertible_to<size_t>;
+	{ cb.capacity() } -> std::convertible_to<size_t>;
+};
+#endif
+
+
+template<typename Buffer>
+using require_byte_stream_buffer = std::enable_if_t<is_byte_stream_buffer<Buffer>::value, int>;
+
+
+// Free space for at least `n` bytes, if possible.
+template<typename Buffer, require_byte_stream_buffer<Buffer> = 0>
+bytes prepare(Buffer& b, size_t n) noexcept(noexcept(b.prepare(n)));
+
+template<typename Buffer, require_byte_stream_buffer<Buffer> = 0>
+void commit(Buffer& b, size_t n) noexcept(noexcept(b.commit(n)));
+
+// The data in the buffer.
+template<typename Buffer, require_byte_stream_buffer<Buffer> = 0>
+bytes data(Buffer& b) noexcept(noexcept(b.read_head()));
+
+template<typename Buffer, require_byte_stream_buffer<Buffer> = 0>
+void consume(Buffer& b, size_t n) noexcept(noexcept(b.consume(n)));
+
+// Reads up to `n` bytes from `fd` into the buffer.
+template<typename Buffer, require_byte_stream_buffer<Buffer> = 0>
+ssize_t read_some(int fd, Buffer& b, size_t n);
+
+// Writes the data in the buffer to `fd`.
+template<typename Buffer, require_byte_stream_buffer<Buffer> = 0>
+ssize_t write_some(int fd, Buffer& b);
+
+
+// Implementation.
+
+template<typename Buffer, require_byte_stream_buffer<Buffer>>
+bytes prepare(Buffer& b, size_t n) noexcept(noexcept(b.prepare(n)))
+{
+	// Don't let the request wrap around in a smaller size type.
+	typedef decltype(b.capacity()) size_type;
+	auto const slab = b.prepare(std::min<size_t>(n, std::numeric_limits<size_type>::max()));
+	return bytes {reinterpret_cast<unsigned char*>(slab.data), slab.size};
+}
+
+
+template<typename Buffer, require_byte_stream_buffer<Buffer>>
+void commit(Buffer& b, size_t n) noexcept(noexcept(b.commit(n)))
+{
+	b.commit(n);
+}
+
+
+template<typename Buffer, require_byte_stream_buffer<Buffer>>
+bytes data(Buffer& b) noexcept(noexcept(b.read_head()))
+{
+	return bytes {reinterpret_cast<unsigned char*>(b.read_head()), b.size()};
+}
+
+
+template<typename Buffer, require_byte_stream_buffer<Buffer>>
+void consume(Buffer& b, size_t n) noexcept(noexcept(b.consume(n)))
+{
+	b.consume(n);
+}
+
+
+template<typename Buffer, require_byte_stream_buffer<Buffer>>
+ssize_t read_some(int fd, Buffer& b, size_t n)
+{
+	bytes const free = bev::prepare(b, n);
+	ssize_t const res = ::read(fd, free.data, free.size);
+
+	// Committing nothing lets e.g. a `pooled_io_buffer` give back its slab.
+	b.commit(res > 0 ? res : 0);
+	return res;
+}
+
+
+template<typename Buffer, require_byte_stream_buffer<Buffer>>
+ssize_t write_some(int fd, Buffer& b)
+{
+	ssize_t const res = ::write(fd, b.read_head(), b.size());
+	if (res > 0) {
+		b.consume(res);
+	}
+	return res;
+}
+
+} // namespace bev
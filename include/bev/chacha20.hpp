@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace bev {
+
+// # ChaCha20
+//
+// The ChaCha20 stream cipher as specified in RFC 8439, with a 256-bit key, a
+// 96-bit nonce and a 32-bit block counter. Usable as a `pipeline` stage or on
+// its own.
+//
+// Encryption and decryption are the same operation, XOR-ing the data with the
+// key stream. The cipher can be applied to data of any length in any number
+// of pieces, the position in the key stream carries over between calls.
+//
+// NOTE: This provides confidentiality only. Without a MAC, e.g. Poly1305,
+// the ciphertext can be tampered with undetected. A key and nonce pair must
+// never be used for more than one stream.
+//
+//
+// # Usage
+//
+//     bev::chacha20 cipher(key, nonce);
+//     cipher.apply(data, data, n); // In place.
+//
+// As a stage, the cipher transforms as much input as fits into the output.
+//
+//
+// # Concurrency
+//
+// Each stream needs its own instance.
+//
+
+class chacha20 {
+public:
+	static constexpr size_t KEY_SIZE = 32;
+	static constexpr size_t NONCE_SIZE = 12;
+	static constexpr size_t BLOCK_LENGTH = 64;
+
+	chacha20(const unsigned char* key, const unsigned char* nonce, uint32_t counter = 0) noexcept;
+
+	// XORs `n` bytes of key stream into `[in, in+n)` and writes the result to
+	// `out`, which may be equal to `in`.
+	void apply(const unsigned char* in, unsigned char* out, size_t n) noexcept;
+
+	int transform(const unsigned char*& in, const unsigned char* in_end,
+		unsigned char*& out, unsigned char* out_end, bool flush) noexcept;
+
+	// Writes the key stream block for the current counter to `out`.
+	void block(unsigned char* out) const noexcept;
+
+private:
+	uint32_t state_[16];
+	unsigned char keystream_[BLOCK_LENGTH];
+	size_t used_; // Bytes of `keystream_` already used.
+};
+
+
+// Implementation.
+
+namespace detail {
+
+inline uint32_t chacha_load32(const unsigned char* p) noexcept
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+}
+
+
+inline uint32_t chacha_rotl(uint32_t x, int n) noexcept
+{
+	return x << n | x >> (32 - n);
+}
+
+
+inline void chacha_quarter_round(uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d) noexcept
+{
+	a += b; d ^= a; d = chacha_rotl(d, 16);
+	c += d; b ^= c; b = chacha_rotl(b, 12);
+	a += b; d ^= a; d = chacha_rotl(d, 8);
+	c += d; b ^= c; b = chacha_rotl(b, 7);
+}
+
+} // namespace detail
+
+
+inline chacha20::chacha20(const unsigned char* key, const unsigned char* nonce, uint32_t counter) noexcept
+  : used_(BLOCK_LENGTH)
+{
+	// "expand 32-byte k"
+	state_[0] = 0x61707865;
+	state_[1] = 0x3320646e;
+	state_[2] = 0x79622d32;
+	state_[3] = 0x6b206574;
+	for (int i = 0; i < 8; ++i) {
+		state_[4 + i] = detail::chacha_load32(key + 4*i);
+	}
+	state_[12] = counter;
+	for (int i = 0; i < 3; ++i) {
+		state_[13 + i] = detail::chacha_load32(nonce + 4*i);
+	}
+}
+
+
+inline void chacha20::block(unsigned char* out) const noexcept
+{
+	using detail::chacha_quarter_round;
+
+	uint32_t x[16];
+	::memcpy(x, state_, sizeof x);
+	for (int i = 0; i < 10; ++i) {
+		chacha_quarter_round(x[0], x[4], x[8], x[12]);
+		chacha_quarter_round(x[1], x[5], x[9], x[13]);
+		chacha_quarter_round(x[2], x[6], x[10], x[14]);
+		chacha_quarter_round(x[3], x[7], x[11], x[15]);
+		chacha_quarter_round(x[0], x[5], x[10], x[15]);
+		chacha_quarter_round(x[1], x[6], x[11], x[12]);
+		chacha_quarter_round(x[2], x[7], x[8], x[13]);
+		chacha_quarter_round(x[3], x[4], x[9], x[14]);
+	}
+	for (int i = 0; i < 16; ++i) {
+		uint32_t const v = x[i] + state_[i];
+		out[4*i] = v;
+		out[4*i + 1] = v >> 8;
+		out[4*i + 2] = v >> 16;
+		out[4*i + 3] = v >> 24;
+	}
+}
+
+
+inline void chacha20::apply(const unsigned char* in, unsigned char* out, size_t n) noexcept
+{
+	while (n > 0) {
+		if (used_ == BLOCK_LENGTH) {
+			this->block(keystream_);
+			++state_[12];
+			used_ = 0;
+		}
+
+		size_t const k = std::min(n, BLOCK_LENGTH - used_);
+		if (k == BLOCK_LENGTH) {
+			// Whole blocks, a word at a time.
+			for (size_t i = 0; i < BLOCK_LENGTH; i += 8) {
+				uint64_t a, b;
+				::memcpy(&a, in + i, 8);
+				::memcpy(&b, keystream_ + i, 8);
+				a ^= b;
+				::memcpy(out + i, &a, 8);
+			}
+		} else {
+			for (size_t i = 0; i < k; ++i) {
+				out[i] = in[i] ^ keystream_[used_ + i];
+			}
+		}
+		used_ += k;
+		in += k;
+		out += k;
+		n -= k;
+	}
+}
+
+
+inline int chacha20::transform(const unsigned char*& in, const unsigned char* in_end,
+	unsigned char*& out, unsigned char* out_end, bool) noexcept
+{
+	size_t const n = std::min(in_end - in, out_end - out);
+	this->apply(in, out, n);
+	in += n;
+	out += n;
+	return 0;
+}
+
+} // namespace bev
@@ -0,0 +1,510 @@
+#pragma once
+
+#include <bev/linear_ringbuffer.hpp>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace bev {
+
+// # Checksummed Ringbuffer
+//
+// A `linear_ringbuffer_` that computes a running CRC32C over every byte
+// passing through `commit()`.
+//
+// Checksumming the data right before it is persisted or sent means another
+// pass over memory that is likely cold by then. Here the bytes in
+// `[write_head(), write_head()+n)` are hashed inside `commit(n)`, while the
+// caller just wrote them and they are still hot in the cache.
+//
+// The CRC is computed with the SSE4.2 `crc32` instruction if the CPU supports
+// it (detected at runtime), and with a slicing-by-8 table otherwise.
+//
+//
+// # Usage
+//
+//     bev::checksummed_ringbuffer rb;
+//     auto from = rb.mark();
+//     ssize_t n = ::read(fd, rb.write_head(), rb.free_size());
+//     rb.commit(n);
+//     [...]
+//     auto to = rb.mark();
+//     uint32_t crc = bev::checksummed_ringbuffer::digest(from, to);
+//
+// `digest(from, to)` is the CRC32C of exactly the bytes committed between
+// the two marks, derived from the two running digests in constant time
+// without looking at the data again. `digest()` is the CRC32C of everything
+// committed since construction; `clear()` does not reset it.
+//
+// Consumers don't have to be handed checkpoints. Every `commit()` also
+// appends its checkpoint to a log that keeps the most recent
+// `Checkpoints - 1` of them, 1023 by default, so the consumer can ask for
+// the digest of any range between two commit boundaries that are still in
+// the log, identified by their offsets in the stream:
+//
+//     uint32_t crc;
+//     size_t n = rb.size(); // Always ends on a commit boundary.
+//     if (rb.digest(offset, offset + n, crc) == 0) {
+//         [the CRC32C of `[read_head(), read_head()+n)` is `crc`]
+//     }
+//     rb.consume(n);
+//     offset += n;
+//
+// The CRC32C functions are also available on their own as `bev::crc32c()`
+// and `bev::crc32c_combine()`.
+//
+//
+// # Errors and Exceptions
+//
+// Initialization behaves exactly like for `linear_ringbuffer_`.
+//
+// `digest(from_offset, to_offset, crc)` returns -1 and sets `errno` if it
+// can't answer the query:
+//
+//  ERANGE - A boundary is older than the oldest checkpoint in the log, i.e.
+//           it has been overwritten by later commits.
+//
+//  EINVAL - A boundary is not the offset of any commit, was not committed
+//           yet, or `from_offset` is greater than `to_offset`.
+//
+//
+// # Concurrency
+//
+// Same as `linear_ringbuffer_`. The running digest belongs to the writing
+// side, so `mark()` and `digest()` must be called by the producer, which can
+// pass the checkpoints along with the data.
+//
+// `digest(from_offset, to_offset, crc)` may be called by the consumer. The
+// producer publishes each log entry with a release store of the number of
+// checkpoints before making the committed bytes readable, so the boundary
+// at the end of the readable bytes is always in the log. Entries that the
+// producer overwrites while they are being read are detected, seqlock-style,
+// and the lookup is retried.
+//
+
+// Continues the CRC32C `crc` of some previous data with `[data, data+n)`.
+// Start with `crc = 0`.
+inline uint32_t crc32c(uint32_t crc, const void* data, size_t n) noexcept;
+
+// Returns the CRC32C of the concatenation AB from the CRC32Cs of A and B
+// and the length of B.
+inline uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t length_b) noexcept;
+
+
+template<typename SizeT = size_t, size_t Checkpoints = 1024>
+class checksummed_ringbuffer_ {
+public:
+	static_assert(Checkpoints >= 2 && (Checkpoints & (Checkpoints - 1)) == 0,
+		"Checkpoints must be a power of two.");
+
+	typedef typename linear_ringbuffer_<SizeT>::value_type value_type;
+	typedef typename linear_ringbuffer_<SizeT>::iterator iterator;
+	typedef typename linear_ringbuffer_<SizeT>::const_iterator const_iterator;
+	typedef typename linear_ringbuffer_<SizeT>::delayed_init delayed_init;
+
+	// The running digest after `offset` committed bytes.
+	struct checkpoint {
+		uint64_t offset;
+		uint32_t digest;
+	};
+
+	checksummed_ringbuffer_(SizeT minsize = 640*1024);
+	checksummed_ringbuffer_(const delayed_init) noexcept;
+	int initialize(SizeT minsize) noexcept;
+
+	// Hashes `[write_head(), write_head()+n)` and makes it readable.
+	void commit(SizeT n) noexcept;
+	void consume(SizeT n) noexcept;
+	iterator read_head() noexcept;
+	iterator write_head() noexcept;
+	void clear() noexcept;
+
+	bool empty() const noexcept;
+	SizeT size() const noexcept;
+	SizeT capacity() const noexcept;
+	SizeT free_size() const noexcept;
+	const_iterator begin() const noexcept;
+	const_iterator end() const noexcept;
+
+	uint32_t digest() const noexcept;
+	checkpoint mark() const noexcept;
+
+	// The CRC32C of the bytes committed between two marks.
+	static uint32_t digest(checkpoint from, checkpoint to) noexcept;
+
+	// The CRC32C of the bytes committed between two commit boundaries in the
+	// checkpoint log, see description above.
+	int digest(uint64_t from_offset, uint64_t to_offset, uint32_t& crc) const noexcept;
+
+	// The underlying buffer. Bytes committed through it are not hashed.
+	linear_ringbuffer_<SizeT>& buffer() noexcept;
+
+private:
+	// Looks up the checkpoint at `offset` among the entries `[first, last)`
+	// of the log, and lowers `touched` to the oldest entry it looked at.
+	int find(uint64_t offset, uint64_t first, uint64_t last,
+		uint64_t& touched, checkpoint& result) const noexcept;
+
+	linear_ringbuffer_<SizeT> rb_;
+	uint64_t committed_;
+	uint32_t digest_;
+
+	// Entry `i` of the log is stored at `log_[i % Checkpoints]`, `count_` is
+	// the number of entries ever written.
+	checkpoint log_[Checkpoints];
+	uint64_t count_;
+};
+
+
+using checksummed_ringbuffer = checksummed_ringbuffer_<size_t>;
+
+
+// Implementation.
+
+namespace detail {
+
+// Reflected CRC32C (Castagnoli) polynomial.
+constexpr uint32_t CRC32C_POLY = 0x82f63b78;
+
+
+struct crc32c_tables {
+	uint32_t t[8][256];
+
+	constexpr crc32c_tables() noexcept
+	  : t()
+	{
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k) {
+				c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+			}
+			t[0][i] = c;
+		}
+		for (uint32_t i = 0; i < 256; ++i) {
+			for (int k = 1; k < 8; ++k) {
+				t[k][i] = (t[k-1][i] >> 8) ^ t[0][t[k-1][i] & 0xff];
+			}
+		}
+	}
+};
+
+
+inline uint32_t crc32c_sw(uint32_t crc, const unsigned char* p, size_t n) noexcept
+{
+	static constexpr crc32c_tables tables {};
+	auto const& t = tables.t;
+
+	for (; n >= 8; p += 8, n -= 8) {
+		uint64_t word;
+		::memcpy(&word, p, 8);
+		word ^= crc;
+		crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff]
+			^ t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff]
+			^ t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff]
+			^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+	}
+	for (; n > 0; ++p, --n) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *p) & 0xff];
+	}
+	return crc;
+}
+
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+inline uint32_t crc32c_hw(uint32_t crc, const unsigned char* p, size_t n) noexcept
+{
+	uint64_t c = crc;
+	for (; n >= 8; p += 8, n -= 8) {
+		uint64_t word;
+		::memcpy(&word, p, 8);
+		c = _mm_crc32_u64(c, word);
+	}
+	for (; n > 0; ++p, --n) {
+		c = _mm_crc32_u8(static_cast<uint32_t>(c), *p);
+	}
+	return static_cast<uint32_t>(c);
+}
+#endif
+
+
+// Returns `a * b` modulo the polynomial, both in reflected bit order.
+inline uint32_t crc32c_multiply(uint32_t a, uint32_t b) noexcept
+{
+	uint32_t product = 0;
+	for (uint32_t m = 1u << 31; m != 0; m >>= 1) {
+		if (a & m) {
+			product ^= b;
+		}
+		b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return product;
+}
+
+
+// Returns `x^(8*n)` modulo the polynomial, which shifts a CRC over `n` zero
+// bytes when multiplied with it.
+inline uint32_t crc32c_shift(uint64_t n) noexcept
+{
+	uint32_t result = 1u << 31;  // x^0
+	uint32_t square = 1u << 23;  // x^8
+	for (; n != 0; n >>= 1) {
+		if (n & 1) {
+			result = crc32c_multiply(result, square);
+		}
+		square = crc32c_multiply(square, square);
+	}
+	return result;
+}
+
+} // namespace detail
+
+
+inline uint32_t crc32c(uint32_t crc, const void* data, size_t n) noexcept
+{
+	auto p = static_cast<const unsigned char*>(data);
+	crc = ~crc;
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("sse4.2")) {
+		return ~detail::crc32c_hw(crc, p, n);
+	}
+#endif
+	return ~detail::crc32c_sw(crc, p, n);
+}
+
+
+inline uint32_t crc32c_combine(uint32_t crc_a, uint32_t crc_b, uint64_t length_b) noexcept
+{
+	// The CRC is linear, and the pre- and post-conditioning of A and B
+	// cancel out, so AB is just A shifted over B, added to B.
+	return detail::crc32c_multiply(detail::crc32c_shift(length_b), crc_a) ^ crc_b;
+}
+
+
+// The log starts out with the checkpoint at offset 0.
+
+template<typename SizeT, size_t Checkpoints>
+checksummed_ringbuffer_<SizeT, Checkpoints>::checksummed_ringbuffer_(SizeT minsize)
+  : rb_(minsize)
+  , committed_(0)
+  , digest_(0)
+  , log_()
+  , count_(1)
+{}
+
+
+template<typename SizeT, size_t Checkpoints>
+checksummed_ringbuffer_<SizeT, Checkpoints>::checksummed_ringbuffer_(const delayed_init) noexcept
+  : rb_(delayed_init {})
+  , committed_(0)
+  , digest_(0)
+  , log_()
+  , count_(1)
+{}
+
+
+template<typename SizeT, size_t Checkpoints>
+int checksummed_ringbuffer_<SizeT, Checkpoints>::initialize(SizeT minsize) noexcept
+{
+	return rb_.initialize(minsize);
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+void checksummed_ringbuffer_<SizeT, Checkpoints>::commit(SizeT n) noexcept
+{
+	digest_ = crc32c(digest_, rb_.write_head(), n);
+	committed_ += n;
+
+	// Offsets in the log must be strictly increasing.
+	if (n > 0) {
+		// Any reader that sees part of the new entry must also see the
+		// count that invalidates the entry it replaces.
+		uint64_t const count = count_;
+		checkpoint& entry = log_[count % Checkpoints];
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		__atomic_store_n(&entry.offset, committed_, __ATOMIC_RELAXED);
+		__atomic_store_n(&entry.digest, digest_, __ATOMIC_RELAXED);
+		__atomic_store_n(&count_, count + 1, __ATOMIC_RELEASE);
+	}
+
+	rb_.commit(n);
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+void checksummed_ringbuffer_<SizeT, Checkpoints>::consume(SizeT n) noexcept
+{
+	rb_.consume(n);
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+auto checksummed_ringbuffer_<SizeT, Checkpoints>::read_head() noexcept -> iterator
+{
+	return rb_.read_head();
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+auto checksummed_ringbuffer_<SizeT, Checkpoints>::write_head() noexcept -> iterator
+{
+	return rb_.write_head();
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+void checksummed_ringbuffer_<SizeT, Checkpoints>::clear() noexcept
+{
+	rb_.clear();
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+bool checksummed_ringbuffer_<SizeT, Checkpoints>::empty() const noexcept
+{
+	return rb_.empty();
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+SizeT checksummed_ringbuffer_<SizeT, Checkpoints>::size() const noexcept
+{
+	return rb_.size();
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+SizeT checksummed_ringbuffer_<SizeT, Checkpoints>::capacity() const noexcept
+{
+	return rb_.capacity();
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+SizeT checksummed_ringbuffer_<SizeT, Checkpoints>::free_size() const noexcept
+{
+	return rb_.free_size();
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+auto checksummed_ringbuffer_<SizeT, Checkpoints>::begin() const noexcept -> const_iterator
+{
+	return rb_.begin();
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+auto checksummed_ringbuffer_<SizeT, Checkpoints>::end() const noexcept -> const_iterator
+{
+	return rb_.end();
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+uint32_t checksummed_ringbuffer_<SizeT, Checkpoints>::digest() const noexcept
+{
+	return digest_;
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+auto checksummed_ringbuffer_<SizeT, Checkpoints>::mark() const noexcept -> checkpoint
+{
+	return checkpoint {committed_, digest_};
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+uint32_t checksummed_ringbuffer_<SizeT, Checkpoints>::digest(checkpoint from, checkpoint to) noexcept
+{
+	// Solving `crc32c_combine(from, x, n) == to` for x, the shifted CRC of
+	// the prefix simply cancels out.
+	uint64_t const n = to.offset - from.offset;
+	return detail::crc32c_multiply(detail::crc32c_shift(n), from.digest) ^ to.digest;
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+int checksummed_ringbuffer_<SizeT, Checkpoints>::digest(
+	uint64_t from_offset, uint64_t to_offset, uint32_t& crc) const noexcept
+{
+	if (from_offset > to_offset) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	while (true) {
+		uint64_t const count = __atomic_load_n(&count_, __ATOMIC_ACQUIRE);
+		// The slot of the oldest entry may already be in the process of
+		// being overwritten with entry `count`.
+		uint64_t const first = count >= Checkpoints ? count - Checkpoints + 1 : 0;
+		uint64_t touched = count;
+		checkpoint from {}, to {};
+		int const error_from = this->find(from_offset, first, count, touched, from);
+		int const error_to = this->find(to_offset, first, count, touched, to);
+
+		// If the producer has started to overwrite any of the entries we
+		// looked at, they may be torn and we have to look again.
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&count_, __ATOMIC_RELAXED) - touched >= Checkpoints) {
+			continue;
+		}
+
+		if (error_from || error_to) {
+			errno = error_from ? error_from : error_to;
+			return -1;
+		}
+
+		crc = digest(from, to);
+		return 0;
+	}
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+int checksummed_ringbuffer_<SizeT, Checkpoints>::find(uint64_t offset, uint64_t first,
+	uint64_t last, uint64_t& touched, checkpoint& result) const noexcept
+{
+	// Binary search for the first entry not before `offset`.
+	uint64_t lo = first;
+	uint64_t hi = last;
+	while (lo < hi) {
+		uint64_t const mid = lo + (hi - lo) / 2;
+		touched = mid < touched ? mid : touched;
+		if (__atomic_load_n(&log_[mid % Checkpoints].offset, __ATOMIC_RELAXED) < offset) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (lo == last) {
+		return EINVAL;
+	}
+
+	touched = lo < touched ? lo : touched;
+	checkpoint const& entry = log_[lo % Checkpoints];
+	result.offset = __atomic_load_n(&entry.offset, __ATOMIC_RELAXED);
+	result.digest = __atomic_load_n(&entry.digest, __ATOMIC_RELAXED);
+	if (result.offset != offset) {
+		return lo == first ? ERANGE : EINVAL;
+	}
+	return 0;
+}
+
+
+template<typename SizeT, size_t Checkpoints>
+auto checksummed_ringbuffer_<SizeT, Checkpoints>::buffer() noexcept -> linear_ringbuffer_<SizeT>&
+{
+	return rb_;
+}
+
+} // namespace bev
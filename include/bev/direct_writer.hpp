@@ -0,0 +1,403 @@
+#pragma once
+
+#include <bev/linear_ringbuffer.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+#include <vector>
+
+#include <unistd.h>
+
+#include <linux/aio_abi.h>
+#include <sys/syscall.h>
+
+namespace bev {
+
+// # Direct Writer
+//
+// Drains a `linear_ringbuffer_` into a file opened with `O_DIRECT`, keeping
+// multiple writes in flight using the kernel's native asynchronous I/O
+// interface.
+//
+// Direct I/O bypasses the page cache, but requires that the memory address,
+// the file offset and the length of every write are multiples of the logical
+// block size of the device. The buffer area of a `linear_ringbuffer_` is page
+// aligned and contiguous across the wrap-around, so as long as the read head
+// is only ever advanced by multiples of the block size, the largest aligned
+// prefix of the readable data can be handed to the kernel without copying:
+//
+//     +------------------------------------------------------+
+//     |  aligned_size(rb, 4096)                | tail |       |
+//     +------------------------------------------------------+
+//      ^ read_head()                                 ^ end()
+//
+// The unaligned tail stays in the buffer until more data arrives, or until
+// `finish()` writes it padded with zeroes and truncates the file to its
+// actual length.
+//
+//
+// # Usage
+//
+//     int fd = ::open("capture.dat", O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+//     bev::direct_writer w(fd);
+//     while (running) {
+//         [produce data into rb]
+//         if (w.submit(rb) < 0 || w.reap(rb, 0) < 0) {
+//             [...]
+//         }
+//     }
+//     w.finish(rb);
+//
+// `submit()` never blocks, `reap(rb, n)` waits until at least `n` writes
+// have completed and consumes the data of all writes completed in order.
+//
+// The writer also works for files opened without `O_DIRECT`, although the
+// kernel then performs the writes synchronously.
+//
+//
+// # Errors and Exceptions
+//
+// Like `linear_ringbuffer_`, the writer can either be initialized by the
+// constructor, which throws a `std::system_error` on failure, or using
+// `direct_writer(delayed_init {})` followed by `initialize()`, which returns
+// -1 and sets `errno`.
+//
+// After initialization, all member functions are noexcept and return -1 and
+// set `errno` on failure. A short write is reported as `EIO`.
+//
+// A write that fails or comes up short is not consumed. Its data stays in the
+// buffer, writes after it are not consumed either, and the next `submit()`
+// writes it again at the same offset, so the file never has holes.
+//
+//
+// # Concurrency
+//
+// All member functions must be called from the consumer thread of the buffer.
+// A single producer may keep committing data concurrently.
+//
+
+// Largest aligned prefix of the readable data of `rb`.
+template<typename SizeT>
+SizeT aligned_size(const linear_ringbuffer_<SizeT>& rb, size_t alignment) noexcept;
+
+
+class direct_writer {
+public:
+	struct delayed_init {};
+
+	direct_writer(int fd, off_t offset = 0, unsigned depth = 4,
+		size_t chunk_size = 1024*1024, size_t alignment = 4096);
+	~direct_writer() noexcept;
+
+	direct_writer(const delayed_init) noexcept;
+	int initialize(int fd, off_t offset, unsigned depth,
+		size_t chunk_size, size_t alignment) noexcept;
+
+	// Submit writes for aligned data that is not yet in flight, and again
+	// for writes that have failed.
+	template<typename SizeT>
+	int submit(linear_ringbuffer_<SizeT>& rb) noexcept;
+
+	// Wait for `min_complete` writes to complete and consume all bytes
+	// written so far. Returns the number of bytes consumed.
+	template<typename SizeT>
+	ssize_t reap(linear_ringbuffer_<SizeT>& rb, unsigned min_complete) noexcept;
+
+	// Write out all remaining data including the unaligned tail. No more
+	// data may be submitted afterwards.
+	template<typename SizeT>
+	int finish(linear_ringbuffer_<SizeT>& rb) noexcept;
+
+	unsigned in_flight() const noexcept; // Submitted writes, excluding failed ones.
+	off_t offset() const noexcept; // File offset of the next byte to be consumed.
+
+	direct_writer(const direct_writer&) = delete;
+	direct_writer& operator=(const direct_writer&) = delete;
+
+private:
+	enum slot_state {
+		IN_FLIGHT,
+		DONE,
+		FAILED,
+	};
+
+	struct slot {
+		off_t offset;
+		size_t length;
+		slot_state state;
+	};
+
+	template<typename SizeT>
+	int submit_slot(linear_ringbuffer_<SizeT>& rb, unsigned i) noexcept;
+	int write_tail(const unsigned char* data, size_t n) noexcept;
+
+	aio_context_t ctx_;
+	int fd_;
+	off_t offset_;
+	size_t chunk_size_;
+	size_t alignment_;
+
+	// Submitted writes in order of their file offsets. A write's data is
+	// only consumed after it and all writes before it have completed.
+	std::vector<slot> slots_;
+	std::vector<struct iocb> iocbs_;
+	unsigned first_;
+	unsigned count_;
+	unsigned in_flight_;
+	size_t submitted_; // Bytes beyond the read head that were submitted.
+};
+
+
+// Implementation.
+
+template<typename SizeT>
+SizeT aligned_size(const linear_ringbuffer_<SizeT>& rb, size_t alignment) noexcept
+{
+	assert((alignment & (alignment-1)) == 0);
+	assert(reinterpret_cast<uintptr_t>(rb.begin()) % alignment == 0);
+	return rb.size() & ~static_cast<SizeT>(alignment-1);
+}
+
+
+inline direct_writer::direct_writer(const delayed_init) noexcept
+  : ctx_(0)
+  , fd_(-1)
+  , offset_(0)
+  , chunk_size_(0)
+  , alignment_(0)
+  , first_(0)
+  , count_(0)
+  , in_flight_(0)
+  , submitted_(0)
+{}
+
+
+inline direct_writer::direct_writer(int fd, off_t offset, unsigned depth,
+		size_t chunk_size, size_t alignment)
+  : direct_writer(delayed_init {})
+{
+	int res = this->initialize(fd, offset, depth, chunk_size, alignment);
+	if (res == -1) {
+		throw std::system_error {errno, std::system_category(), __PRETTY_FUNCTION__};
+	}
+}
+
+
+inline int direct_writer::initialize(int fd, off_t offset, unsigned depth,
+		size_t chunk_size, size_t alignment) noexcept
+{
+	if (depth == 0 || alignment == 0 || (alignment & (alignment-1))
+			|| offset % alignment || chunk_size < alignment) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	try {
+		slots_.resize(depth);
+		iocbs_.resize(depth);
+	} catch (const std::bad_alloc&) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	if (::syscall(SYS_io_setup, depth, &ctx_) < 0) {
+		return -1;
+	}
+
+	fd_ = fd;
+	offset_ = offset;
+	chunk_size_ = chunk_size & ~(alignment-1);
+	alignment_ = alignment;
+	return 0;
+}
+
+
+inline direct_writer::~direct_writer() noexcept
+{
+	// Waits for all writes in flight to complete.
+	if (ctx_) {
+		::syscall(SYS_io_destroy, ctx_);
+	}
+}
+
+
+template<typename SizeT>
+int direct_writer::submit_slot(linear_ringbuffer_<SizeT>& rb, unsigned i) noexcept
+{
+	slot& s = slots_[i];
+	struct iocb& cb = iocbs_[i];
+	::memset(&cb, 0, sizeof cb);
+	cb.aio_data = i;
+	cb.aio_fildes = fd_;
+	cb.aio_lio_opcode = IOCB_CMD_PWRITE;
+	cb.aio_buf = reinterpret_cast<uintptr_t>(rb.read_head() + (s.offset - offset_));
+	cb.aio_nbytes = s.length;
+	cb.aio_offset = s.offset;
+
+	struct iocb* list[1] = {&cb};
+	if (::syscall(SYS_io_submit, ctx_, 1, list) != 1) {
+		return -1;
+	}
+
+	s.state = IN_FLIGHT;
+	++in_flight_;
+	return 0;
+}
+
+
+template<typename SizeT>
+int direct_writer::submit(linear_ringbuffer_<SizeT>& rb) noexcept
+{
+	size_t const available = aligned_size(rb, alignment_);
+	unsigned const depth = slots_.size();
+
+	// Retry failed writes first, they hold up everything after them.
+	for (unsigned k = 0; k < count_; ++k) {
+		unsigned const i = (first_ + k) % depth;
+		if (slots_[i].state == FAILED && this->submit_slot(rb, i) < 0) {
+			return -1;
+		}
+	}
+
+	while (count_ < depth && submitted_ < available) {
+		unsigned const i = (first_ + count_) % depth;
+		size_t const length = std::min(chunk_size_, available - submitted_);
+
+		slots_[i] = slot {static_cast<off_t>(offset_ + submitted_), length, FAILED};
+		if (this->submit_slot(rb, i) < 0) {
+			return -1;
+		}
+		submitted_ += length;
+		++count_;
+	}
+
+	return 0;
+}
+
+
+template<typename SizeT>
+ssize_t direct_writer::reap(linear_ringbuffer_<SizeT>& rb, unsigned min_complete) noexcept
+{
+	unsigned const depth = slots_.size();
+	struct io_event events[64];
+	int error = 0;
+
+	min_complete = std::min(min_complete, in_flight_);
+	while (in_flight_ > 0) {
+		long n = ::syscall(SYS_io_getevents, ctx_, std::min(min_complete, 64u),
+			std::min(depth, 64u), events, nullptr);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+
+		for (long j = 0; j < n; ++j) {
+			slot& s = slots_[events[j].data];
+			s.state = FAILED;
+			if (events[j].res < 0) {
+				error = -events[j].res;
+			} else if (static_cast<size_t>(events[j].res) != s.length) {
+				error = EIO;
+			} else {
+				s.state = DONE;
+			}
+		}
+		in_flight_ -= n;
+
+		min_complete -= std::min<unsigned>(min_complete, n);
+		if (min_complete == 0) {
+			break;
+		}
+	}
+
+	if (error) {
+		errno = error;
+		return -1;
+	}
+
+	ssize_t consumed = 0;
+	while (count_ > 0 && slots_[first_].state == DONE) {
+		size_t const length = slots_[first_].length;
+		rb.consume(length);
+		submitted_ -= length;
+		offset_ += length;
+		consumed += length;
+		first_ = (first_ + 1) % depth;
+		--count_;
+	}
+
+	return consumed;
+}
+
+
+inline int direct_writer::write_tail(const unsigned char* data, size_t n) noexcept
+{
+	ssize_t res;
+	do {
+		res = ::pwrite(fd_, data, n, offset_);
+	} while (res < 0 && errno == EINTR);
+
+	if (res < 0) {
+		return -1;
+	}
+	if (static_cast<size_t>(res) != n) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+
+template<typename SizeT>
+int direct_writer::finish(linear_ringbuffer_<SizeT>& rb) noexcept
+{
+	// Drain everything that is aligned.
+	do {
+		if (this->submit(rb) < 0 || this->reap(rb, in_flight_) < 0) {
+			return -1;
+		}
+	} while (aligned_size(rb, alignment_) > 0);
+
+	size_t const n = rb.size();
+	if (n == 0) {
+		return 0;
+	}
+
+	// The bytes after the readable data are free space, so the padding can
+	// be written in place. This requires that the buffer was not written
+	// to concurrently while finishing.
+	size_t const padded = (n + alignment_ - 1) & ~(alignment_ - 1);
+	assert(padded - n <= rb.free_size());
+	::memset(rb.read_head() + n, 0, padded - n);
+
+	if (this->write_tail(rb.read_head(), padded) < 0) {
+		return -1;
+	}
+	if (::ftruncate(fd_, offset_ + n) < 0) {
+		return -1;
+	}
+
+	rb.consume(n);
+	offset_ += n;
+	return 0;
+}
+
+
+inline unsigned direct_writer::in_flight() const noexcept
+{
+	return in_flight_;
+}
+
+
+inline off_t direct_writer::offset() const noexcept
+{
+	return offset_;
+}
+
+} // namespace bev
@@ -0,0 +1,334 @@
+#pragma once
+
+#include <bev/linear_ringbuffer.hpp>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+namespace bev {
+
+// # Flight Ring
+//
+// A lossy queue of variable-size records for telemetry and flight recorders,
+// where the producer must never block or drop new data. When a new record
+// does not fit, the oldest records are overwritten instead.
+//
+// Records are stored like in a `record_ring_`, as a 32-bit length prefix
+// followed by the payload, padded to 8 bytes. The buffer is only used for its
+// mirrored mapping, so a record is never split at the edge of the buffer.
+//
+// The producer owns two 64-bit positions counting bytes since the start:
+// `tail()`, where the next record is written, and `head()`, the start of the
+// oldest record that is still intact. Before overwriting anything, the
+// producer moves `head()` forward over whole records. Since these positions
+// never wrap around, they double as a generation counter: a reader can tell
+// that the record at its position was overwritten while it was copying it
+// by checking whether `head()` moved past that position.
+//
+//
+// # Usage
+//
+// Writing:
+//
+//     bev::flight_ring fr(1 << 20);
+//     fr.push(msg, msg_len); // Never blocks, overwrites the oldest records.
+//
+// Reading, from any number of threads with one `reader` each:
+//
+//     bev::flight_ring::reader r(fr);
+//     char buf[4096];
+//     size_t n;
+//     while (r.read(buf, sizeof buf, n) > 0) {
+//         handle(buf, n);
+//     }
+//     if (r.lost_bytes()) {
+//         [some records were overwritten before they could be read]
+//     }
+//
+// A reader copies every record out of the buffer before it validates it, so
+// the record is known to be intact once `read()` returns it.
+//
+//
+// # Errors and Exceptions
+//
+// Construction behaves like for `linear_ringbuffer_`. `push()` and `reserve()`
+// only fail for records that are larger than the whole buffer.
+// `reader::read()` returns -1 and sets `errno` to `EMSGSIZE` if the next
+// record does not fit into the output buffer, without skipping it.
+//
+//
+// # Concurrency
+//
+// There must be a single producer, whose operations are wait-free. Readers
+// are lock-free and do not affect the producer at all.
+//
+
+template<typename SizeT = size_t>
+class flight_ring_ {
+public:
+	typedef typename linear_ringbuffer_<SizeT>::delayed_init delayed_init;
+	typedef uint32_t length_type;
+
+	static constexpr size_t ALIGNMENT = 8;
+
+	flight_ring_(SizeT minsize = 640*1024);
+	flight_ring_(const delayed_init) noexcept;
+	int initialize(SizeT minsize) noexcept;
+
+	// Copies a record into the ring, overwriting the oldest records if
+	// necessary. Returns false if the record can never fit.
+	bool push(const void* data, size_t n) noexcept;
+
+	// Returns storage for a record of up to `n` bytes, after making room for
+	// it, or null if it can never fit. Nothing is visible to readers until
+	// `publish()`.
+	unsigned char* reserve(size_t n) noexcept;
+	void publish(size_t n) noexcept;
+
+	uint64_t head() const noexcept;
+	uint64_t tail() const noexcept;
+	SizeT capacity() const noexcept;
+
+	// Space occupied by a record with `n` bytes of payload.
+	static constexpr size_t footprint(size_t n) noexcept;
+
+	class reader {
+	public:
+		// Starts at the oldest record that is currently intact.
+		explicit reader(const flight_ring_& ring) noexcept;
+
+		// Copies the next record to `out`. Returns 1 and its size in `n`,
+		// 0 if there is no new record, or -1 if it is larger than `max`.
+		int read(void* out, size_t max, size_t& n) noexcept;
+
+		// Bytes resp. times that the reader was overrun by the producer.
+		uint64_t lost_bytes() const noexcept;
+		uint64_t overruns() const noexcept;
+
+	private:
+		// Returns true if the record at `position_` may have been
+		// overwritten, and skips to the oldest intact record if so.
+		bool overrun() noexcept;
+
+		const flight_ring_& ring_;
+		uint64_t position_;
+		uint64_t lost_bytes_;
+		uint64_t overruns_;
+	};
+
+private:
+	unsigned char* at(uint64_t position) const noexcept;
+
+	linear_ringbuffer_<SizeT> rb_;
+	unsigned char* base_;
+	uint64_t head_;
+	uint64_t tail_;
+	size_t reserved_;
+};
+
+
+using flight_ring = flight_ring_<size_t>;
+
+
+// Implementation.
+
+template<typename SizeT>
+constexpr size_t flight_ring_<SizeT>::footprint(size_t n) noexcept
+{
+	return (sizeof(length_type) + n + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+
+template<typename SizeT>
+flight_ring_<SizeT>::flight_ring_(SizeT minsize)
+  : rb_(minsize)
+  , base_(rb_.write_head())
+  , head_(0)
+  , tail_(0)
+  , reserved_(0)
+{}
+
+
+template<typename SizeT>
+flight_ring_<SizeT>::flight_ring_(const delayed_init) noexcept
+  : rb_(delayed_init {})
+  , base_(nullptr)
+  , head_(0)
+  , tail_(0)
+  , reserved_(0)
+{}
+
+
+template<typename SizeT>
+int flight_ring_<SizeT>::initialize(SizeT minsize) noexcept
+{
+	int res = rb_.initialize(minsize);
+	if (res == 0) {
+		// The buffer is never committed to, so this stays its start.
+		base_ = rb_.write_head();
+	}
+	return res;
+}
+
+
+template<typename SizeT>
+unsigned char* flight_ring_<SizeT>::at(uint64_t position) const noexcept
+{
+	return base_ + position % rb_.capacity();
+}
+
+
+template<typename SizeT>
+unsigned char* flight_ring_<SizeT>::reserve(size_t n) noexcept
+{
+	size_t const size = footprint(n);
+	if (n > length_type(-1) || size > rb_.capacity()) {
+		return nullptr;
+	}
+
+	// Drop the oldest records until the new one fits. Each iteration frees
+	// at least `ALIGNMENT` bytes, so this is bounded by the record size.
+	uint64_t head = head_;
+	while (tail_ + size - head > rb_.capacity()) {
+		length_type length;
+		::memcpy(&length, this->at(head), sizeof length);
+		head += footprint(length);
+	}
+
+	if (head != head_) {
+		// Readers must see the new head before any of the bytes that
+		// are about to be overwritten change.
+		__atomic_store_n(&head_, head, __ATOMIC_RELEASE);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	}
+
+	reserved_ = n;
+	return this->at(tail_) + sizeof(length_type);
+}
+
+
+template<typename SizeT>
+void flight_ring_<SizeT>::publish(size_t n) noexcept
+{
+	assert(n <= reserved_);
+	length_type const length = n;
+	::memcpy(this->at(tail_), &length, sizeof length);
+	__atomic_store_n(&tail_, tail_ + footprint(n), __ATOMIC_RELEASE);
+	reserved_ = 0;
+}
+
+
+template<typename SizeT>
+bool flight_ring_<SizeT>::push(const void* data, size_t n) noexcept
+{
+	unsigned char* p = this->reserve(n);
+	if (!p) {
+		return false;
+	}
+
+	::memcpy(p, data, n);
+	this->publish(n);
+	return true;
+}
+
+
+template<typename SizeT>
+uint64_t flight_ring_<SizeT>::head() const noexcept
+{
+	return __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+}
+
+
+template<typename SizeT>
+uint64_t flight_ring_<SizeT>::tail() const noexcept
+{
+	return __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+}
+
+
+template<typename SizeT>
+SizeT flight_ring_<SizeT>::capacity() const noexcept
+{
+	return rb_.capacity();
+}
+
+
+template<typename SizeT>
+flight_ring_<SizeT>::reader::reader(const flight_ring_& ring) noexcept
+  : ring_(ring)
+  , position_(ring.head())
+  , lost_bytes_(0)
+  , overruns_(0)
+{}
+
+
+template<typename SizeT>
+bool flight_ring_<SizeT>::reader::overrun() noexcept
+{
+	uint64_t const head = ring_.head();
+	if (head <= position_) {
+		return false;
+	}
+
+	lost_bytes_ += head - position_;
+	++overruns_;
+	position_ = head;
+	return true;
+}
+
+
+template<typename SizeT>
+int flight_ring_<SizeT>::reader::read(void* out, size_t max, size_t& n) noexcept
+{
+	while (true) {
+		uint64_t const tail = ring_.tail();
+		this->overrun();
+		if (position_ == tail) {
+			return 0;
+		}
+
+		// Everything read from the buffer might be garbage until it was
+		// validated by checking the head again after the copy.
+		length_type length;
+		::memcpy(&length, ring_.at(position_), sizeof length);
+		bool const fits = length <= max;
+		bool const sane = footprint(length) <= tail - position_;
+		if (fits && sane) {
+			::memcpy(out, ring_.at(position_) + sizeof length, length);
+		}
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (this->overrun()) {
+			continue;
+		}
+
+		// The record was intact, so it must have been consistent.
+		assert(sane);
+		if (!fits) {
+			errno = EMSGSIZE;
+			return -1;
+		}
+
+		position_ += footprint(length);
+		n = length;
+		return 1;
+	}
+}
+
+
+template<typename SizeT>
+uint64_t flight_ring_<SizeT>::reader::lost_bytes() const noexcept
+{
+	return lost_bytes_;
+}
+
+
+template<typename SizeT>
+uint64_t flight_ring_<SizeT>::reader::overruns() const noexcept
+{
+	return overruns_;
+}
+
+} // namespace bev
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <bev/linear_ringbuffer.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#include <unistd.h>
+
+namespace bev {
+
+// # Group Commit Writer
+//
+// A durability stage that drains a `linear_ringbuffer_` into a file and
+// amortizes the cost of `fdatasync()` over many records.
+//
+// Calling `fdatasync()` after every record limits throughput to the number of
+// disk flushes per second, while never calling it loses data on a crash. The
+// writer instead accumulates written but unsynced bytes and flushes them once
+// either their amount or the age of the oldest one exceeds a budget, 4MiB or
+// 2ms by default.
+//
+// Each `drain()` submits everything readable with a single `pwrite()` rather
+// than a `pwritev()`: thanks to the mirrored mapping, the readable bytes are
+// one contiguous span even when they wrap around the end of the buffer, so
+// there is nothing to gather. The writes start wherever the previous one
+// ended and are not aligned; for `O_DIRECT` files, use the `direct_writer`
+// from `bev/direct_writer.hpp` instead.
+//
+//
+// # Usage
+//
+// The writer thread drains the buffer periodically:
+//
+//     bev::group_commit_writer w(fd);
+//     while (running) {
+//         if (w.drain(rb) < 0) {
+//             [...]
+//         }
+//         [wait for more data]
+//     }
+//     w.flush();
+//
+// Producers identify their data by its position in the stream, i.e. the
+// total number of bytes committed to the buffer up to and including their
+// record, and can wait until it has reached the disk:
+//
+//     std::unique_lock<std::mutex> lock(producer_mutex);
+//     ::memcpy(rb.write_head(), record, n);
+//     rb.commit(n);
+//     uint64_t seq = (stream_offset += n);
+//     lock.unlock();
+//
+//     w.wait_durable(seq);
+//
+// Waiting producers do not block each other or the writer, they are woken up
+// together after every flush that makes progress.
+//
+//
+// # Errors
+//
+// `drain()` and `flush()` return -1 and set `errno` when writing or flushing
+// fails. Data that was written before a write failed is consumed, so calling
+// `drain()` again retries with the rest. Since the state of unsynced data is
+// unknown after a failed `fdatasync()`, the writer should be considered
+// broken at that point.
+//
+// Note that `drain()` must be called at least every `max_delay` for the
+// latency budget to be honored, the writer does not start a thread on its own.
+//
+//
+// # Concurrency
+//
+// `drain()` and `flush()` must be called from the single consumer thread of
+// the buffer. `written()`, `durable()` and `wait_durable()` may be called
+// from any thread.
+//
+
+class group_commit_writer {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	struct budget {
+		clock::duration max_delay;
+		size_t max_bytes;
+	};
+
+	static constexpr budget default_budget() noexcept {
+		return budget {std::chrono::milliseconds(2), 4*1024*1024};
+	}
+
+	// Data is appended to `fd` starting at `offset`. The file descriptor is
+	// not owned by the writer.
+	group_commit_writer(int fd, off_t offset = 0, budget b = default_budget()) noexcept;
+
+	// Write all readable bytes to the file and consume them, then flush if
+	// the budget is exceeded. Returns the number of bytes written.
+	template<typename SizeT>
+	ssize_t drain(linear_ringbuffer_<SizeT>& rb) noexcept;
+
+	// Unconditionally flush all written bytes.
+	int flush() noexcept;
+
+	// Stream positions up to which data was written resp. flushed.
+	uint64_t written() const noexcept;
+	uint64_t durable() const noexcept;
+
+	void wait_durable(uint64_t seq);
+	bool wait_durable(uint64_t seq, clock::duration timeout);
+
+	group_commit_writer(const group_commit_writer&) = delete;
+	group_commit_writer& operator=(const group_commit_writer&) = delete;
+
+private:
+	// Stores the number of bytes written in `done`, even on failure.
+	int write_all(const unsigned char* data, size_t n, size_t& done) noexcept;
+
+	int fd_;
+	off_t offset_;
+	budget budget_;
+	clock::time_point oldest_unsynced_;
+
+	std::atomic<uint64_t> written_;
+	std::atomic<uint64_t> durable_;
+
+	std::mutex mutex_;
+	std::condition_variable durable_cv_;
+};
+
+
+// Implementation.
+
+inline group_commit_writer::group_commit_writer(int fd, off_t offset, budget b) noexcept
+  : fd_(fd)
+  , offset_(offset)
+  , budget_(b)
+  , oldest_unsynced_()
+  , written_(0)
+  , durable_(0)
+{}
+
+
+inline int group_commit_writer::write_all(const unsigned char* data, size_t n, size_t& done) noexcept
+{
+	done = 0;
+	while (n > 0) {
+		ssize_t res = ::pwrite(fd_, data, n, offset_);
+		if (res < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += res;
+		n -= res;
+		done += res;
+		offset_ += res;
+	}
+	return 0;
+}
+
+
+template<typename SizeT>
+ssize_t group_commit_writer::drain(linear_ringbuffer_<SizeT>& rb) noexcept
+{
+	// Thanks to the mirrored mapping, all readable data can be written with
+	// a single call regardless of where it is located in the buffer.
+	size_t const n = rb.size();
+	if (n > 0) {
+		uint64_t const written = written_.load(std::memory_order_relaxed);
+		if (written == durable_.load(std::memory_order_relaxed)) {
+			oldest_unsynced_ = clock::now();
+		}
+		// `offset_` has advanced by what was written, so that must be
+		// consumed even if the rest failed.
+		size_t done;
+		int const res = this->write_all(rb.read_head(), n, done);
+		rb.consume(done);
+		written_.store(written + done, std::memory_order_release);
+		if (res < 0) {
+			return -1;
+		}
+	}
+
+	uint64_t const pending = written_.load(std::memory_order_relaxed)
+		- durable_.load(std::memory_order_relaxed);
+
+	if (pending > 0 && (pending >= budget_.max_bytes
+			|| clock::now() - oldest_unsynced_ >= budget_.max_delay)) {
+		if (this->flush() < 0) {
+			return -1;
+		}
+	}
+
+	return n;
+}
+
+
+inline int group_commit_writer::flush() noexcept
+{
+	uint64_t const written = written_.load(std::memory_order_relaxed);
+	if (written == durable_.load(std::memory_order_relaxed)) {
+		return 0;
+	}
+
+	if (::fdatasync(fd_) < 0) {
+		return -1;
+	}
+
+	{
+		// Publishing under the mutex ensures that no waiter can miss the
+		// notification between checking `durable_` and going to sleep.
+		std::lock_guard<std::mutex> lock(mutex_);
+		durable_.store(written, std::memory_order_release);
+	}
+	durable_cv_.notify_all();
+
+	return 0;
+}
+
+
+inline uint64_t group_commit_writer::written() const noexcept
+{
+	return written_.load(std::memory_order_acquire);
+}
+
+
+inline uint64_t group_commit_writer::durable() const noexcept
+{
+	return durable_.load(std::memory_order_acquire);
+}
+
+
+inline void group_commit_writer::wait_durable(uint64_t seq)
+{
+	if (this->durable() >= seq) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	durable_cv_.wait(lock, [&] { return this->durable() >= seq; });
+}
+
+
+inline bool group_commit_writer::wait_durable(uint64_t seq, clock::duration timeout)
+{
+	if (this->durable() >= seq) {
+		return true;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	return durable_cv_.wait_for(lock, timeout, [&] { return this->durable() >= seq; });
+}
+
+} // namespace bev
@@ -0,0 +1,323 @@
+#pragma once
+
+#include <bev/io_buffer.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace bev {
+
+// # Growable IO Buffer
+//
+// An `io_buffer` that starts small and grows when `prepare()` asks for more
+// than fits, up to a fixed maximum. This avoids retry loops for messages that
+// are larger than a typical buffer, without sizing every buffer for the
+// largest message.
+//
+// The memory is an anonymous mapping that grows geometrically with
+// `mremap()`, so the kernel moves page table entries instead of copying the
+// contents. When the buffer runs empty after it has not needed the extra
+// room for a while, it shrinks back to its initial size.
+//
+//
+// # Usage
+//
+//     // Starts with 4 KiB, never grows beyond 16 MiB.
+//     bev::growable_io_buffer iob(4096, 16*1024*1024);
+//     bev::io_buffer_view::slab slab = iob.prepare(header.message_size);
+//     ssize_t n = ::read(socket, slab.data, slab.size);
+//     iob.commit(n);
+//
+// Otherwise the interface is the same as for `io_buffer_view`. Pointers into
+// the buffer are invalidated by `prepare()` and by `consume()`.
+//
+// The buffer is only ever shrunk while it is empty, by `consume()` or
+// `clear()`, by a `prepare()` that fits into the initial size, or by
+// `trim()`. Since a large message is usually consumed right after it was
+// received, the `shrink_after` period has typically not passed yet at that
+// point. So that a connection that goes idle after a large message does not
+// keep its large mapping, `next_trim_deadline()` tells when the buffer can
+// be shrunk. The event loop arms a timer for it and calls `trim()` when the
+// timer fires:
+//
+//     iob.consume(n);
+//     auto deadline = iob.next_trim_deadline();
+//     if (deadline != bev::growable_io_buffer::clock::time_point::max()) {
+//         loop.schedule(deadline, [&] { iob.trim(); });
+//     }
+//
+// A `trim()` that comes too early or after new data arrived does nothing,
+// so the timer does not need to be cancelled.
+//
+//
+// # Multi-threading
+//
+// No concurrent operations are allowed.
+//
+//
+// # Exceptions
+//
+// The constructor throws `std::bad_alloc` if the initial mapping fails. All
+// other operations are noexcept. If growing fails, `prepare()` returns a
+// smaller slab, as if the maximum size was reached.
+//
+
+class growable_io_buffer
+{
+public:
+    typedef std::chrono::steady_clock clock;
+
+    // Sizes are rounded up to whole pages.
+    explicit growable_io_buffer(size_t initial_size = 4096, size_t max_size = 64*1024*1024,
+        std::chrono::milliseconds shrink_after = std::chrono::seconds(10));
+    ~growable_io_buffer() noexcept;
+
+    // NOTE: The returned `slab.size` might be less than requested.
+    io_buffer_view::slab prepare(size_t size) noexcept;
+    void commit(size_t n) noexcept;
+    void consume(size_t n) noexcept;
+    void clear() noexcept;
+
+    char* read_head() noexcept;
+    char* write_head() noexcept;
+
+    size_t size() const noexcept;      // Amount of data inside the buffer.
+    size_t free_size() const noexcept; // Amount of data that can be committed.
+    size_t capacity() const noexcept;  // Amount of data that can be prepared without growing.
+    size_t max_size() const noexcept;  // Amount of data that can be prepared at most.
+
+    void set_compaction_policy(const io_buffer_view::compaction_policy& policy) noexcept;
+    const io_buffer_view::compaction_policy& get_compaction_policy() const noexcept;
+    uint64_t bytes_moved() const noexcept;
+    uint64_t compactions() const noexcept;
+
+    // Shrinks the buffer back to its initial size if it is empty and the
+    // `shrink_after` period has passed. Returns true if it was shrunk.
+    bool trim() noexcept;
+
+    // When `trim()` will shrink the buffer if it stays empty, or
+    // `clock::time_point::max()` if it is not empty or already at its
+    // initial size.
+    clock::time_point next_trim_deadline() const noexcept;
+
+    uint64_t grows() const noexcept;
+    uint64_t shrinks() const noexcept;
+
+    growable_io_buffer(const growable_io_buffer&) = delete;
+    growable_io_buffer& operator=(const growable_io_buffer&) = delete;
+
+private:
+    size_t round_up(size_t n) const noexcept;
+    bool resize(size_t length) noexcept;
+
+    char* buffer_;
+    size_t length_;
+    size_t initial_length_;
+    size_t max_length_;
+    std::chrono::milliseconds shrink_after_;
+    clock::time_point last_busy_;
+    io_buffer_view view_;
+    uint64_t grows_ = 0;
+    uint64_t shrinks_ = 0;
+};
+
+
+// Implementation.
+
+inline size_t growable_io_buffer::round_up(size_t n) const noexcept
+{
+    size_t const page = ::getpagesize();
+    if (n > SIZE_MAX - page) {
+        return SIZE_MAX / page * page;
+    }
+    return n > 0 ? (n + page - 1) / page * page : page;
+}
+
+
+inline growable_io_buffer::growable_io_buffer(size_t initial_size, size_t max_size,
+        std::chrono::milliseconds shrink_after)
+  : buffer_(nullptr)
+  , length_(round_up(initial_size))
+  , initial_length_(length_)
+  , max_length_(std::max(round_up(max_size), length_))
+  , shrink_after_(shrink_after)
+  , last_busy_(clock::now())
+{
+    void* addr = ::mmap(nullptr, length_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        throw std::bad_alloc {};
+    }
+    buffer_ = static_cast<char*>(addr);
+    view_.assign(buffer_, length_);
+}
+
+
+inline growable_io_buffer::~growable_io_buffer() noexcept
+{
+    ::munmap(buffer_, length_);
+}
+
+
+inline bool growable_io_buffer::resize(size_t length) noexcept
+{
+    // The contents stay at the same offsets, even if the mapping moves.
+    void* addr = ::mremap(buffer_, length_, length, MREMAP_MAYMOVE);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    buffer_ = static_cast<char*>(addr);
+    length_ = length;
+    view_.relocate(buffer_, length_);
+    return true;
+}
+
+
+inline io_buffer_view::slab growable_io_buffer::prepare(size_t n) noexcept
+{
+    size_t const size = view_.size();
+    if (size == 0 && n <= initial_length_) {
+        this->trim();
+    }
+
+    if (n > length_ - size) {
+        last_busy_ = clock::now();
+
+        // Grow past the current write head, so that nothing needs to be
+        // moved unless the maximum is reached.
+        size_t const tail = view_.write_head() - buffer_;
+        size_t const wanted = n > SIZE_MAX - tail ? SIZE_MAX : tail + n;
+        size_t const length = std::min(round_up(std::max(wanted, length_ * 2)), max_length_);
+        if (length > length_ && this->resize(length)) {
+            ++grows_;
+        }
+    } else if (length_ > initial_length_ && size + n > initial_length_) {
+        // Still using the extra room.
+        last_busy_ = clock::now();
+    }
+
+    return view_.prepare(n);
+}
+
+
+inline bool growable_io_buffer::trim() noexcept
+{
+    if (length_ == initial_length_ || view_.size() != 0
+            || clock::now() - last_busy_ < shrink_after_) {
+        return false;
+    }
+
+    // Shrinking never moves the mapping.
+    if (!this->resize(initial_length_)) {
+        return false;
+    }
+    ++shrinks_;
+    return true;
+}
+
+
+inline auto growable_io_buffer::next_trim_deadline() const noexcept -> clock::time_point
+{
+    if (length_ == initial_length_ || view_.size() != 0) {
+        return clock::time_point::max();
+    }
+    return last_busy_ + shrink_after_;
+}
+
+
+inline void growable_io_buffer::commit(size_t n) noexcept
+{
+    view_.commit(n);
+}
+
+
+inline void growable_io_buffer::consume(size_t n) noexcept
+{
+    view_.consume(n);
+    this->trim();
+}
+
+
+inline void growable_io_buffer::clear() noexcept
+{
+    view_.clear();
+    this->trim();
+}
+
+
+inline char* growable_io_buffer::read_head() noexcept
+{
+    return view_.read_head();
+}
+
+
+inline char* growable_io_buffer::write_head() noexcept
+{
+    return view_.write_head();
+}
+
+
+inline size_t growable_io_buffer::size() const noexcept
+{
+    return view_.size();
+}
+
+
+inline size_t growable_io_buffer::free_size() const noexcept
+{
+    return view_.free_size();
+}
+
+
+inline size_t growable_io_buffer::capacity() const noexcept
+{
+    return view_.capacity();
+}
+
+
+inline size_t growable_io_buffer::max_size() const noexcept
+{
+    return max_length_;
+}
+
+
+inline void growable_io_buffer::set_compaction_policy(const io_buffer_view::compaction_policy& policy) noexcept
+{
+    view_.set_compaction_policy(policy);
+}
+
+
+inline const io_buffer_view::compaction_policy& growable_io_buffer::get_compaction_policy() const noexcept
+{
+    return view_.get_compaction_policy();
+}
+
+
+inline uint64_t growable_io_buffer::bytes_moved() const noexcept
+{
+    return view_.bytes_moved();
+}
+
+
+inline uint64_t growable_io_buffer::compactions() const noexcept
+{
+    return view_.compactions();
+}
+
+
+inline uint64_t growable_io_buffer::grows() const noexcept
+{
+    return grows_;
+}
+
+
+inline uint64_t growable_io_buffer::shrinks() const noexcept
+{
+    return shrinks_;
+}
+
+} // namespace bev
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <bev/line_scanner.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <sys/types.h>
+
+namespace bev {
+
+// # HTTP Tokenizer
+//
+// Splits an HTTP/1.x request line and its headers into tokens, directly on
+// the contiguous readable area of a `linear_ringbuffer_` or `io_buffer_view`.
+//
+// The tokenizer never copies. All tokens are reported as offsets relative to
+// the start of the data, i.e. to `read_head()`, so they stay valid while the
+// data is moved by `io_buffer_view::prepare()`.
+//
+// Most of the time is spent searching for line ends and separators, which is
+// done with the vectorized searches of the `line_scanner`. Until the complete
+// request head has arrived, only the newly committed bytes are searched for
+// the terminating empty line, and the head is tokenized exactly once.
+//
+//
+// # Usage
+//
+//     bev::http_tokenizer tokenizer;
+//     bev::http_request req;
+//     ssize_t n = tokenizer.parse(rb, req);
+//     if (n > 0) {
+//         const char* base = reinterpret_cast<const char*>(rb.read_head());
+//         std::string_view method(base + req.method.offset, req.method.length);
+//         [...]
+//         rb.consume(n); // The body, if any, follows the head.
+//     } else if (n == 0) {
+//         [need more bytes, call `parse()` again after the next `commit()`]
+//     } else {
+//         [malformed request]
+//     }
+//
+// Header values are trimmed of surrounding whitespace. A request with more
+// than `http_request::MAX_HEADERS` headers is treated as malformed.
+//
+
+struct http_token {
+	uint32_t offset;
+	uint32_t length;
+};
+
+
+struct http_header {
+	http_token name;
+	http_token value;
+};
+
+
+struct http_request {
+	static constexpr size_t MAX_HEADERS = 64;
+
+	http_token method;
+	http_token target;
+	int minor_version;
+	size_t num_headers;
+	http_header headers[MAX_HEADERS];
+};
+
+
+class http_tokenizer {
+public:
+	http_tokenizer() noexcept;
+
+	// Returns the length of the request head including the terminating empty
+	// line, 0 if it is incomplete, or -1 if the request is malformed.
+	ssize_t parse(const char* data, size_t size, http_request& req) noexcept;
+
+	template<typename Buffer>
+	ssize_t parse(Buffer& b, http_request& req) noexcept;
+
+	// Must be called when the data is replaced by something else than more
+	// bytes of the same request.
+	void reset() noexcept;
+
+private:
+	ssize_t tokenize(const char* data, const char* end, http_request& req) noexcept;
+
+	size_t scanned_; // Bytes known not to start the terminating empty line.
+};
+
+
+// Implementation.
+
+inline http_tokenizer::http_tokenizer() noexcept
+  : scanned_(0)
+{}
+
+
+inline void http_tokenizer::reset() noexcept
+{
+	scanned_ = 0;
+}
+
+
+template<typename Buffer>
+ssize_t http_tokenizer::parse(Buffer& b, http_request& req) noexcept
+{
+	return this->parse(reinterpret_cast<const char*>(b.read_head()), b.size(), req);
+}
+
+
+inline ssize_t http_tokenizer::parse(const char* data, size_t size, http_request& req) noexcept
+{
+	// Tokens are 32-bit offsets.
+	if (size > UINT32_MAX) {
+		size = UINT32_MAX;
+	}
+
+	const char* const last = data + size;
+	const char* p = data + std::min(scanned_, size);
+
+	while (true) {
+		p = detail::find_pair(p, last, '\r', '\n');
+		if (p == last) {
+			scanned_ = size > 0 ? size - 1 : 0;
+			return 0;
+		}
+		if (last - p < 4) {
+			scanned_ = p - data;
+			return 0;
+		}
+		if (p[2] == '\r' && p[3] == '\n') {
+			break;
+		}
+		p += 2;
+	}
+
+	scanned_ = 0;
+	return this->tokenize(data, p + 4, req);
+}
+
+
+inline ssize_t http_tokenizer::tokenize(const char* data, const char* end, http_request& req) noexcept
+{
+	auto make_token = [data](const char* first, const char* last) {
+		return http_token {static_cast<uint32_t>(first - data), static_cast<uint32_t>(last - first)};
+	};
+
+	// Request line: method SP request-target SP HTTP-version CRLF
+	const char* line_end = detail::find_pair(data, end, '\r', '\n');
+	const char* sp1 = detail::find_byte(data, line_end, ' ');
+	if (sp1 == data || sp1 == line_end) {
+		return -1;
+	}
+	const char* sp2 = detail::find_byte(sp1 + 1, line_end, ' ');
+	if (sp2 == sp1 + 1 || sp2 == line_end) {
+		return -1;
+	}
+
+	const char* version = sp2 + 1;
+	if (line_end - version != 8 || ::memcmp(version, "HTTP/1.", 7) != 0
+			|| version[7] < '0' || version[7] > '9') {
+		return -1;
+	}
+
+	req.method = make_token(data, sp1);
+	req.target = make_token(sp1 + 1, sp2);
+	req.minor_version = version[7] - '0';
+	req.num_headers = 0;
+
+	// Header fields: field-name ":" OWS field-value OWS CRLF, until the
+	// empty line that `parse()` found.
+	const char* p = line_end + 2;
+	while (p != end - 2) {
+		line_end = detail::find_pair(p, end, '\r', '\n');
+		const char* colon = detail::find_byte(p, line_end, ':');
+		if (colon == p || colon == line_end || req.num_headers == http_request::MAX_HEADERS) {
+			return -1;
+		}
+		// No whitespace is allowed between the field name and the colon.
+		if (colon[-1] == ' ' || colon[-1] == '\t') {
+			return -1;
+		}
+
+		const char* value = colon + 1;
+		const char* value_end = line_end;
+		while (value < value_end && (*value == ' ' || *value == '\t')) {
+			++value;
+		}
+		while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) {
+			--value_end;
+		}
+
+		req.headers[req.num_headers++] = http_header {make_token(p, colon), make_token(value, value_end)};
+		p = line_end + 2;
+	}
+
+	return end - data;
+}
+
+} // namespace bev
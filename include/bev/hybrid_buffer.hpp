@@ -0,0 +1,245 @@
+#pragma once
+
+#include <bev/io_buffer.hpp>
+#include <bev/linear_ringbuffer.hpp>
+#include <bev/ringbuffer_pool.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+namespace bev {
+
+// # Hybrid Buffer
+//
+// A buffer for connections that usually exchange only little data, but
+// occasionally much more. Small traffic goes through an `io_buffer_view` over
+// `InlineSize` bytes inside the object itself, which costs no system calls at
+// all. As soon as `prepare()` asks for more than fits at the end of that
+// storage, which would otherwise require moving the data to the front, the
+// contents are copied once into a `linear_ringbuffer` from a pool. When the
+// ringbuffer runs empty, it goes back to the pool and the buffer is small again.
+//
+// The interface is the same as for `io_buffer_view`, so callers don't notice
+// the switch, except that pointers into the buffer are invalidated by
+// `prepare()` as well as by `commit()` and `consume()` when the buffer
+// becomes empty.
+//
+//
+// # Usage
+//
+//     bev::hybrid_buffer<> b; // Uses `thread_ringbuffer_pool()`.
+//     bev::io_buffer_view::slab slab = b.prepare(512);
+//     ssize_t n = ::read(socket, slab.data, slab.size);
+//     b.commit(n > 0 ? n : 0);
+//
+//     n = ::write(socket, b.read_head(), b.size());
+//     b.consume(n);
+//
+//
+// # Errors and Exceptions
+//
+// All operations are noexcept. If no ringbuffer can be obtained, the buffer
+// stays small, and `prepare()` returns what fits into the inline storage.
+//
+//
+// # Concurrency
+//
+// No concurrent operations are allowed. A buffer using the thread's pool must
+// only be used on that thread, and must be destroyed before the thread exits.
+//
+
+template<size_t InlineSize = 2048>
+class hybrid_buffer {
+public:
+	hybrid_buffer() noexcept;
+	explicit hybrid_buffer(ringbuffer_pool& pool) noexcept;
+	~hybrid_buffer() noexcept;
+
+	// NOTE: The returned `slab.size` might be less than requested.
+	io_buffer_view::slab prepare(size_t size) noexcept;
+	void commit(size_t n) noexcept;
+	void consume(size_t n) noexcept;
+	void clear() noexcept;
+
+	char* read_head() noexcept;
+	char* write_head() noexcept;
+
+	size_t size() const noexcept;      // Amount of data inside the buffer.
+	size_t free_size() const noexcept; // Amount of data that can be committed.
+	size_t capacity() const noexcept;  // Amount of data that can be prepared.
+
+	// Whether the data currently lives in a ringbuffer.
+	bool upgraded() const noexcept;
+
+	// The inline storage is referenced by the view.
+	hybrid_buffer(const hybrid_buffer&) = delete;
+	hybrid_buffer& operator=(const hybrid_buffer&) = delete;
+
+private:
+	bool upgrade() noexcept;
+	void downgrade() noexcept;
+
+	ringbuffer_pool& pool_;
+	linear_ringbuffer ring_;
+	bool upgraded_;
+	io_buffer_view view_;
+	char inline_[InlineSize];
+};
+
+
+// Implementation.
+
+template<size_t InlineSize>
+hybrid_buffer<InlineSize>::hybrid_buffer() noexcept
+  : hybrid_buffer(thread_ringbuffer_pool())
+{}
+
+
+template<size_t InlineSize>
+hybrid_buffer<InlineSize>::hybrid_buffer(ringbuffer_pool& pool) noexcept
+  : pool_(pool)
+  , ring_(linear_ringbuffer::delayed_init {})
+  , upgraded_(false)
+  , view_(inline_, InlineSize)
+{}
+
+
+template<size_t InlineSize>
+hybrid_buffer<InlineSize>::~hybrid_buffer() noexcept
+{
+	this->downgrade();
+}
+
+
+template<size_t InlineSize>
+bool hybrid_buffer<InlineSize>::upgrade() noexcept
+{
+	if (pool_.acquire(ring_) == -1) {
+		return false;
+	}
+
+	size_t const size = view_.size();
+	if (size > ring_.free_size()) {
+		pool_.release(ring_);
+		return false;
+	}
+
+	::memcpy(ring_.write_head(), view_.read_head(), size);
+	ring_.commit(size);
+	view_.clear();
+	upgraded_ = true;
+	return true;
+}
+
+
+template<size_t InlineSize>
+void hybrid_buffer<InlineSize>::downgrade() noexcept
+{
+	if (upgraded_) {
+		pool_.release(ring_);
+		upgraded_ = false;
+	}
+}
+
+
+template<size_t InlineSize>
+io_buffer_view::slab hybrid_buffer<InlineSize>::prepare(size_t n) noexcept
+{
+	if (!upgraded_) {
+		if (n <= view_.free_size() || !this->upgrade()) {
+			return view_.prepare(n);
+		}
+	}
+
+	auto const slab = ring_.prepare(std::min(n, ring_.free_size()));
+	return io_buffer_view::slab {reinterpret_cast<char*>(slab.data), slab.size};
+}
+
+
+template<size_t InlineSize>
+void hybrid_buffer<InlineSize>::commit(size_t n) noexcept
+{
+	if (!upgraded_) {
+		view_.commit(n);
+		return;
+	}
+
+	ring_.commit(n);
+	if (ring_.empty()) {
+		this->downgrade();
+	}
+}
+
+
+template<size_t InlineSize>
+void hybrid_buffer<InlineSize>::consume(size_t n) noexcept
+{
+	if (!upgraded_) {
+		view_.consume(n);
+		return;
+	}
+
+	ring_.consume(n);
+	if (ring_.empty()) {
+		this->downgrade();
+	}
+}
+
+
+template<size_t InlineSize>
+void hybrid_buffer<InlineSize>::clear() noexcept
+{
+	this->downgrade();
+	view_.clear();
+}
+
+
+template<size_t InlineSize>
+char* hybrid_buffer<InlineSize>::read_head() noexcept
+{
+	return upgraded_ ? reinterpret_cast<char*>(ring_.read_head()) : view_.read_head();
+}
+
+
+template<size_t InlineSize>
+char* hybrid_buffer<InlineSize>::write_head() noexcept
+{
+	return upgraded_ ? reinterpret_cast<char*>(ring_.write_head()) : view_.write_head();
+}
+
+
+template<size_t InlineSize>
+size_t hybrid_buffer<InlineSize>::size() const noexcept
+{
+	return upgraded_ ? ring_.size() : view_.size();
+}
+
+
+template<size_t InlineSize>
+size_t hybrid_buffer<InlineSize>::free_size() const noexcept
+{
+	return upgraded_ ? ring_.free_size() : view_.free_size();
+}
+
+
+template<size_t InlineSize>
+size_t hybrid_buffer<InlineSize>::capacity() const noexcept
+{
+	if (upgraded_) {
+		return ring_.free_size();
+	}
+
+	// Assuming that the pool can provide a ringbuffer.
+	size_t const ring_size = pool_.ring_size();
+	return std::max(ring_size, InlineSize) - view_.size();
+}
+
+
+template<size_t InlineSize>
+bool hybrid_buffer<InlineSize>::upgraded() const noexcept
+{
+	return upgraded_;
+}
+
+} // namespace bev
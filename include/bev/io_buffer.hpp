@@ -1,6 +1,14 @@
+#pragma once
+
+#include <cstddef>
 #include <cstdint>
 #include <memory>
-#include <functional>
+
+#include <sys/uio.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace bev {
 
@@ -40,9 +48,10 @@ namespace bev {
 // # Exceptions
 //
 // Both constructors of `io_buffer` may throw `std::bad_alloc` on allocation
-// failure. (Although the constructor accepting a `unique_ptr` will in practice
-// not allocate, because the type-erased deleter should be small enough for the
-// small function optimization. However, this is not guaranteed.)
+// failure. (The constructor accepting a `unique_ptr` only allocates if the
+// deleter is stateful and larger than a pointer or not trivially copyable,
+// in order to store it.) The allocating constructor throws
+// `std::invalid_argument` if `options.alignment` is not a power of two.
 //
 // All other operations on the buffer are noexcept. In particular, class `io_buffer_view`
 // provides a fully noexcept interface.
@@ -57,6 +66,55 @@ namespace bev {
 // The class `io_buffer_view` can be used to treat an existing memory region as an
 // `io_buffer` without assuming ownership of the underlying memory.
 //
+// When `io_buffer` allocates its own memory, `io_buffer_options` control how.
+// The memory is never initialized, so large buffers are cheap to create.
+//
+//     bev::io_buffer iob(64*1024*1024, {4096, false, false}); // Page aligned.
+//     bev::io_buffer iob(64*1024*1024, {0, true, true});      // Huge pages.
+//
+//
+// # Compaction
+//
+// When `prepare()` is asked for more than `free_size()`, the buffer can make
+// room by moving its contents to the front. By default it always does, but
+// with a slow consumer this means moving nearly the whole buffer for every
+// small `prepare()`. A `compaction_policy` can restrict moving to the cases
+// where it is cheap:
+//
+//     iob.set_compaction_policy({0.25, 1024*1024});
+//
+// With this policy, the contents are only moved if they fill at most a quarter
+// of the buffer, or if there is no free space left at the end at all. Otherwise
+// `prepare()` just returns the smaller free area at the end. Moves of at least
+// 1 MiB use non-temporal stores in cache-line-sized chunks, so that they don't
+// evict the working set from the cache.
+//
+// `bytes_moved()` and `compactions()` count the work done for compaction.
+//
+//
+// # Scatter-Gather
+//
+// Callers that read and write with `readv()` and `writev()` don't need the
+// data to be contiguous, and can avoid compaction altogether by using the
+// buffer as a ring: `prepare_iov()` returns the free space at the end and,
+// after it, the free space in front of the data, and `data_iov()` returns
+// the data in up to two parts.
+//
+//     auto free = iob.prepare_iov(64*1024);
+//     ssize_t n = ::readv(socket, free.iov, free.count);
+//     iob.commit(n);
+//
+//     auto data = iob.data_iov();
+//     n = ::writev(socket, data.iov, data.count);
+//     iob.consume(n);
+//
+// While `wrapped()` is true, the data continues at the start of the buffer.
+// `read_head()` and `size()` then only describe the first part, so code that
+// writes from `read_head()` stays correct and picks up the second part after
+// consuming the first, while `total_size()` counts both parts. `prepare()`
+// never compacts a wrapped buffer. It becomes contiguous again when the first
+// part is consumed.
+//
 
 using std::size_t;
 
@@ -70,45 +128,114 @@ public:
         size_t size;
     };
 
+    struct compaction_policy {
+        // Only compact if at most this fraction of the buffer holds data,
+        // unless there is no free space at the end at all.
+        double max_live_fraction;
+
+        // Use non-temporal stores for moves of at least this many bytes.
+        size_t streaming_threshold;
+    };
+
+    static constexpr compaction_policy ALWAYS_COMPACT = {1.0, SIZE_MAX};
+
+    struct iovecs {
+        struct iovec iov[2];
+        int count;
+    };
+
     // NOTE: If the default constructor is used, the view is in undefined state
     // until `assign()` is called.
     io_buffer_view() noexcept;
     io_buffer_view(char* data, size_t n) noexcept;
     void assign(char* data, size_t n) noexcept;
 
+    // Like `assign()`, but keeps the contents at the same offsets, e.g. when the
+    // memory was resized or moved underneath the view. `n` must be at least the
+    // offset of `write_head()`, and the view must not be `wrapped()`.
+    void relocate(char* data, size_t n) noexcept;
+
     // NOTE: The returned `slab.size` might be less than requested.
     slab prepare(size_t size) noexcept;
     void commit(size_t n) noexcept;
     void consume(size_t n) noexcept;
     void clear() noexcept;
 
+    // Takes back the last `n` committed bytes.
+    void uncommit(size_t n) noexcept;
+
+    // Scatter-gather interface, see above. Never moves any data.
+    iovecs prepare_iov(size_t size) noexcept;
+    iovecs data_iov() noexcept;
+    bool wrapped() const noexcept;
+
     char* read_head() noexcept;
     char* write_head() noexcept;
 
-    size_t size() const noexcept;      // Amount of data inside the buffer.
-    size_t free_size() const noexcept; // Amount of data that can be committed.
-    size_t capacity() const noexcept;  // Amount of data that can be prepared.
+    size_t size() const noexcept;       // Amount of data at `read_head()`.
+    size_t total_size() const noexcept; // Amount of data inside the buffer.
+    size_t free_size() const noexcept;  // Amount of data that can be committed.
+    size_t capacity() const noexcept;   // Amount of data that can be prepared.
+
+    void set_compaction_policy(const compaction_policy& policy) noexcept;
+    const compaction_policy& get_compaction_policy() const noexcept;
+    uint64_t bytes_moved() const noexcept;
+    uint64_t compactions() const noexcept;
 
 private:
+    void compact() noexcept;
+
     char* buffer_;
     size_t length_;
     size_t head_;
     size_t tail_;
+    size_t wrap_ = 0; // End of the data continued at the start, if `wrapped()`.
+    compaction_policy policy_ = ALWAYS_COMPACT;
+    uint64_t bytes_moved_ = 0;
+    uint64_t compactions_ = 0;
+};
+
+
+struct io_buffer_options {
+    // Alignment of heap allocations, a power of two.
+    size_t alignment = 64;
+
+    // Use an anonymous mapping instead of the heap, which is page aligned.
+    bool mmap = false;
+
+    // Implies `mmap`. Align the mapping to 2 MiB and advise the kernel to
+    // back it with transparent huge pages.
+    bool huge_pages = false;
 };
 
 
 namespace detail {
 
 // Class `io_buffer_storage` holds a pointer to the allocated memory region along
-// with a type-erased deleter.
+// with a type-erased deleter. The deleter is a function pointer and a pointer-sized
+// slot for its state, e.g. a reference to the original deleter or the size of a
+// mapping, to avoid the size and the possible allocation of a `std::function`.
 class io_buffer_storage
 {
 public:
     template<typename Deleter>
     io_buffer_storage(std::unique_ptr<char, Deleter> storage, size_t size);
+    io_buffer_storage(size_t size, const io_buffer_options& options);
+    ~io_buffer_storage() noexcept;
+
+    io_buffer_storage(io_buffer_storage&& other) noexcept;
+    io_buffer_storage& operator=(io_buffer_storage&& other) noexcept;
+    io_buffer_storage(const io_buffer_storage&) = delete;
+    io_buffer_storage& operator=(const io_buffer_storage&) = delete;
+
+    void swap(io_buffer_storage& other) noexcept;
 
 protected:
-    std::unique_ptr<char, std::function<void(char*)>> buffer_;    
+    typedef void (*release_function)(char* buffer, void* state) noexcept;
+
+    char* buffer_;
+    release_function release_;
+    alignas(void*) unsigned char state_[sizeof(void*)];
 };
 
 } // namespace detail
@@ -120,10 +247,13 @@ class io_buffer
   , public io_buffer_view
 {
 public:
-    io_buffer(size_t size);
+    io_buffer(size_t size, const io_buffer_options& options = io_buffer_options());
 
     template<typename Deleter>
     io_buffer(std::unique_ptr<char, Deleter> storage, size_t size);
+
+    io_buffer(io_buffer&& other) noexcept = default;
+    io_buffer& operator=(io_buffer&& other) noexcept;
 };
 
 
@@ -137,7 +267,13 @@ public:
 #include <unistd.h>
 #include <string.h>
 
+#include <algorithm>
+#include <new>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include <sys/mman.h>
 
 namespace bev {
 namespace detail {
@@ -145,42 +281,174 @@ namespace detail {
 template<typename Deleter>
 io_buffer_storage::io_buffer_storage(std::unique_ptr<char, Deleter> storage, size_t size)
 {
-    // Can use `if constexpr` here in C++17.
-    if (std::is_reference<Deleter>::value) {
-        std::function<void(char*)> deleter = std::ref(storage.get_deleter());
-        buffer_ = std::unique_ptr<char, std::function<void(char*)>>{storage.release(), deleter};
+    (void)size;
+    typedef typename std::remove_reference<Deleter>::type D;
+
+    // Like `std::unique_ptr`, never call the deleter for a null pointer,
+    // and don't keep a copy of it that nothing would release.
+    if (!storage) {
+        buffer_ = nullptr;
+        return;
+    }
+
+    if constexpr (std::is_reference<Deleter>::value) {
+        // Only remember where the deleter is.
+        D* deleter = &storage.get_deleter();
+        ::memcpy(state_, &deleter, sizeof deleter);
+        release_ = [](char* buffer, void* state) noexcept {
+            D* deleter;
+            ::memcpy(&deleter, state, sizeof deleter);
+            (*deleter)(buffer);
+        };
+    } else if constexpr (sizeof(D) <= sizeof(state_) && alignof(D) <= alignof(void*)
+            && std::is_trivially_copyable<D>::value) {
+        // Small deleters, including all stateless ones, are stored inline.
+        // They are relocated with `memcpy()` when the storage is moved.
+        new (state_) D(std::move(storage.get_deleter()));
+        release_ = [](char* buffer, void* state) noexcept {
+            D* deleter = std::launder(reinterpret_cast<D*>(state));
+            (*deleter)(buffer);
+            deleter->~D();
+        };
     } else {
-        // Non-reference deleters must be at least MoveConstructible.
-        buffer_ = std::unique_ptr<char, std::function<void(char*)>>{
-            storage.release(), std::function<void(char*)>(std::move(storage.get_deleter()) )};
+        // Non-reference deleters must be at least MoveConstructible. If this
+        // throws, `storage` still owns the memory.
+        D* deleter = new D(std::move(storage.get_deleter()));
+        ::memcpy(state_, &deleter, sizeof deleter);
+        release_ = [](char* buffer, void* state) noexcept {
+            D* deleter;
+            ::memcpy(&deleter, state, sizeof deleter);
+            (*deleter)(buffer);
+            delete deleter;
+        };
+    }
+
+    buffer_ = storage.release();
+}
+
+
+inline io_buffer_storage::io_buffer_storage(size_t size, const io_buffer_options& options)
+{
+    if (!options.mmap && !options.huge_pages) {
+        size_t const alignment = options.alignment ? options.alignment : alignof(std::max_align_t);
+        if ((alignment & (alignment - 1)) != 0) {
+            throw std::invalid_argument {"bev::io_buffer: alignment must be a power of two"};
+        }
+        buffer_ = static_cast<char*>(::operator new(size, std::align_val_t(alignment)));
+        ::memcpy(state_, &alignment, sizeof alignment);
+        release_ = [](char* buffer, void* state) noexcept {
+            size_t alignment;
+            ::memcpy(&alignment, state, sizeof alignment);
+            ::operator delete(buffer, std::align_val_t(alignment));
+        };
+        return;
+    }
+
+    constexpr size_t HUGE_PAGE_SIZE = 2*1024*1024;
+    size_t const granularity = options.huge_pages ? HUGE_PAGE_SIZE : ::getpagesize();
+    size_t const length = size > 0 ? (size + granularity - 1) / granularity * granularity : granularity;
+    if (length < size) {
+        throw std::bad_alloc {};
+    }
+
+    // Map a bit more, so that the mapping can be aligned to a huge page.
+    size_t const reserve = options.huge_pages ? length + HUGE_PAGE_SIZE : length;
+    void* addr = ::mmap(nullptr, reserve, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        throw std::bad_alloc {};
+    }
+
+    char* first = static_cast<char*>(addr);
+    if (options.huge_pages) {
+        char* aligned = reinterpret_cast<char*>(
+            (reinterpret_cast<uintptr_t>(first) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+        if (aligned != first) {
+            ::munmap(first, aligned - first);
+        }
+        if (aligned + length != first + reserve) {
+            ::munmap(aligned + length, first + reserve - (aligned + length));
+        }
+        first = aligned;
+
+        // Only advisory, e.g. if transparent huge pages are disabled.
+        ::madvise(first, length, MADV_HUGEPAGE);
+    }
+
+    buffer_ = first;
+    ::memcpy(state_, &length, sizeof length);
+    release_ = [](char* buffer, void* state) noexcept {
+        size_t length;
+        ::memcpy(&length, state, sizeof length);
+        ::munmap(buffer, length);
+    };
+}
+
+
+inline io_buffer_storage::io_buffer_storage(io_buffer_storage&& other) noexcept
+  : buffer_(other.buffer_)
+  , release_(other.release_)
+{
+    // The state is either trivially copyable or a pointer.
+    ::memcpy(state_, other.state_, sizeof state_);
+    other.buffer_ = nullptr;
+}
+
+
+inline io_buffer_storage& io_buffer_storage::operator=(io_buffer_storage&& other) noexcept
+{
+    // The previous storage is released together with `other`.
+    this->swap(other);
+    return *this;
+}
+
+
+inline void io_buffer_storage::swap(io_buffer_storage& other) noexcept
+{
+    std::swap(buffer_, other.buffer_);
+    std::swap(release_, other.release_);
+    unsigned char state[sizeof state_];
+    ::memcpy(state, state_, sizeof state_);
+    ::memcpy(state_, other.state_, sizeof state_);
+    ::memcpy(other.state_, state, sizeof state_);
+}
+
+
+inline io_buffer_storage::~io_buffer_storage() noexcept
+{
+    if (buffer_) {
+        release_(buffer_, state_);
     }
 }
 
 } // namespace detail
 
 
-io_buffer::io_buffer(size_t size)
-  : detail::io_buffer_storage(std::unique_ptr<char>(std::allocator<char>().allocate(size)), size)
-  , io_buffer_view(this->detail::io_buffer_storage::buffer_.get(), size)
+inline io_buffer::io_buffer(size_t size, const io_buffer_options& options)
+  : detail::io_buffer_storage(size, options)
+  , io_buffer_view(this->detail::io_buffer_storage::buffer_, size)
 {
-  char* storage = detail::io_buffer_storage::buffer_.get();
-  // In C++17, the loop can be replaced by
-  // `std::uninitialized_default_construct(storage, storage+size)`.
-  for (size_t i=0; i<size; ++i) {
-    new (storage+i) char;
-  }
 }
 
 
 template<typename Deleter>
 io_buffer::io_buffer(std::unique_ptr<char, Deleter> storage, size_t size)
   : detail::io_buffer_storage(std::move(storage), size)
-  , io_buffer_view(this->detail::io_buffer_storage::buffer_.get(), size)
+  , io_buffer_view(this->detail::io_buffer_storage::buffer_, size)
 {
 }
 
 
-io_buffer_view::io_buffer_view() noexcept = default;
+inline io_buffer& io_buffer::operator=(io_buffer&& other) noexcept
+{
+    // Swap the views as well, so that `other` keeps referring to the storage
+    // it now owns until it is destroyed.
+    this->detail::io_buffer_storage::swap(other);
+    std::swap(static_cast<io_buffer_view&>(*this), static_cast<io_buffer_view&>(other));
+    return *this;
+}
+
+
+inline io_buffer_view::io_buffer_view() noexcept = default;
 
 
 inline io_buffer_view::io_buffer_view(char* data, size_t size) noexcept
@@ -198,6 +466,15 @@ inline void io_buffer_view::assign(char* data, size_t size) noexcept
     length_ = size;
     head_ = 0;
     tail_ = 0;
+    wrap_ = 0;
+}
+
+
+inline void io_buffer_view::relocate(char* data, size_t size) noexcept
+{
+    // assert: tail_ <= size && !wrapped()
+    buffer_ = data;
+    length_ = size;
 }
 
 
@@ -209,7 +486,7 @@ inline char* io_buffer_view::read_head() noexcept
 
 inline char* io_buffer_view::write_head() noexcept
 {
-    return buffer_ + tail_;
+    return buffer_ + (wrap_ > 0 ? wrap_ : tail_);
 }
 
 
@@ -219,48 +496,193 @@ inline size_t io_buffer_view::size() const noexcept
 }
 
 
+inline size_t io_buffer_view::total_size() const noexcept
+{
+    return tail_ - head_ + wrap_;
+}
+
+
 inline size_t io_buffer_view::capacity() const noexcept
 {
-    return length_ - this->size();
+    return length_ - this->total_size();
 }
 
 
 inline size_t io_buffer_view::free_size() const noexcept
 {
-    return length_ - tail_;
+    return wrap_ > 0 ? head_ - wrap_ : length_ - tail_;
 }
 
 
-inline io_buffer_view::slab io_buffer_view::prepare(size_t n) noexcept
+inline bool io_buffer_view::wrapped() const noexcept
 {
-    // Make as much room as we can
-    if (n > this->free_size()) {
-        std::size_t size = tail_ - head_;
+    return wrap_ > 0;
+}
+
+
+namespace detail {
+
+// Moves `n` bytes from `src` down to `dst < src`, like `memmove()`, but
+// bypassing the cache for the bulk of the data.
+inline void stream_move_down(char* dst, const char* src, size_t n) noexcept
+{
+#if defined(__SSE2__)
+    // Align the destination to a cache line.
+    size_t head = (64 - reinterpret_cast<uintptr_t>(dst) % 64) % 64;
+    if (head > n) {
+        head = n;
+    }
+    ::memmove(dst, src, head);
+    dst += head;
+    src += head;
+    n -= head;
+
+    // Every chunk is loaded completely before it is stored, and the stores
+    // stay below the next source chunk, so overlap is fine.
+    for (; n >= 64; dst += 64, src += 64, n -= 64) {
+        __m128i const a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+        __m128i const b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+        __m128i const c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 32));
+        __m128i const d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 48));
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst), a);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 16), b);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 32), c);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + 48), d);
+    }
+    _mm_sfence();
+#endif
+    ::memmove(dst, src, n);
+}
+
+} // namespace detail
+
+
+inline void io_buffer_view::compact() noexcept
+{
+    std::size_t size = tail_ - head_;
+    if (size >= policy_.streaming_threshold) {
+        detail::stream_move_down(buffer_, buffer_ + head_, size);
+    } else {
         ::memmove(buffer_, buffer_ + head_, size);
-        tail_ = size;
-        head_ = 0;
+    }
+    tail_ = size;
+    head_ = 0;
+
+    bytes_moved_ += size;
+    ++compactions_;
+}
+
+
+inline io_buffer_view::slab io_buffer_view::prepare(size_t n) noexcept
+{
+    // Make as much room as we can, if the policy says it's worth it.
+    if (n > this->free_size() && head_ > 0 && wrap_ == 0) {
+        bool const cheap = this->size() <= policy_.max_live_fraction * length_;
+        if (cheap || this->free_size() == 0) {
+            this->compact();
+        }
     }
 
     // If we still don't have enough, adjust request.
-    if (n > this->capacity()) {
-        n = this->capacity();
+    if (n > this->free_size()) {
+        n = this->free_size();
     }
 
-    return slab {buffer_ + tail_, n};
+    return slab {this->write_head(), n};
+}
+
+
+inline io_buffer_view::iovecs io_buffer_view::prepare_iov(size_t n) noexcept
+{
+    iovecs result {};
+    char* const first = this->write_head();
+    size_t const first_size = std::min(n, this->free_size());
+    if (first_size > 0) {
+        result.iov[result.count++] = iovec {first, first_size};
+    }
+
+    // Continue in front of the data, unless that's where `first` already is.
+    size_t const second_size = wrap_ == 0 ? std::min(n - first_size, head_) : 0;
+    if (second_size > 0) {
+        result.iov[result.count++] = iovec {buffer_, second_size};
+    }
+    return result;
+}
+
+
+inline io_buffer_view::iovecs io_buffer_view::data_iov() noexcept
+{
+    iovecs result {};
+    if (tail_ > head_) {
+        result.iov[result.count++] = iovec {buffer_ + head_, tail_ - head_};
+    }
+    if (wrap_ > 0) {
+        result.iov[result.count++] = iovec {buffer_, wrap_};
+    }
+    return result;
+}
+
+
+inline void io_buffer_view::set_compaction_policy(const compaction_policy& policy) noexcept
+{
+    policy_ = policy;
+}
+
+
+inline auto io_buffer_view::get_compaction_policy() const noexcept -> const compaction_policy&
+{
+    return policy_;
+}
+
+
+inline uint64_t io_buffer_view::bytes_moved() const noexcept
+{
+    return bytes_moved_;
+}
+
+
+inline uint64_t io_buffer_view::compactions() const noexcept
+{
+    return compactions_;
 }
 
 
 inline void io_buffer_view::commit(std::size_t n) noexcept
 {
-    // assert: tail_ + n < size
-    tail_ += n;
+    // assert: n <= free space, including in front of the data
+    if (wrap_ == 0 && n <= length_ - tail_) {
+        tail_ += n;
+        return;
+    }
+
+    // Data written through `prepare_iov()` continues at the start.
+    wrap_ += n - (length_ - tail_);
+    tail_ = length_;
 }
 
 
 inline void io_buffer_view::consume(std::size_t n) noexcept
 {
-    // assert: size() <= n
+    // assert: n <= total_size()
     head_ += n;
+    if (head_ >= tail_) {
+        // Continue with the part at the start, if any.
+        head_ -= tail_;
+        tail_ = wrap_;
+        wrap_ = 0;
+        if (head_ >= tail_) {
+            head_ = tail_ = 0;
+        }
+    }
+}
+
+
+inline void io_buffer_view::uncommit(std::size_t n) noexcept
+{
+    // assert: n <= total_size()
+    size_t const wrapped = std::min(n, wrap_);
+    wrap_ -= wrapped;
+    tail_ -= n - wrapped;
     if (head_ >= tail_) {
         head_ = tail_ = 0;
     }
@@ -269,7 +691,7 @@ inline void io_buffer_view::consume(std::size_t n) noexcept
 
 inline void io_buffer_view::clear() noexcept
 {
-    head_ = tail_ = 0;
+    head_ = tail_ = wrap_ = 0;
 }
 
 } // namespace bev
@@ -0,0 +1,265 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace bev {
+
+// # Line Scanner
+//
+// Splits the contents of a `linear_ringbuffer_` or an `io_buffer_view` into
+// lines or frames terminated by a one- or two-byte delimiter, e.g. `\n` or
+// `\r\n`.
+//
+// Searching the whole readable area every time new data arrives is quadratic
+// when a long line trickles in over many reads. The scanner instead remembers
+// how far it has already searched and only looks at newly committed bytes.
+// The search is vectorized with AVX2 if the CPU supports it (detected at
+// runtime), with SSE2 otherwise on x86-64, and falls back to a scalar loop
+// on other architectures.
+//
+//
+// # Usage
+//
+//     bev::line_scanner scanner('\r', '\n');
+//     while (true) {
+//         [read data into rb]
+//         while (size_t n = scanner.find(rb)) {
+//             handle_line(rb.read_head(), n - 2); // Without the delimiter.
+//             scanner.consume(rb, n);
+//         }
+//     }
+//
+// `find()` returns the length of the first line including its delimiter, or
+// 0 if the readable data does not contain a complete line yet. The line
+// starts at `read_head()` and is always contiguous.
+//
+// All data must be consumed through the scanner, since it needs to know by
+// how much the read head moved. Calling `reset()` forgets the search progress.
+//
+//
+// # Concurrency
+//
+// The scanner belongs to the reading side of the buffer.
+//
+
+namespace detail {
+
+// Returns a pointer to the first occurrence of `c` in `[first, last)`, or
+// `last` if there is none.
+inline const char* find_byte(const char* first, const char* last, char c) noexcept;
+
+// Returns a pointer `p` to the first occurrence of `p[0] == a && p[1] == b`
+// in `[first, last)`, or `last` if there is none.
+inline const char* find_pair(const char* first, const char* last, char a, char b) noexcept;
+
+} // namespace detail
+
+
+class line_scanner {
+public:
+	explicit line_scanner(char delimiter) noexcept;
+	line_scanner(char first, char second) noexcept;
+
+	// Length of the first line of `[data, data+size)` including the
+	// delimiter, or 0 if there is no complete line.
+	size_t scan(const char* data, size_t size) noexcept;
+
+	// Must be called after `n` bytes were removed from the front of the data.
+	void advance(size_t n) noexcept;
+	void reset() noexcept;
+
+	// Convenience wrappers for buffers with `read_head()`, `size()` and
+	// `consume()`.
+	template<typename Buffer>
+	size_t find(Buffer& b) noexcept;
+
+	template<typename Buffer>
+	void consume(Buffer& b, size_t n) noexcept;
+
+	size_t delimiter_size() const noexcept;
+
+private:
+	char first_;
+	char second_;
+	bool pair_;
+	size_t scanned_; // Bytes known not to start a delimiter.
+};
+
+
+// Implementation.
+
+namespace detail {
+
+#if defined(__x86_64__)
+// The AVX2 loops search whole 32-byte blocks, advance `first` past them and
+// return null if there is no match, leaving the rest to the SSE2 loops.
+__attribute__((target("avx2")))
+inline const char* find_byte_avx2(const char*& first, const char* last, char c) noexcept
+{
+	__m256i const needle = _mm256_set1_epi8(c);
+	for (; last - first >= 32; first += 32) {
+		__m256i const x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+		unsigned const mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, needle));
+		if (mask) {
+			return first + __builtin_ctz(mask);
+		}
+	}
+	return nullptr;
+}
+
+
+__attribute__((target("avx2")))
+inline const char* find_pair_avx2(const char*& first, const char* last, char a, char b) noexcept
+{
+	__m256i const va = _mm256_set1_epi8(a);
+	__m256i const vb = _mm256_set1_epi8(b);
+	for (; last - first >= 33; first += 32) {
+		__m256i const x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+		__m256i const y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + 1));
+		unsigned const mask = _mm256_movemask_epi8(_mm256_and_si256(
+			_mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(y, vb)));
+		if (mask) {
+			return first + __builtin_ctz(mask);
+		}
+	}
+	return nullptr;
+}
+#endif
+
+
+inline const char* find_byte(const char* first, const char* last, char c) noexcept
+{
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		if (const char* p = find_byte_avx2(first, last, c)) {
+			return p;
+		}
+	}
+#endif
+#if defined(__SSE2__)
+	__m128i const needle16 = _mm_set1_epi8(c);
+	for (; last - first >= 16; first += 16) {
+		__m128i const x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+		unsigned const mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, needle16));
+		if (mask) {
+			return first + __builtin_ctz(mask);
+		}
+	}
+#endif
+	auto p = static_cast<const char*>(::memchr(first, c, last - first));
+	return p ? p : last;
+}
+
+
+inline const char* find_pair(const char* first, const char* last, char a, char b) noexcept
+{
+	// Compare each block against `a` and the block shifted by one byte
+	// against `b`, which needs one byte beyond the block.
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		if (const char* p = find_pair_avx2(first, last, a, b)) {
+			return p;
+		}
+	}
+#endif
+#if defined(__SSE2__)
+	__m128i const va16 = _mm_set1_epi8(a);
+	__m128i const vb16 = _mm_set1_epi8(b);
+	for (; last - first >= 17; first += 16) {
+		__m128i const x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+		__m128i const y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + 1));
+		unsigned const mask = _mm_movemask_epi8(_mm_and_si128(
+			_mm_cmpeq_epi8(x, va16), _mm_cmpeq_epi8(y, vb16)));
+		if (mask) {
+			return first + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for (; last - first >= 2; ++first) {
+		if (first[0] == a && first[1] == b) {
+			return first;
+		}
+	}
+	return last;
+}
+
+} // namespace detail
+
+
+inline line_scanner::line_scanner(char delimiter) noexcept
+  : first_(delimiter)
+  , second_(0)
+  , pair_(false)
+  , scanned_(0)
+{}
+
+
+inline line_scanner::line_scanner(char first, char second) noexcept
+  : first_(first)
+  , second_(second)
+  , pair_(true)
+  , scanned_(0)
+{}
+
+
+inline size_t line_scanner::scan(const char* data, size_t size) noexcept
+{
+	if (scanned_ >= size) {
+		return 0;
+	}
+
+	const char* const last = data + size;
+	const char* p = pair_
+		? detail::find_pair(data + scanned_, last, first_, second_)
+		: detail::find_byte(data + scanned_, last, first_);
+
+	if (p == last) {
+		// The last byte might still turn out to start a two-byte delimiter.
+		scanned_ = pair_ ? size - 1 : size;
+		return 0;
+	}
+
+	// Stay on the delimiter, so that asking again is cheap.
+	scanned_ = p - data;
+	return p - data + this->delimiter_size();
+}
+
+
+inline void line_scanner::advance(size_t n) noexcept
+{
+	scanned_ = scanned_ > n ? scanned_ - n : 0;
+}
+
+
+inline void line_scanner::reset() noexcept
+{
+	scanned_ = 0;
+}
+
+
+template<typename Buffer>
+size_t line_scanner::find(Buffer& b) noexcept
+{
+	return this->scan(reinterpret_cast<const char*>(b.read_head()), b.size());
+}
+
+
+template<typename Buffer>
+void line_scanner::consume(Buffer& b, size_t n) noexcept
+{
+	b.consume(n);
+	this->advance(n);
+}
+
+
+inline size_t line_scanner::delimiter_size() const noexcept
+{
+	return pair_ ? 2 : 1;
+}
+
+} // namespace bev
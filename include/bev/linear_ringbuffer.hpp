@@ -8,6 +8,8 @@
 #include <unistd.h>
 
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 namespace bev {
 
@@ -64,6 +66,12 @@ namespace bev {
 //     ssize_t n = ::write(fileno(f), rb.read_head(), rb.size();
 //     rb.consume(n);
 //
+// For code that is generic over this and `io_buffer`, `prepare(n)` returns
+// the first pair as a slab of at most `n` bytes, see `byte_stream_buffer.hpp`.
+//
+// To copy large payloads in and out, `bev::put()` and `bev::get()` from
+// `bulk_copy.hpp` use faster copy kernels instead of `memcpy()`.
+//
 // If there are multiple readers/writers, it is the calling code's
 // responsibility to ensure that the reads/writes and the calls to
 // produce/consume appear atomic to the buffer, otherwise data loss
@@ -93,10 +101,6 @@ namespace bev {
 //
 //  EINVAL - The `minsize` argument was 0, or 2*`minsize` did overflow.
 //
-//  EAGAIN - Another thread allocated memory in the area that was intended
-//           to use for the second copy of the buffer. Callers are encouraged
-//           to try again.
-//
 // If exceptions are preferred, the `linear_ringbuffer(int minsize)`
 // constructor will attempt to initialize the internal buffers immediately and
 // throw a `std::system_error` on failure. The error code as described above
@@ -109,9 +113,57 @@ namespace bev {
 // single writer, but mutiple readers or multiple writers must serialize
 // their accesses with a mutex.
 //
-// If the ring buffer is used in a single-threaded application, the
-// `linear_ringbuffer_st` class can be used to avoid paying for atomic
-// increases and decreases of the internal size.
+// The writer publishes new data with a release store of the write position
+// in `commit()`, and the reader hands space back with a release store of the
+// read position in `consume()`. The position owned by the other side is read
+// with an acquire load. On x86, all of these compile to plain moves.
+//
+// A reader processing fixed-size messages can claim everything that is
+// available with a single acquire load, process the batch in place, and
+// release it with a single store:
+//
+//     auto batch = rb.claim_batch(64 * sizeof(event));
+//     process(batch.data, batch.size);
+//     rb.release_batch(batch.size);
+//
+//
+// # Persistence
+//
+// Instead of anonymous memory, the buffer can be backed by a regular file
+// by passing an open file descriptor to the constructor or to `initialize()`:
+//
+//     int fd = ::open("journal.dat", O_RDWR | O_CREAT, 0644);
+//     bev::linear_ringbuffer rb(fd, 1024*1024);
+//
+// The file consists of one header page storing the read and write positions,
+// followed by the buffer area. The buffer area is mapped twice, exactly like
+// the anonymous buffer. An empty file is extended to the required size, an
+// existing file must have been created with the same capacity and is reopened
+// with its contents intact.
+//
+// Since the mapping is shared, committed bytes live in the page cache and
+// survive a crash of the process. To make them durable against a crash of
+// the system, and to persist the current read and write positions in the
+// header page, call `sync()`:
+//
+//     rb.commit(n);
+//     int error = rb.sync(); // Flushes all readable bytes and the header.
+//
+// To make only a prefix of the readable bytes durable, e.g. up to the end of
+// the last complete record, pass the range `[cbegin(), last)` instead. The
+// header then records `last` as the write position, so bytes behind it are
+// not recovered even if they happened to reach the disk. Any other range
+// is rejected with `EINVAL`.
+//
+// After a crash, the buffer is restored to the state of the last `sync()`,
+// i.e. bytes committed after it are lost and bytes consumed after it are
+// delivered again. The destructor only stores the current read position in
+// the header page, up to the write position of the last `sync()`, and does
+// not wait for it to reach the disk. Call `sync()` before destroying the
+// buffer to keep bytes committed after that.
+//
+// The file descriptor is not owned by the buffer and may be closed right
+// after initialization. For anonymous buffers, `sync()` does nothing.
 //
 //
 // # Implementation Notes
@@ -125,28 +177,21 @@ namespace bev {
 //
 // Since the main use case is interfacing with C APIs, it seems more pragmatic
 // to just let the caller cast their data to `void*` rather than supporting
-// arbitrary element types.
-//
-// The initialization of the buffer is subject to failure, and sadly this cannot
-// be avoided. [1] There are two sources of errors:
+// arbitrary element types. For fixed-size trivially copyable elements, the
+// `typed_ringbuffer` in `bev/typed_ringbuffer.hpp` takes care of the casts and
+// rounds the capacity to a multiple of both the element and the page size.
 //
-//  1) Resource exhaustion. The maximum amount of available memory, file
-//  descriptors, memory mappings etc. may be exceeded. This is similar to any
-//  other container type.
+// The initialization of the buffer is subject to failure due to resource
+// exhaustion. The maximum amount of available memory, file descriptors,
+// memory mappings etc. may be exceeded. This is similar to any other
+// container type.
 //
-//  2) To allocate the ringbuffer storage, first a memory region twice the
-//  required size is mapped, then it is shrunk by half and a copy of the first
-//  half of the buffer is mapped into the (now empty) second half.
-//  If some other thread is creating its own mapping in the second half after
-//  the buffer has been shrunk but before the second half has been mapped, this
-//  will fail. To ensure success, allocate the buffers before branching into
-//  multi-threaded code.
-//
-// [1] Technically, we could use `MREMAP_FIXED` to enforce creation of the
-// second buffer, but at the cost of potentially unmapping random mappings made
-// by other threads, which seems much worse than just failing. I've spent some
-// time scouring the manpages and implementation of `mmap()` for a technique to
-// make it work atomically but came up empty. If there is one, please tell me.
+// To allocate the ringbuffer storage, first a memory region twice the
+// required size is mapped, then a copy of the first half of the buffer is
+// mapped over the second half using `mremap()` with `MREMAP_FIXED`.
+// Since the target range is already owned by the buffer at that point, no
+// other thread can have created a mapping there in between, and there is
+// no risk of unmapping anything but our own pages.
 //
 
 template<typename SizeT = size_t>
@@ -168,12 +213,47 @@ public:
 	linear_ringbuffer_(SizeT minsize = 640*1024);
 	~linear_ringbuffer_() noexcept;
 
+	// Use the file referred to by `fd` as backing storage, see description above.
+	linear_ringbuffer_(int fd, SizeT minsize);
+
 	// Noexcept initialization interface, see description above.
 	linear_ringbuffer_(const delayed_init) noexcept;
 	int initialize(SizeT minsize) noexcept;
+	int initialize(int fd, SizeT minsize) noexcept;
+
+	// Flush the readable bytes resp. the readable bytes in `[first, last)`
+	// and the matching read and write positions to a file-backed buffer's
+	// storage. The range must start at `cbegin()`.
+	int sync() noexcept;
+	int sync(const_iterator first, const_iterator last) noexcept;
 
 	void commit(SizeT n) noexcept;
 	void consume(SizeT n) noexcept;
+
+	// Takes back the last `n` committed bytes. Only safe if no concurrent
+	// reader can have seen them yet.
+	void uncommit(SizeT n) noexcept;
+
+	// Batched consumption for a single reader, see description above.
+	struct batch {
+		iterator data;
+		SizeT size;
+	};
+	batch claim_batch(SizeT max) noexcept;
+	void release_batch(SizeT n) noexcept;
+
+	// Same as `io_buffer_view::prepare()`, never moves any data.
+	struct slab {
+		iterator data;
+		SizeT size;
+	};
+	slab prepare(SizeT n) noexcept;
+
+	// Same as `io_buffer_view::prepare_iov()` and `data_iov()`, except that a
+	// single `iovec` always suffices.
+	struct iovec prepare_iov(SizeT n) noexcept;
+	struct iovec data_iov() noexcept;
+
 	iterator read_head() noexcept;
 	iterator write_head() noexcept;
 	void clear() noexcept;
@@ -187,6 +267,9 @@ public:
 	const_iterator end() const noexcept;
 	const_iterator cend() const noexcept;
 
+	// The capacity is always a multiple of the page size.
+	static size_t page_size() noexcept;
+
 	// Plumbing
 
 	linear_ringbuffer_(linear_ringbuffer_&& other) noexcept;
@@ -197,10 +280,21 @@ public:
 	linear_ringbuffer_& operator=(const linear_ringbuffer_&) = delete;
 
 private:
+	// Layout of the first page of a file-backed buffer.
+	struct file_header {
+		uint64_t magic;
+		uint64_t capacity;
+		uint64_t head;
+		uint64_t tail;
+	};
+
+	static constexpr uint64_t FILE_MAGIC = 0x31676e6972766562; // "bevring1"
+
 	unsigned char* buffer_;
 	SizeT capacity_;
 	SizeT head_;
 	SizeT tail_;
+	file_header* header_; // Null unless the buffer is backed by a file.
 };
 
 
@@ -218,14 +312,58 @@ using linear_ringbuffer = linear_ringbuffer_<size_t>;
 template<typename SizeT>
 void linear_ringbuffer_<SizeT>::commit(SizeT n) noexcept {
 	assert(n <= free_size());
-	tail_ += n;
+	__atomic_store_n(&tail_, tail_ + n, __ATOMIC_RELEASE);
 }
 
 
 template<typename SizeT>
 void linear_ringbuffer_<SizeT>::consume(SizeT n) noexcept {
 	assert(n <= size());
-	head_ += n;
+	__atomic_store_n(&head_, head_ + n, __ATOMIC_RELEASE);
+}
+
+
+template<typename SizeT>
+void linear_ringbuffer_<SizeT>::uncommit(SizeT n) noexcept {
+	assert(n <= size());
+	__atomic_store_n(&tail_, tail_ - n, __ATOMIC_RELEASE);
+}
+
+
+template<typename SizeT>
+auto linear_ringbuffer_<SizeT>::claim_batch(SizeT max) noexcept -> batch
+{
+	SizeT const available = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE) - head_;
+	return batch {buffer_ + head_ % capacity_, available < max ? available : max};
+}
+
+
+template<typename SizeT>
+void linear_ringbuffer_<SizeT>::release_batch(SizeT n) noexcept {
+	this->consume(n);
+}
+
+
+template<typename SizeT>
+auto linear_ringbuffer_<SizeT>::prepare(SizeT n) noexcept -> slab
+{
+	SizeT const free = this->free_size();
+	return slab {this->write_head(), n < free ? n : free};
+}
+
+
+template<typename SizeT>
+struct iovec linear_ringbuffer_<SizeT>::prepare_iov(SizeT n) noexcept
+{
+	slab const s = this->prepare(n);
+	return iovec {s.data, s.size};
+}
+
+
+template<typename SizeT>
+struct iovec linear_ringbuffer_<SizeT>::data_iov() noexcept
+{
+	return iovec {this->read_head(), this->size()};
 }
 
 
@@ -237,13 +375,14 @@ void linear_ringbuffer_<SizeT>::clear() noexcept {
 
 template<typename SizeT>
 SizeT linear_ringbuffer_<SizeT>::size() const noexcept {
-	return tail_ - head_;
+	return __atomic_load_n(&tail_, __ATOMIC_ACQUIRE)
+		- __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
 }
 
 
 template<typename SizeT>
 bool linear_ringbuffer_<SizeT>::empty() const noexcept {
-	return head_ == tail_;
+	return size() == 0;
 }
 
 
@@ -283,10 +422,8 @@ auto linear_ringbuffer_<SizeT>::read_head() noexcept -> iterator
 template<typename SizeT>
 auto linear_ringbuffer_<SizeT>::cend() const noexcept -> const_iterator
 {
-	auto h = head_ % capacity_;
-	auto t = tail_ % capacity_;
-	bool const wraps = t < h;
-	return buffer_ + t + (wraps ? capacity_ : 0);
+	// Thanks to the mirrored mapping, the end never wraps around.
+	return cbegin() + size();
 }
 
 
@@ -310,6 +447,7 @@ linear_ringbuffer_<SizeT>::linear_ringbuffer_(const delayed_init) noexcept
   , capacity_(0)
   , head_(0)
   , tail_(0)
+  , header_(nullptr)
 {}
 
 
@@ -319,6 +457,7 @@ linear_ringbuffer_<SizeT>::linear_ringbuffer_(SizeT minsize)
   , capacity_(0)
   , head_(0)
   , tail_(0)
+  , header_(nullptr)
 {
 	int res = this->initialize(minsize);
 	if (res == -1) {
@@ -327,11 +466,26 @@ linear_ringbuffer_<SizeT>::linear_ringbuffer_(SizeT minsize)
 }
 
 
+template<typename SizeT>
+linear_ringbuffer_<SizeT>::linear_ringbuffer_(int fd, SizeT minsize)
+  : buffer_(nullptr)
+  , capacity_(0)
+  , head_(0)
+  , tail_(0)
+  , header_(nullptr)
+{
+	int res = this->initialize(fd, minsize);
+	if (res == -1) {
+		throw std::system_error {errno, std::system_category(), __PRETTY_FUNCTION__};
+	}
+}
+
+
 template<typename SizeT>
 linear_ringbuffer_<SizeT>::linear_ringbuffer_(linear_ringbuffer_&& other) noexcept
 	: linear_ringbuffer_(delayed_init {})
 {
-	other.swap(this);
+	other.swap(*this);
 }
 
 
@@ -345,16 +499,25 @@ auto linear_ringbuffer_<SizeT>::operator=(linear_ringbuffer_&& other) noexcept
 
 
 template<typename SizeT>
-int linear_ringbuffer_<SizeT>::initialize(SizeT minsize) noexcept
+size_t linear_ringbuffer_<SizeT>::page_size() noexcept
 {
 #ifdef PAGESIZE
-	constexpr size_t PAGE_SIZE = PAGESIZE;
+	return PAGESIZE;
 #else
 	static const size_t PAGE_SIZE = ::sysconf(_SC_PAGESIZE);
+	return PAGE_SIZE;
 #endif
+}
+
+
+template<typename SizeT>
+int linear_ringbuffer_<SizeT>::initialize(SizeT minsize) noexcept
+{
+	size_t const PAGE_SIZE = page_size();
+
 	// Use `char*` instead of `void*` because we need to do arithmetic on them.
-	unsigned char* addr =nullptr;
-	unsigned char* addr2=nullptr;
+	unsigned char* addr = nullptr;
+	unsigned char* addr2 = nullptr;
 
 	// Technically, we could also report sucess here since a zero-length
 	// buffer can't be legally used anyways.
@@ -378,28 +541,20 @@ int linear_ringbuffer_<SizeT>::initialize(SizeT minsize) noexcept
 		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0));
 
 	if (addr == MAP_FAILED) {
+		addr = nullptr;
 		goto errout;
 	}
 
-	// Shrink to actual buffer size.
-	addr = static_cast<unsigned char*>(::mremap(addr, 2*bytes, bytes, 0));
-	if (addr == MAP_FAILED) {
-		goto errout;
-	}
-
-	// Create the second copy right after the shrinked buffer.
-	addr2 = static_cast<unsigned char*>(::mremap(addr, 0, bytes, MREMAP_MAYMOVE,
-		addr+bytes));
+	// Replace the second half by a copy of the first half. Since the
+	// target range belongs to our own mapping, `MREMAP_FIXED` cannot
+	// clobber anything else.
+	addr2 = static_cast<unsigned char*>(::mremap(addr, 0, bytes,
+		MREMAP_MAYMOVE | MREMAP_FIXED, addr+bytes));
 
 	if (addr2 == MAP_FAILED) {
 		goto errout;
 	}
 
-	if (addr2 != addr+bytes) {
-		errno = EAGAIN;
-		goto errout;
-	}
-
 	// Sanity check.
 	assert((*addr = 'x') && *addr2 == 'x');
 	assert((*addr2 = 'y') && *addr == 'y');
@@ -415,19 +570,160 @@ errout:
 	// null, `bytes` might be large enough that this overlaps some actual
 	// mappings.
 	if (addr) {
-		::munmap(addr, bytes);
+		::munmap(addr, 2*bytes);
+	}
+	errno = error;
+	return -1;
+}
+
+
+template<typename SizeT>
+int linear_ringbuffer_<SizeT>::initialize(int fd, SizeT minsize) noexcept
+{
+	size_t const PAGE_SIZE = page_size();
+	unsigned char* addr = nullptr;
+	file_header* header = nullptr;
+	struct stat st;
+
+	if (minsize == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	size_t const bytes = (minsize + (PAGE_SIZE-1)) & ~(PAGE_SIZE-1);
+	assert(static_cast<SizeT>(bytes) == bytes);
+
+	// Check for overflow of the total mapping size.
+	if (bytes*2 < bytes || PAGE_SIZE + bytes*2 < bytes*2) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (::fstat(fd, &st) < 0) {
+		return -1;
+	}
+
+	// A fresh file is extended to hold the header page and one copy of
+	// the buffer area, an existing one must match that size exactly.
+	bool const fresh = st.st_size == 0;
+	if (fresh) {
+		if (::ftruncate(fd, PAGE_SIZE + bytes) < 0) {
+			return -1;
+		}
+	} else if (static_cast<size_t>(st.st_size) != PAGE_SIZE + bytes) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Reserve the whole address range up front and map the file over it
+	// with `MAP_FIXED`, which only ever replaces our own reservation.
+	addr = static_cast<unsigned char*>(::mmap(NULL, PAGE_SIZE + 2*bytes,
+		PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0));
+
+	if (addr == MAP_FAILED) {
+		return -1;
 	}
-	if (addr2) {
-		::munmap(addr2, bytes);
+
+	// Header page and first copy of the buffer area.
+	if (::mmap(addr, PAGE_SIZE + bytes, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		goto errout;
+	}
+
+	// Second copy of the buffer area.
+	if (::mmap(addr + PAGE_SIZE + bytes, bytes, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED, fd, PAGE_SIZE) == MAP_FAILED) {
+		goto errout;
 	}
+
+	header = reinterpret_cast<file_header*>(addr);
+	if (fresh) {
+		header->magic = FILE_MAGIC;
+		header->capacity = bytes;
+		header->head = 0;
+		header->tail = 0;
+	} else if (header->magic != FILE_MAGIC || header->capacity != bytes
+			|| header->tail - header->head > bytes) {
+		errno = EINVAL;
+		goto errout;
+	}
+
+	buffer_ = addr + PAGE_SIZE;
+	capacity_ = bytes;
+	head_ = header->head;
+	tail_ = header->tail;
+	header_ = header;
+
+	return 0;
+
+errout:
+	int error = errno;
+	::munmap(addr, PAGE_SIZE + 2*bytes);
 	errno = error;
 	return -1;
 }
 
 
+template<typename SizeT>
+int linear_ringbuffer_<SizeT>::sync() noexcept
+{
+	return this->sync(cbegin(), cend());
+}
+
+
+template<typename SizeT>
+int linear_ringbuffer_<SizeT>::sync(const_iterator first, const_iterator last) noexcept
+{
+	if (!header_) {
+		return 0;
+	}
+
+	// The header can only describe a prefix of the readable bytes, anything
+	// else would make it claim bytes that were never flushed.
+	if (first != cbegin() || last < first || last > cend()) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	size_t const PAGE_SIZE = page_size();
+
+	// `msync()` requires a page-aligned start address. Flushing through
+	// the second copy of the buffer area reaches the same file pages.
+	if (first != last) {
+		auto addr = reinterpret_cast<uintptr_t>(first) & ~(PAGE_SIZE-1);
+		auto length = reinterpret_cast<uintptr_t>(last) - addr;
+		if (::msync(reinterpret_cast<void*>(addr), length, MS_SYNC) < 0) {
+			return -1;
+		}
+	}
+
+	// Only publish the new positions after the data they refer to is stable.
+	// The writer may have committed more in the meantime, but those bytes
+	// were not flushed.
+	header_->head = head_;
+	header_->tail = head_ + (last - first);
+	return ::msync(header_, PAGE_SIZE, MS_SYNC);
+}
+
+
 template<typename SizeT>
 linear_ringbuffer_<SizeT>::~linear_ringbuffer_() noexcept
 {
+	if (header_) {
+		// The header may reach the disk at any time after this, so it must
+		// not claim bytes that were never flushed. Only the read position
+		// is stored, clamped to the write position of the last `sync()`.
+		SizeT const synced_head = header_->head;
+		SizeT const synced_tail = header_->tail;
+		if (SizeT(head_ - synced_head) <= SizeT(synced_tail - synced_head)) {
+			header_->head = head_;
+		} else {
+			header_->head = synced_tail;
+		}
+		::munmap(header_, page_size() + capacity_ * 2);
+		return;
+	}
+
 	// Either `buffer_` and `capacity_` are both initialized properly,
 	// or both are zero.
 	::munmap(buffer_, capacity_ * 2);
@@ -442,6 +738,7 @@ void linear_ringbuffer_<SizeT>::swap(linear_ringbuffer_& other) noexcept
 	swap(capacity_, other.capacity_);
 	swap(tail_, other.tail_);
 	swap(head_, other.head_);
+	swap(header_, other.header_);
 }
 
 
@@ -0,0 +1,374 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+namespace bev {
+
+// # LZ Codec
+//
+// A fast LZ77 compressor and decompressor in the style of LZ4, usable as
+// `pipeline` stages or on their own.
+//
+// The compressed stream is a sequence of independent blocks, each with an
+// 8-byte header holding the uncompressed and the compressed size as 32-bit
+// little-endian integers. A block that would not get smaller is stored as is,
+// which is marked by the most significant bit of the compressed size.
+//
+// Inside a block, the data is a sequence of a token byte, literals and a
+// 16-bit match offset, in the same encoding as LZ4 blocks. Matches are found
+// greedily with a single-entry hash table and do not cross block boundaries.
+//
+//
+// # Usage
+//
+//     bev::lz_compressor lz;
+//     bev::pump(lz, in, out);
+//
+// The compressor takes whatever input is available, up to `block_size`, and
+// shrinks the block if the output buffer is short of space, so it never
+// waits for input. The decompressor needs a complete block in its input
+// buffer and space for the uncompressed block in its output buffer, so both
+// buffers should be somewhat larger than `lz_compress_bound(block_size)`.
+//
+//
+// # Errors and Exceptions
+//
+// `lz_decompressor::transform()` returns -1 and sets `errno` to `EBADMSG` for
+// corrupt input, or for an incomplete block when flushing.
+//
+
+// Largest possible size of a compressed block of `n` bytes, including the
+// header.
+constexpr size_t lz_compress_bound(size_t n) noexcept;
+
+// Compresses `[in, in+n)` into one block at `out`, which must have room for
+// `lz_compress_bound(n)` bytes, and returns the size of the block. `table`
+// is scratch space of `LZ_TABLE_SIZE` entries.
+constexpr size_t LZ_TABLE_SIZE = 1 << 12;
+inline size_t lz_compress_block(const unsigned char* in, size_t n, unsigned char* out,
+	uint32_t* table) noexcept;
+
+
+class lz_compressor {
+public:
+	static constexpr size_t DEFAULT_BLOCK_SIZE = 64*1024;
+
+	explicit lz_compressor(size_t block_size = DEFAULT_BLOCK_SIZE) noexcept;
+
+	int transform(const unsigned char*& in, const unsigned char* in_end,
+		unsigned char*& out, unsigned char* out_end, bool flush) noexcept;
+
+private:
+	size_t block_size_;
+	uint32_t table_[LZ_TABLE_SIZE];
+};
+
+
+class lz_decompressor {
+public:
+	// Blocks that would decompress to more than `max_block_size` bytes are
+	// rejected as corrupt.
+	explicit lz_decompressor(size_t max_block_size = lz_compressor::DEFAULT_BLOCK_SIZE) noexcept;
+
+	int transform(const unsigned char*& in, const unsigned char* in_end,
+		unsigned char*& out, unsigned char* out_end, bool flush) noexcept;
+
+private:
+	size_t max_block_size_;
+};
+
+
+// Implementation.
+
+namespace detail {
+
+constexpr size_t LZ_HEADER_SIZE = 8;
+constexpr uint32_t LZ_STORED = 0x80000000;
+constexpr size_t LZ_MIN_MATCH = 4;
+constexpr size_t LZ_MAX_OFFSET = 65535;
+
+// Like LZ4, the last bytes of a block are always literals, which lets the
+// match search read 4 bytes at a time without checking the end.
+constexpr size_t LZ_LAST_LITERALS = 5;
+constexpr size_t LZ_MATCH_LIMIT = 12;
+
+
+inline uint32_t lz_read32(const unsigned char* p) noexcept
+{
+	uint32_t x;
+	::memcpy(&x, p, 4);
+	return x;
+}
+
+
+inline void lz_write32le(unsigned char* p, uint32_t x) noexcept
+{
+	p[0] = x;
+	p[1] = x >> 8;
+	p[2] = x >> 16;
+	p[3] = x >> 24;
+}
+
+
+inline uint32_t lz_read32le(const unsigned char* p) noexcept
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+}
+
+
+inline unsigned char* lz_write_length(unsigned char* op, size_t n) noexcept
+{
+	for (; n >= 255; n -= 255) {
+		*op++ = 255;
+	}
+	*op++ = n;
+	return op;
+}
+
+
+// Reads the continuation bytes of a length, returns false on truncation.
+inline bool lz_read_length(const unsigned char*& ip, const unsigned char* end, size_t& n) noexcept
+{
+	unsigned char b;
+	do {
+		if (ip == end) {
+			return false;
+		}
+		b = *ip++;
+		n += b;
+	} while (b == 255);
+	return true;
+}
+
+
+inline unsigned char* lz_write_sequence(unsigned char* op, const unsigned char* literals,
+	size_t literal_length, size_t offset, size_t match_length) noexcept
+{
+	unsigned char* token = op++;
+	*token = std::min<size_t>(literal_length, 15) << 4;
+	if (literal_length >= 15) {
+		op = lz_write_length(op, literal_length - 15);
+	}
+	::memcpy(op, literals, literal_length);
+	op += literal_length;
+
+	if (match_length == 0) {
+		return op; // The last sequence has no match.
+	}
+
+	*op++ = offset;
+	*op++ = offset >> 8;
+	match_length -= LZ_MIN_MATCH;
+	*token |= std::min<size_t>(match_length, 15);
+	if (match_length >= 15) {
+		op = lz_write_length(op, match_length - 15);
+	}
+	return op;
+}
+
+
+// Returns the end of the decoded data, or null for corrupt input.
+inline unsigned char* lz_decode(const unsigned char* ip, const unsigned char* iend,
+	unsigned char* out, unsigned char* oend) noexcept
+{
+	unsigned char* op = out;
+	while (ip < iend) {
+		unsigned const token = *ip++;
+
+		size_t literal_length = token >> 4;
+		if (literal_length == 15 && !lz_read_length(ip, iend, literal_length)) {
+			return nullptr;
+		}
+		if (literal_length > size_t(iend - ip) || literal_length > size_t(oend - op)) {
+			return nullptr;
+		}
+		::memcpy(op, ip, literal_length);
+		ip += literal_length;
+		op += literal_length;
+
+		if (ip == iend) {
+			break;
+		}
+
+		if (iend - ip < 2) {
+			return nullptr;
+		}
+		size_t const offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (offset == 0 || offset > size_t(op - out)) {
+			return nullptr;
+		}
+
+		size_t match_length = token & 15;
+		if (match_length == 15 && !lz_read_length(ip, iend, match_length)) {
+			return nullptr;
+		}
+		match_length += LZ_MIN_MATCH;
+		if (match_length > size_t(oend - op)) {
+			return nullptr;
+		}
+
+		const unsigned char* match = op - offset;
+		if (offset >= match_length) {
+			::memcpy(op, match, match_length);
+			op += match_length;
+		} else {
+			// Overlapping matches repeat the last `offset` bytes.
+			for (size_t i = 0; i < match_length; ++i) {
+				*op++ = match[i];
+			}
+		}
+	}
+	return op;
+}
+
+} // namespace detail
+
+
+constexpr size_t lz_compress_bound(size_t n) noexcept
+{
+	return detail::LZ_HEADER_SIZE + n + n / 255 + 16;
+}
+
+
+inline size_t lz_compress_block(const unsigned char* in, size_t n, unsigned char* out,
+	uint32_t* table) noexcept
+{
+	using namespace detail;
+
+	unsigned char* const body = out + LZ_HEADER_SIZE;
+	unsigned char* op = body;
+	size_t anchor = 0;
+
+	if (n > LZ_MATCH_LIMIT) {
+		// Positions are stored plus one, so that zero means empty.
+		::memset(table, 0, LZ_TABLE_SIZE * sizeof(uint32_t));
+
+		size_t const limit = n - LZ_MATCH_LIMIT;
+		size_t const match_end = n - LZ_LAST_LITERALS;
+		size_t ip = 0;
+		while (ip < limit) {
+			uint32_t const seq = lz_read32(in + ip);
+			uint32_t const h = (seq * 2654435761u) / (0x100000000 / LZ_TABLE_SIZE);
+			size_t ref = table[h];
+			table[h] = ip + 1;
+
+			if (ref == 0 || ip + 1 - ref > LZ_MAX_OFFSET || lz_read32(in + ref - 1) != seq) {
+				// Skip faster through data that does not compress.
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+			--ref;
+
+			size_t length = LZ_MIN_MATCH;
+			while (ip + length < match_end && in[ref + length] == in[ip + length]) {
+				++length;
+			}
+			while (ip > anchor && ref > 0 && in[ip - 1] == in[ref - 1]) {
+				--ip;
+				--ref;
+				++length;
+			}
+
+			op = lz_write_sequence(op, in + anchor, ip - anchor, ip - ref, length);
+			ip += length;
+			anchor = ip;
+		}
+	}
+	op = lz_write_sequence(op, in + anchor, n - anchor, 0, 0);
+
+	uint32_t compressed = op - body;
+	if (compressed >= n) {
+		::memcpy(body, in, n);
+		compressed = n | LZ_STORED;
+		op = body + n;
+	}
+	lz_write32le(out, n);
+	lz_write32le(out + 4, compressed);
+	return op - out;
+}
+
+
+inline lz_compressor::lz_compressor(size_t block_size) noexcept
+  : block_size_(std::max<size_t>(1, std::min<size_t>(block_size, detail::LZ_STORED - 1)))
+{}
+
+
+inline int lz_compressor::transform(const unsigned char*& in, const unsigned char* in_end,
+	unsigned char*& out, unsigned char* out_end, bool) noexcept
+{
+	size_t n = std::min<size_t>(in_end - in, block_size_);
+	size_t const space = out_end - out;
+
+	// Shrink the block until its worst case fits into the output.
+	if (lz_compress_bound(n) > space) {
+		n = space > lz_compress_bound(0) ? (space - lz_compress_bound(0)) * 255 / 256 : 0;
+	}
+	if (n == 0) {
+		return 0;
+	}
+
+	out += lz_compress_block(in, n, out, table_);
+	in += n;
+	return 0;
+}
+
+
+inline lz_decompressor::lz_decompressor(size_t max_block_size) noexcept
+  : max_block_size_(max_block_size)
+{}
+
+
+inline int lz_decompressor::transform(const unsigned char*& in, const unsigned char* in_end,
+	unsigned char*& out, unsigned char* out_end, bool flush) noexcept
+{
+	using namespace detail;
+
+	while (true) {
+		size_t const available = in_end - in;
+		if (available < LZ_HEADER_SIZE) {
+			break;
+		}
+
+		uint32_t const raw_size = lz_read32le(in);
+		uint32_t const compressed = lz_read32le(in + 4);
+		size_t const body_size = compressed & ~LZ_STORED;
+		if (raw_size > max_block_size_ || body_size > lz_compress_bound(raw_size)) {
+			errno = EBADMSG;
+			return -1;
+		}
+		if (available < LZ_HEADER_SIZE + body_size) {
+			break;
+		}
+		if (size_t(out_end - out) < raw_size) {
+			return 0; // Backpressure, not truncation.
+		}
+
+		const unsigned char* body = in + LZ_HEADER_SIZE;
+		if (compressed & LZ_STORED) {
+			if (body_size != raw_size) {
+				errno = EBADMSG;
+				return -1;
+			}
+			::memcpy(out, body, raw_size);
+		} else if (lz_decode(body, body + body_size, out, out + raw_size) != out + raw_size) {
+			errno = EBADMSG;
+			return -1;
+		}
+
+		in += LZ_HEADER_SIZE + body_size;
+		out += raw_size;
+	}
+
+	if (flush && in != in_end) {
+		errno = EBADMSG;
+		return -1;
+	}
+	return 0;
+}
+
+} // namespace bev
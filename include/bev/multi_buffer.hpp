@@ -0,0 +1,250 @@
+#pragma once
+
+#include <bev/slab_pool.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+#include <limits.h>
+#include <sys/uio.h>
+
+namespace bev {
+
+// # Multi Buffer
+//
+// An unbounded buffer made of a chain of fixed-size slabs from a `slab_pool`,
+// for messages that are too large or too unpredictable for a fixed
+// `io_buffer` or ringbuffer.
+//
+// Growing the buffer just appends another slab, so nothing is ever copied or
+// moved. In return, the contents are not contiguous, and are exposed as
+// sequences of `iovec`s for `readv()` and `writev()` instead:
+//
+//     +-------------+   +-------------+   +-------------+
+//     |   |  data   |-->|    data     |-->| data |      |
+//     +-------------+   +-------------+   +-------------+
+//          ^ head                                ^ tail
+//
+// Slabs that were completely consumed are released to the pool right away.
+//
+//
+// # Usage
+//
+// Writing data into the buffer:
+//
+//     bev::slab_pool pool;
+//     bev::multi_buffer mb(pool);
+//     auto free = mb.prepare(1024*1024);
+//     ssize_t n = ::readv(socket, free.iov, free.count);
+//     mb.commit(n);
+//
+// Reading data from the buffer:
+//
+//     auto data = mb.data();
+//     ssize_t n = ::writev(socket, data.iov, data.count);
+//     mb.consume(n);
+//
+// The `iovec`s stay valid until the next call to a non-const member function.
+// At most `IOV_MAX` of them are returned, which covers less than the
+// requested size for very small slabs.
+//
+//
+// # Exceptions
+//
+// `prepare()` throws `std::bad_alloc` if no slab can be allocated. `data()`
+// might throw `std::bad_alloc` too, the first time it needs more `iovec`s.
+// All other operations are noexcept.
+//
+//
+// # Multi-threading
+//
+// No concurrent operations are allowed, which includes the pool.
+//
+
+class multi_buffer
+{
+public:
+    struct buffers {
+        const struct iovec* iov;
+        int count;
+        size_t size; // Total size of all `iovec`s.
+    };
+
+    // The buffer never grows beyond `max_size` bytes of data.
+    explicit multi_buffer(slab_pool& pool, size_t max_size = SIZE_MAX) noexcept;
+    ~multi_buffer() noexcept;
+
+    // NOTE: The returned `size` might be less than requested.
+    buffers prepare(size_t size);
+    void commit(size_t n) noexcept;
+    void consume(size_t n) noexcept;
+    void clear() noexcept;
+
+    buffers data();
+
+    // The data at the head that is contiguous.
+    char* read_head() noexcept;
+    size_t contiguous_size() const noexcept;
+
+    bool empty() const noexcept;
+    size_t size() const noexcept;     // Amount of data inside the buffer.
+    size_t capacity() const noexcept; // Amount of memory currently held.
+    size_t max_size() const noexcept;
+
+    multi_buffer(const multi_buffer&) = delete;
+    multi_buffer& operator=(const multi_buffer&) = delete;
+
+private:
+    buffers make_buffers(size_t offset, size_t size);
+
+    slab_pool& pool_;
+    size_t slab_size_;
+    size_t max_size_;
+    std::deque<char*> slabs_;
+    size_t head_; // Offset of the data in the first slab.
+    size_t size_;
+    std::vector<struct iovec> iov_;
+};
+
+
+// Implementation.
+
+inline multi_buffer::multi_buffer(slab_pool& pool, size_t max_size) noexcept
+  : pool_(pool)
+  , slab_size_(pool.slab_size())
+  , max_size_(max_size)
+  , head_(0)
+  , size_(0)
+{
+}
+
+
+inline multi_buffer::~multi_buffer() noexcept
+{
+    this->clear();
+}
+
+
+inline multi_buffer::buffers multi_buffer::make_buffers(size_t offset, size_t size)
+{
+    // `offset` is relative to the start of the first slab.
+    iov_.clear();
+    size_t total = 0;
+    size_t index = offset / slab_size_;
+    size_t within = offset % slab_size_;
+    while (total < size && iov_.size() < IOV_MAX) {
+        size_t const n = std::min(slab_size_ - within, size - total);
+        iov_.push_back(iovec {slabs_[index] + within, n});
+        total += n;
+        ++index;
+        within = 0;
+    }
+    return buffers {iov_.data(), static_cast<int>(iov_.size()), total};
+}
+
+
+inline multi_buffer::buffers multi_buffer::prepare(size_t n)
+{
+    n = std::min(n, max_size_ - size_);
+
+    // No more slabs than can be covered by `IOV_MAX` iovecs.
+    size_t const tail = head_ + size_;
+    size_t const max_slabs = tail / slab_size_ + IOV_MAX;
+    while (slabs_.size() * slab_size_ < tail + n && slabs_.size() < max_slabs) {
+        // Make sure that the slab is not lost if the deque can't grow.
+        char* slab = pool_.acquire();
+        try {
+            slabs_.push_back(slab);
+        } catch (...) {
+            pool_.release(slab);
+            throw;
+        }
+    }
+
+    return this->make_buffers(tail, n);
+}
+
+
+inline void multi_buffer::commit(size_t n) noexcept
+{
+    assert(head_ + size_ + n <= slabs_.size() * slab_size_);
+    size_ += n;
+}
+
+
+inline void multi_buffer::consume(size_t n) noexcept
+{
+    assert(n <= size_);
+    size_ -= n;
+    head_ += n;
+
+    if (size_ == 0) {
+        // Don't keep any memory while idle.
+        this->clear();
+        return;
+    }
+
+    while (head_ >= slab_size_) {
+        pool_.release(slabs_.front());
+        slabs_.pop_front();
+        head_ -= slab_size_;
+    }
+}
+
+
+inline void multi_buffer::clear() noexcept
+{
+    for (char* slab : slabs_) {
+        pool_.release(slab);
+    }
+    slabs_.clear();
+    head_ = 0;
+    size_ = 0;
+}
+
+
+inline multi_buffer::buffers multi_buffer::data()
+{
+    return this->make_buffers(head_, size_);
+}
+
+
+inline char* multi_buffer::read_head() noexcept
+{
+    return slabs_.empty() ? nullptr : slabs_.front() + head_;
+}
+
+
+inline size_t multi_buffer::contiguous_size() const noexcept
+{
+    return std::min(size_, slab_size_ - head_);
+}
+
+
+inline bool multi_buffer::empty() const noexcept
+{
+    return size_ == 0;
+}
+
+
+inline size_t multi_buffer::size() const noexcept
+{
+    return size_;
+}
+
+
+inline size_t multi_buffer::capacity() const noexcept
+{
+    return slabs_.size() * slab_size_;
+}
+
+
+inline size_t multi_buffer::max_size() const noexcept
+{
+    return max_size_;
+}
+
+} // namespace bev
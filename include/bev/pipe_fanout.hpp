@@ -0,0 +1,262 @@
+#pragma once
+
+#include <bev/linear_ringbuffer.hpp>
+
+#include <algorithm>
+#include <cerrno>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace bev {
+
+// # Pipe Fan-Out
+//
+// Duplicates the contents of a `linear_ringbuffer_` to several file
+// descriptors while copying every byte only once.
+//
+// For every output there is a private staging pipe. A chunk of readable data
+// is written into the first staging pipe, which is the only copy performed,
+// and duplicated into all other staging pipes with `tee()`, which only takes
+// references to the pipe pages. From there, each staging pipe is `splice()`d
+// into its output independently, so a slow output does not hold back the
+// others until the next chunk is started.
+//
+//          rb --write()--> [staging 0] --splice()--> output 0
+//                               |
+//                             tee()
+//                               v
+//                          [staging 1] --splice()--> output 1
+//
+// Data is only consumed from the buffer once all outputs have accepted it,
+// so the buffer applies backpressure according to the slowest output.
+//
+// Note that the data is deliberately not `vmsplice()`d from the buffer:
+// the pipes would then hold references to the buffer pages themselves, and
+// the data seen by slow readers would change when the buffer wraps around.
+//
+//
+// # Usage
+//
+//     int outputs[] = {recorder_fd, live_fd};
+//     bev::pipe_fanout fanout(outputs, 2);
+//     while (running) {
+//         [produce data into rb]
+//         if (fanout.pump(rb) < 0) {
+//             [...]
+//         }
+//         [poll outputs for writability if `!fanout.idle()`]
+//     }
+//
+// `pump()` moves as much data as possible and returns the number of bytes
+// consumed from the buffer. It does not block on the staging pipes, so if
+// the outputs are non-blocking too, it returns as soon as no output can make
+// progress.
+//
+//
+// # Errors and Exceptions
+//
+// The constructor throws a `std::system_error` if the staging pipes cannot be
+// created. `pump()` returns -1 and sets `errno` on failure. A chunk that could
+// not be duplicated into all staging pipes is kept, and the next `pump()` only
+// retries the missing copies, so no output receives any data twice.
+//
+
+class pipe_fanout {
+public:
+	// The file descriptors in `fds` are not owned by the fan-out. The actual
+	// pipe size may be rounded up by the kernel.
+	pipe_fanout(const int* fds, size_t n, size_t pipe_size = 64*1024);
+	~pipe_fanout() noexcept;
+
+	template<typename SizeT>
+	ssize_t pump(linear_ringbuffer_<SizeT>& rb) noexcept;
+
+	// True if all outputs have accepted all data taken from the buffer.
+	bool idle() const noexcept;
+
+	pipe_fanout(const pipe_fanout&) = delete;
+	pipe_fanout& operator=(const pipe_fanout&) = delete;
+
+private:
+	struct output {
+		int fd;
+		int pipe[2];
+		size_t pending; // Bytes left in the staging pipe.
+		bool staged;    // The current chunk is in the staging pipe.
+	};
+
+	int start_chunk(const unsigned char* data, size_t n) noexcept;
+	int tee_chunk() noexcept;
+	void close_pipes() noexcept;
+
+	std::vector<output> outputs_;
+	size_t pipe_size_;
+	size_t chunk_; // Size of the chunk currently being distributed.
+};
+
+
+// Implementation.
+
+inline pipe_fanout::pipe_fanout(const int* fds, size_t n, size_t pipe_size)
+  : outputs_()
+  , pipe_size_(pipe_size)
+  , chunk_(0)
+{
+	outputs_.reserve(n);
+	for (size_t i = 0; i < n; ++i) {
+		output out {fds[i], {-1, -1}, 0, false};
+		if (::pipe2(out.pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+			int error = errno;
+			this->close_pipes();
+			throw std::system_error {error, std::system_category(), __PRETTY_FUNCTION__};
+		}
+		outputs_.push_back(out);
+
+		// All staging pipes need the same size for `tee()` to always
+		// duplicate a whole chunk.
+		int size = ::fcntl(out.pipe[1], F_SETPIPE_SZ, static_cast<int>(pipe_size));
+		if (size < 0) {
+			int error = errno;
+			this->close_pipes();
+			throw std::system_error {error, std::system_category(), __PRETTY_FUNCTION__};
+		}
+		pipe_size_ = size;
+	}
+}
+
+
+inline pipe_fanout::~pipe_fanout() noexcept
+{
+	this->close_pipes();
+}
+
+
+inline void pipe_fanout::close_pipes() noexcept
+{
+	for (output& out : outputs_) {
+		::close(out.pipe[0]);
+		::close(out.pipe[1]);
+	}
+	outputs_.clear();
+}
+
+
+inline int pipe_fanout::start_chunk(const unsigned char* data, size_t n) noexcept
+{
+	ssize_t written = ::write(outputs_[0].pipe[1], data, std::min(n, pipe_size_));
+	if (written < 0) {
+		return errno == EAGAIN ? 0 : -1;
+	}
+
+	// From here on, the chunk is in the first staging pipe, so it must not
+	// be written again even if duplicating it fails.
+	for (output& out : outputs_) {
+		out.staged = false;
+	}
+	outputs_[0].pending = written;
+	outputs_[0].staged = true;
+	chunk_ = written;
+	return 0;
+}
+
+
+// Returns 1 once all staging pipes hold the current chunk, and 0 if that has
+// to be retried later.
+inline int pipe_fanout::tee_chunk() noexcept
+{
+	for (size_t i = 1; i < outputs_.size(); ++i) {
+		output& out = outputs_[i];
+		if (out.staged) {
+			continue;
+		}
+
+		ssize_t res = ::tee(outputs_[0].pipe[0], out.pipe[1], chunk_, SPLICE_F_NONBLOCK);
+		if (res == static_cast<ssize_t>(chunk_)) {
+			out.pending = chunk_;
+			out.staged = true;
+			continue;
+		}
+		if (res < 0) {
+			return errno == EAGAIN || errno == EINTR ? 0 : -1;
+		}
+
+		// A partial `tee()` cannot be resumed, since the next call would
+		// start again at the beginning of the source pipe. Discard the
+		// partial copy, so that the retry starts from an empty pipe.
+		char discard[4096];
+		for (ssize_t left = res; left > 0; ) {
+			ssize_t n = ::read(out.pipe[0], discard, std::min<size_t>(left, sizeof discard));
+			if (n <= 0) {
+				return -1;
+			}
+			left -= n;
+		}
+		errno = EIO;
+		return -1;
+	}
+	return 1;
+}
+
+
+template<typename SizeT>
+ssize_t pipe_fanout::pump(linear_ringbuffer_<SizeT>& rb) noexcept
+{
+	ssize_t consumed = 0;
+	while (true) {
+		if (chunk_ == 0) {
+			if (rb.empty() || outputs_.empty()) {
+				return consumed;
+			}
+			if (this->start_chunk(rb.read_head(), rb.size()) < 0) {
+				return -1;
+			}
+			if (chunk_ == 0) {
+				return consumed;
+			}
+		}
+
+		// The first staging pipe is the source of all copies, so nothing may
+		// be spliced out of it before all copies exist.
+		int const staged = this->tee_chunk();
+		if (staged <= 0) {
+			return staged < 0 ? -1 : consumed;
+		}
+
+		bool progress = false;
+		bool done = true;
+		for (output& out : outputs_) {
+			if (out.pending == 0) {
+				continue;
+			}
+			ssize_t res = ::splice(out.pipe[0], nullptr, out.fd, nullptr,
+				out.pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if (res < 0 && errno != EAGAIN && errno != EINTR) {
+				return -1;
+			}
+			if (res > 0) {
+				out.pending -= res;
+				progress = true;
+			}
+			done = done && out.pending == 0;
+		}
+
+		if (done) {
+			rb.consume(chunk_);
+			consumed += chunk_;
+			chunk_ = 0;
+		} else if (!progress) {
+			return consumed;
+		}
+	}
+}
+
+
+inline bool pipe_fanout::idle() const noexcept
+{
+	return chunk_ == 0;
+}
+
+} // namespace bev
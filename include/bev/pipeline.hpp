@@ -0,0 +1,319 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+namespace bev {
+
+// # Pipeline
+//
+// Chains ringbuffers with transformations like compression, encryption or
+// encoding in between, without any temporary buffers:
+//
+//     ring -> stage -> ring -> stage -> ring
+//
+// A stage reads directly from the `read_head()` of its input buffer and writes
+// directly to the `write_head()` of its output buffer. If the output buffer is
+// full, the stage just stops consuming its input, so backpressure propagates
+// upstream by itself. Input that a stage can not handle yet, e.g. an
+// incomplete block, simply stays in the input buffer until more arrives.
+//
+// Each stage can either be driven inline by calling `pump()`, or run on its
+// own thread by a `stage_thread`. `pump()` works with any of
+// `linear_ringbuffer_`, `checksummed_ringbuffer_` or `io_buffer_view`.
+// Since `io_buffer_view` does not allow concurrent operations, a
+// `stage_thread` only accepts the two ringbuffer types.
+//
+//
+// # Stages
+//
+// A stage is any class with a member function
+//
+//     int transform(const unsigned char*& in, const unsigned char* in_end,
+//                   unsigned char*& out, unsigned char* out_end, bool flush) noexcept;
+//
+// that transforms some prefix of `[in, in_end)` into `[out, out_end)` and
+// advances `in` and `out` accordingly. `flush` is set when no more input will
+// follow, so that the stage has to handle the remaining input. It returns 0,
+// or -1 and sets `errno` if the input is malformed.
+//
+// The following stages are available:
+//
+//   * `lz_compressor` and `lz_decompressor` in `<bev/lz_codec.hpp>`
+//   * `chacha20` in `<bev/chacha20.hpp>`
+//   * `hex_encoder` and `base64_encoder` in `<bev/text_encoding.hpp>`
+//
+//
+// # Usage
+//
+// Inline:
+//
+//     bev::lz_compressor lz;
+//     [write data into `in`]
+//     if (bev::pump(lz, in, out) < 0) {
+//         [malformed input]
+//     }
+//
+// On a separate thread:
+//
+//     bev::chacha20 cipher(key, nonce);
+//     bev::stage_thread encrypt(cipher, in, out);
+//     [write data into `in`]
+//     encrypt.close(); // No more input.
+//     encrypt.join();  // All input was transformed.
+//
+// Destroying a `stage_thread` that was not joined stops it immediately,
+// possibly leaving input behind.
+//
+// A stage that has nothing to do first yields a few times, then sleeps for
+// increasingly long periods of up to 1ms, so an idle pipeline does not burn
+// a core. The writer of the input buffer can call `notify()` after
+// `commit()` to wake the stage right away, and `close()` does so as well.
+// Without it, e.g. between two chained `stage_thread`s, the stage picks up
+// new input or output space after at most one sleep period.
+//
+//     source.commit(n);
+//     encrypt.notify();
+//
+//
+// # Concurrency
+//
+// A `stage_thread` is the only reader of its input buffer and the only writer
+// of its output buffer, so every buffer in a pipeline has exactly one reader
+// and one writer thread.
+//
+
+// Runs `stage` once on the readable bytes of `in` and the free space of
+// `out`. Returns 1 if it made progress, 0 if it did not, or -1 and sets
+// `errno` if the stage failed.
+template<typename Stage, typename In, typename Out>
+int pump(Stage& stage, In& in, Out& out, bool flush = false) noexcept;
+
+
+template<typename SizeT> class linear_ringbuffer_;
+template<typename SizeT, size_t Checkpoints> class checksummed_ringbuffer_;
+
+namespace detail {
+
+template<typename T>
+struct is_spsc_ringbuffer : std::false_type {};
+
+template<typename SizeT>
+struct is_spsc_ringbuffer<linear_ringbuffer_<SizeT>> : std::true_type {};
+
+template<typename SizeT, size_t Checkpoints>
+struct is_spsc_ringbuffer<checksummed_ringbuffer_<SizeT, Checkpoints>> : std::true_type {};
+
+} // namespace detail
+
+
+template<typename Stage, typename In, typename Out>
+class stage_thread {
+public:
+	static_assert(detail::is_spsc_ringbuffer<In>::value && detail::is_spsc_ringbuffer<Out>::value,
+		"stage_thread needs buffers that allow one concurrent reader and writer.");
+
+	stage_thread(Stage& stage, In& in, Out& out);
+	~stage_thread() noexcept;
+
+	// Signals that no more input will be written.
+	void close() noexcept;
+
+	// Wakes the stage if it is sleeping, see description above.
+	void notify() noexcept;
+
+	// Waits until all input was transformed after `close()`, or until the
+	// stage failed.
+	void join();
+
+	bool done() const noexcept;
+
+	// The `errno` value of a failed stage, or 0.
+	int error() const noexcept;
+
+	stage_thread(const stage_thread&) = delete;
+	stage_thread& operator=(const stage_thread&) = delete;
+
+private:
+	void run() noexcept;
+
+	// Sleeps for at most `timeout`, unless the buffers changed since they
+	// had `available` readable and `space` free bytes, or `closed_` is no
+	// longer `closed`.
+	void sleep(size_t available, size_t space, bool closed,
+		std::chrono::microseconds timeout) noexcept;
+
+	Stage& stage_;
+	In& in_;
+	Out& out_;
+	std::atomic<bool> closed_;
+	std::atomic<bool> stopped_;
+	std::atomic<bool> done_;
+	std::atomic<int> error_;
+	std::atomic<bool> sleeping_;
+	std::mutex mutex_;
+	std::condition_variable wakeup_cv_;
+	std::thread thread_;
+};
+
+
+// Implementation.
+
+template<typename Stage, typename In, typename Out>
+int pump(Stage& stage, In& in, Out& out, bool flush) noexcept
+{
+	// `io_buffer_view` works with `char`, the ringbuffers with `unsigned char`.
+	const unsigned char* const first = reinterpret_cast<const unsigned char*>(in.read_head());
+	unsigned char* const out_first = reinterpret_cast<unsigned char*>(out.write_head());
+	const unsigned char* p = first;
+	unsigned char* q = out_first;
+
+	if (stage.transform(p, first + in.size(), q, out_first + out.free_size(), flush) < 0) {
+		return -1;
+	}
+
+	// Publish the output before handing back the input space.
+	out.commit(q - out_first);
+	in.consume(p - first);
+	return p != first || q != out_first;
+}
+
+
+template<typename Stage, typename In, typename Out>
+stage_thread<Stage, In, Out>::stage_thread(Stage& stage, In& in, Out& out)
+  : stage_(stage)
+  , in_(in)
+  , out_(out)
+  , closed_(false)
+  , stopped_(false)
+  , done_(false)
+  , error_(0)
+  , sleeping_(false)
+  , mutex_()
+  , wakeup_cv_()
+  , thread_(&stage_thread::run, this)
+{}
+
+
+template<typename Stage, typename In, typename Out>
+stage_thread<Stage, In, Out>::~stage_thread() noexcept
+{
+	if (thread_.joinable()) {
+		stopped_.store(true, std::memory_order_relaxed);
+		this->notify();
+		thread_.join();
+	}
+}
+
+
+template<typename Stage, typename In, typename Out>
+void stage_thread<Stage, In, Out>::close() noexcept
+{
+	closed_.store(true, std::memory_order_release);
+	this->notify();
+}
+
+
+template<typename Stage, typename In, typename Out>
+void stage_thread<Stage, In, Out>::notify() noexcept
+{
+	// Pairs with the fence in `sleep()`: either the stage sees what was
+	// written before this call, or we see that it is going to sleep.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (sleeping_.load(std::memory_order_relaxed)
+			&& sleeping_.exchange(false, std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> lock(mutex_);
+		wakeup_cv_.notify_one();
+	}
+}
+
+
+template<typename Stage, typename In, typename Out>
+void stage_thread<Stage, In, Out>::join()
+{
+	thread_.join();
+}
+
+
+template<typename Stage, typename In, typename Out>
+bool stage_thread<Stage, In, Out>::done() const noexcept
+{
+	return done_.load(std::memory_order_acquire);
+}
+
+
+template<typename Stage, typename In, typename Out>
+int stage_thread<Stage, In, Out>::error() const noexcept
+{
+	return error_.load(std::memory_order_acquire);
+}
+
+
+template<typename Stage, typename In, typename Out>
+void stage_thread<Stage, In, Out>::run() noexcept
+{
+	// Number of idle rounds spent yielding before starting to sleep, and
+	// the longest sleep as a power of two of microseconds.
+	unsigned const SPIN_ROUNDS = 64;
+	unsigned const MAX_SLEEP_SHIFT = 10;
+
+	unsigned idle = 0;
+	while (!stopped_.load(std::memory_order_relaxed)) {
+		// Read `closed_` before pumping, so that a flush never misses
+		// input that was written before `close()`.
+		bool const flush = closed_.load(std::memory_order_acquire);
+		size_t const available = in_.size();
+		size_t const space = out_.free_size();
+
+		int progress = pump(stage_, in_, out_, flush);
+		if (progress < 0) {
+			error_.store(errno, std::memory_order_release);
+			break;
+		}
+		if (flush && progress == 0 && in_.empty()) {
+			done_.store(true, std::memory_order_release);
+			break;
+		}
+		if (progress > 0) {
+			idle = 0;
+		} else if (++idle < SPIN_ROUNDS) {
+			std::this_thread::yield();
+		} else {
+			unsigned const shift = idle - SPIN_ROUNDS < MAX_SLEEP_SHIFT
+				? idle - SPIN_ROUNDS : MAX_SLEEP_SHIFT;
+			this->sleep(available, space, flush, std::chrono::microseconds(1u << shift));
+		}
+	}
+}
+
+
+template<typename Stage, typename In, typename Out>
+void stage_thread<Stage, In, Out>::sleep(size_t available, size_t space, bool closed,
+	std::chrono::microseconds timeout) noexcept
+{
+	sleeping_.store(true, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	// Anything that happened before a `notify()` that saw `sleeping_` as
+	// false is visible now.
+	if (in_.size() != available || out_.free_size() != space
+			|| closed_.load(std::memory_order_relaxed) != closed
+			|| stopped_.load(std::memory_order_relaxed)) {
+		sleeping_.store(false, std::memory_order_relaxed);
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	wakeup_cv_.wait_for(lock, timeout, [this] {
+		return !sleeping_.load(std::memory_order_relaxed);
+	});
+	sleeping_.store(false, std::memory_order_relaxed);
+}
+
+} // namespace bev
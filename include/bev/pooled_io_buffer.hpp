@@ -0,0 +1,222 @@
+#pragma once
+
+#include <bev/io_buffer.hpp>
+#include <bev/slab_pool.hpp>
+
+#include <new>
+
+namespace bev {
+
+// # Pooled IO Buffer
+//
+// An `io_buffer` that only holds memory while it holds data. The memory is a
+// slab borrowed from a `slab_pool`, by default the one of the current thread,
+// and it is returned to the pool as soon as the buffer becomes empty again.
+//
+// This is meant for servers with many mostly idle connections: instead of
+// one buffer per connection, the memory held is proportional to the number
+// of connections that currently have data in flight. Once a burst is over,
+// the pool gives the memory of its idle chunks back to the system, see
+// `slab_pool`.
+//
+//
+// # Usage
+//
+// The interface is the same as for `io_buffer_view`, but the data must always
+// be written through `prepare()`, as before that there might be no memory
+// to write to:
+//
+//     bev::pooled_io_buffer iob;
+//     bev::io_buffer_view::slab slab = iob.prepare(512);
+//     ssize_t n = ::read(socket, slab.data, slab.size);
+//     iob.commit(n > 0 ? n : 0);   // Gives back the slab if still empty.
+//
+//     n = ::write(socket, iob.read_head(), iob.size());
+//     iob.consume(n);              // Gives back the slab if now empty.
+//
+// `capacity()` is the slab size of the pool even while no slab is held.
+//
+//
+// # Multi-threading
+//
+// No concurrent operations are allowed. A buffer using the thread's pool must
+// only be used on that thread, and must be destroyed before the thread exits.
+//
+//
+// # Exceptions
+//
+// All operations are noexcept. If the pool fails to allocate a slab,
+// `prepare()` returns an empty slab, as if the buffer was full.
+//
+
+class pooled_io_buffer
+{
+public:
+    pooled_io_buffer() noexcept;
+    explicit pooled_io_buffer(slab_pool& pool) noexcept;
+    ~pooled_io_buffer() noexcept;
+
+    // NOTE: The returned `slab.size` might be less than requested.
+    io_buffer_view::slab prepare(size_t size) noexcept;
+    void commit(size_t n) noexcept;
+    void consume(size_t n) noexcept;
+    void clear() noexcept;
+
+    char* read_head() noexcept;
+    char* write_head() noexcept;
+
+    size_t size() const noexcept;      // Amount of data inside the buffer.
+    size_t free_size() const noexcept; // Amount of data that can be committed.
+    size_t capacity() const noexcept;  // Amount of data that can be prepared.
+
+    void set_compaction_policy(const io_buffer_view::compaction_policy& policy) noexcept;
+    const io_buffer_view::compaction_policy& get_compaction_policy() const noexcept;
+    uint64_t bytes_moved() const noexcept;
+    uint64_t compactions() const noexcept;
+
+    // Whether the buffer currently holds a slab.
+    bool holds_memory() const noexcept;
+
+    pooled_io_buffer(const pooled_io_buffer&) = delete;
+    pooled_io_buffer& operator=(const pooled_io_buffer&) = delete;
+
+private:
+    void release() noexcept;
+
+    slab_pool& pool_;
+    io_buffer_view view_;
+    char* slab_;
+};
+
+
+// Implementation.
+
+inline pooled_io_buffer::pooled_io_buffer() noexcept
+  : pooled_io_buffer(thread_slab_pool())
+{
+}
+
+
+inline pooled_io_buffer::pooled_io_buffer(slab_pool& pool) noexcept
+  : pool_(pool)
+  , view_(nullptr, 0)
+  , slab_(nullptr)
+{
+}
+
+
+inline pooled_io_buffer::~pooled_io_buffer() noexcept
+{
+    this->release();
+}
+
+
+inline void pooled_io_buffer::release() noexcept
+{
+    if (slab_) {
+        pool_.release(slab_);
+        slab_ = nullptr;
+        view_.assign(nullptr, 0);
+    }
+}
+
+
+inline io_buffer_view::slab pooled_io_buffer::prepare(size_t n) noexcept
+{
+    if (!slab_) {
+        try {
+            slab_ = pool_.acquire();
+        } catch (const std::bad_alloc&) {
+            return io_buffer_view::slab {nullptr, 0};
+        }
+        view_.assign(slab_, pool_.slab_size());
+    }
+
+    return view_.prepare(n);
+}
+
+
+inline void pooled_io_buffer::commit(size_t n) noexcept
+{
+    view_.commit(n);
+    if (view_.size() == 0) {
+        this->release();
+    }
+}
+
+
+inline void pooled_io_buffer::consume(size_t n) noexcept
+{
+    view_.consume(n);
+    if (view_.size() == 0) {
+        this->release();
+    }
+}
+
+
+inline void pooled_io_buffer::clear() noexcept
+{
+    this->release();
+}
+
+
+inline char* pooled_io_buffer::read_head() noexcept
+{
+    return view_.read_head();
+}
+
+
+inline char* pooled_io_buffer::write_head() noexcept
+{
+    return view_.write_head();
+}
+
+
+inline size_t pooled_io_buffer::size() const noexcept
+{
+    return view_.size();
+}
+
+
+inline size_t pooled_io_buffer::free_size() const noexcept
+{
+    return view_.free_size();
+}
+
+
+inline size_t pooled_io_buffer::capacity() const noexcept
+{
+    return slab_ ? view_.capacity() : pool_.slab_size();
+}
+
+
+inline void pooled_io_buffer::set_compaction_policy(const io_buffer_view::compaction_policy& policy) noexcept
+{
+    view_.set_compaction_policy(policy);
+}
+
+
+inline const io_buffer_view::compaction_policy& pooled_io_buffer::get_compaction_policy() const noexcept
+{
+    return view_.get_compaction_policy();
+}
+
+
+inline uint64_t pooled_io_buffer::bytes_moved() const noexcept
+{
+    return view_.bytes_moved();
+}
+
+
+inline uint64_t pooled_io_buffer::compactions() const noexcept
+{
+    return view_.compactions();
+}
+
+
+inline bool pooled_io_buffer::holds_memory() const noexcept
+{
+    return slab_ != nullptr;
+}
+
+} // namespace bev
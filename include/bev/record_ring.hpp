@@ -0,0 +1,219 @@
+#pragma once
+
+#include <bev/linear_ringbuffer.hpp>
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+namespace bev {
+
+// # Record Ring
+//
+// A queue of variable-size records layered on top of a `linear_ringbuffer_`.
+//
+// Every record is stored as a 32-bit length prefix followed by the payload,
+// padded to a multiple of 8 bytes so that the next prefix is aligned again:
+//
+//     +------------------------------------------------------+
+//     | len | payload ...  | pad | len | payload | pad | ...  |
+//     +------------------------------------------------------+
+//      ^ read_head()
+//
+// Thanks to the mirrored mapping of the underlying buffer, a record is never
+// split at the edge of the buffer, so `front()` can hand out a pointer to the
+// complete payload that can be passed directly to a parser.
+//
+//
+// # Usage
+//
+// Copying a complete record into the ring:
+//
+//     bev::record_ring rr;
+//     if (!rr.try_push(msg, msg_len)) {
+//         [ring is full]
+//     }
+//
+// Constructing a record in place:
+//
+//     unsigned char* p = rr.reserve(max_len);
+//     if (p) {
+//         size_t n = encode(p, max_len);
+//         rr.publish(n); // n <= max_len
+//     }
+//
+// Reading records:
+//
+//     while (!rr.empty()) {
+//         bev::record_ring::record r = rr.front();
+//         parse(r.data, r.size);
+//         rr.pop();
+//     }
+//
+//
+// # Errors and Exceptions
+//
+// Construction behaves like for `linear_ringbuffer_`. `try_push()` and
+// `reserve()` indicate a full ring by returning false resp. a null pointer.
+// A record that is larger than the capacity can never be stored.
+//
+//
+// # Concurrency
+//
+// Same as `linear_ringbuffer_`, i.e. one thread may push records while
+// another one pops them.
+//
+
+template<typename SizeT = size_t>
+class record_ring_ {
+public:
+	typedef typename linear_ringbuffer_<SizeT>::delayed_init delayed_init;
+	typedef uint32_t length_type;
+
+	struct record {
+		unsigned char* data;
+		size_t size;
+	};
+
+	static constexpr size_t ALIGNMENT = 8;
+
+	record_ring_(SizeT minsize = 640*1024);
+	record_ring_(const delayed_init) noexcept;
+	int initialize(SizeT minsize) noexcept;
+
+	bool try_push(const void* data, size_t n) noexcept;
+
+	// Returns storage for a record of up to `n` bytes, or null if there is
+	// not enough space. Nothing is visible to the reader until `publish()`.
+	unsigned char* reserve(size_t n) noexcept;
+	void publish(size_t n) noexcept;
+
+	// NOTE: `front()` and `pop()` must only be called when `!empty()`.
+	record front() noexcept;
+	void pop() noexcept;
+	bool empty() const noexcept;
+	void clear() noexcept;
+
+	// The underlying buffer, e.g. to query its capacity.
+	const linear_ringbuffer_<SizeT>& buffer() const noexcept;
+
+	// Space occupied by a record with `n` bytes of payload.
+	static constexpr size_t footprint(size_t n) noexcept;
+
+private:
+	linear_ringbuffer_<SizeT> rb_;
+	size_t reserved_;
+};
+
+
+using record_ring = record_ring_<size_t>;
+
+
+// Implementation.
+
+template<typename SizeT>
+constexpr size_t record_ring_<SizeT>::footprint(size_t n) noexcept
+{
+	return (sizeof(length_type) + n + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+
+template<typename SizeT>
+record_ring_<SizeT>::record_ring_(SizeT minsize)
+  : rb_(minsize)
+  , reserved_(0)
+{}
+
+
+template<typename SizeT>
+record_ring_<SizeT>::record_ring_(const delayed_init) noexcept
+  : rb_(delayed_init {})
+  , reserved_(0)
+{}
+
+
+template<typename SizeT>
+int record_ring_<SizeT>::initialize(SizeT minsize) noexcept
+{
+	return rb_.initialize(minsize);
+}
+
+
+template<typename SizeT>
+unsigned char* record_ring_<SizeT>::reserve(size_t n) noexcept
+{
+	// The length must fit into the prefix, and larger records would not
+	// fit into any buffer we can map anyways.
+	if (n > length_type(-1) || footprint(n) > rb_.free_size()) {
+		return nullptr;
+	}
+
+	reserved_ = n;
+	return rb_.write_head() + sizeof(length_type);
+}
+
+
+template<typename SizeT>
+void record_ring_<SizeT>::publish(size_t n) noexcept
+{
+	assert(n <= reserved_);
+	length_type const length = n;
+	::memcpy(rb_.write_head(), &length, sizeof length);
+	rb_.commit(footprint(n));
+	reserved_ = 0;
+}
+
+
+template<typename SizeT>
+bool record_ring_<SizeT>::try_push(const void* data, size_t n) noexcept
+{
+	unsigned char* p = this->reserve(n);
+	if (!p) {
+		return false;
+	}
+
+	::memcpy(p, data, n);
+	this->publish(n);
+	return true;
+}
+
+
+template<typename SizeT>
+auto record_ring_<SizeT>::front() noexcept -> record
+{
+	assert(!this->empty());
+	length_type length;
+	::memcpy(&length, rb_.read_head(), sizeof length);
+	return record {rb_.read_head() + sizeof length, length};
+}
+
+
+template<typename SizeT>
+void record_ring_<SizeT>::pop() noexcept
+{
+	rb_.consume(footprint(this->front().size));
+}
+
+
+template<typename SizeT>
+bool record_ring_<SizeT>::empty() const noexcept
+{
+	return rb_.empty();
+}
+
+
+template<typename SizeT>
+void record_ring_<SizeT>::clear() noexcept
+{
+	rb_.clear();
+	reserved_ = 0;
+}
+
+
+template<typename SizeT>
+auto record_ring_<SizeT>::buffer() const noexcept -> const linear_ringbuffer_<SizeT>&
+{
+	return rb_;
+}
+
+} // namespace bev
@@ -0,0 +1,227 @@
+#pragma once
+
+#include <bev/line_scanner.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+
+namespace bev {
+
+// # RESP Tokenizer
+//
+// Splits one complete value of the Redis serialization protocol (RESP2) into
+// tokens, directly on the contiguous readable area of a `linear_ringbuffer_`
+// or `io_buffer_view`.
+//
+// Nested values are flattened in pre-order, i.e. an array token is followed
+// by the tokens of its elements:
+//
+//     *2\r\n$3\r\nGET\r\n$3\r\nkey\r\n
+//
+//     {'*', 2}, {'$', 3, "GET"}, {'$', 3, "key"}
+//
+// Payloads are reported as offsets relative to the start of the data, i.e. to
+// `read_head()`, and are never copied. Line ends are located with the
+// vectorized search of the `line_scanner`.
+//
+//
+// # Usage
+//
+//     bev::resp_tokenizer tokenizer;
+//     bev::resp_token tokens[64];
+//     size_t count;
+//     ssize_t n = tokenizer.parse(rb, tokens, 64, count);
+//     if (n > 0) {
+//         [handle `count` tokens]
+//         rb.consume(n);
+//     } else if (n == 0) {
+//         [need more bytes, call `parse()` again after the next `commit()`]
+//     } else {
+//         [malformed input or more than 64 tokens]
+//     }
+//
+// When a value is incomplete, the tokenizer remembers how many bytes are at
+// least required before another attempt can succeed, so that a large bulk
+// string arriving in many pieces is not parsed again for every piece.
+//
+
+struct resp_token {
+	char type;      // One of '+', '-', ':', '$' or '*'.
+	int64_t value;  // The integer, bulk string length or array size; -1 for null.
+	uint32_t offset;
+	uint32_t length; // Payload of simple strings, errors and bulk strings.
+};
+
+
+class resp_tokenizer {
+public:
+	resp_tokenizer() noexcept;
+
+	// Returns the length of the first complete value, 0 if it is incomplete,
+	// or -1 if the input is malformed or has more than `max_tokens` tokens.
+	ssize_t parse(const char* data, size_t size, resp_token* tokens,
+		size_t max_tokens, size_t& count) noexcept;
+
+	template<typename Buffer>
+	ssize_t parse(Buffer& b, resp_token* tokens, size_t max_tokens, size_t& count) noexcept;
+
+	// Must be called when the data is replaced by something else than more
+	// bytes of the same value.
+	void reset() noexcept;
+
+private:
+	size_t needed_; // No value can be complete with fewer bytes.
+};
+
+
+// Implementation.
+
+namespace detail {
+
+// Parses a decimal integer with optional sign that spans `[first, last)`.
+inline bool parse_resp_integer(const char* first, const char* last, int64_t& out) noexcept
+{
+	bool negative = false;
+	if (first != last && (*first == '-' || *first == '+')) {
+		negative = *first == '-';
+		++first;
+	}
+	if (first == last) {
+		return false;
+	}
+
+	uint64_t value = 0;
+	for (; first != last; ++first) {
+		unsigned const digit = static_cast<unsigned char>(*first) - '0';
+		if (digit > 9 || value > (UINT64_MAX - digit) / 10) {
+			return false;
+		}
+		value = value * 10 + digit;
+	}
+
+	if (value > static_cast<uint64_t>(INT64_MAX) + negative) {
+		return false;
+	}
+	out = negative ? -static_cast<int64_t>(value - 1) - 1 : static_cast<int64_t>(value);
+	return true;
+}
+
+} // namespace detail
+
+
+inline resp_tokenizer::resp_tokenizer() noexcept
+  : needed_(0)
+{}
+
+
+inline void resp_tokenizer::reset() noexcept
+{
+	needed_ = 0;
+}
+
+
+template<typename Buffer>
+ssize_t resp_tokenizer::parse(Buffer& b, resp_token* tokens, size_t max_tokens, size_t& count) noexcept
+{
+	return this->parse(reinterpret_cast<const char*>(b.read_head()), b.size(),
+		tokens, max_tokens, count);
+}
+
+
+inline ssize_t resp_tokenizer::parse(const char* data, size_t size, resp_token* tokens,
+		size_t max_tokens, size_t& count) noexcept
+{
+	count = 0;
+	if (size < needed_) {
+		return 0;
+	}
+
+	// Payload offsets are 32-bit.
+	if (size > UINT32_MAX) {
+		size = UINT32_MAX;
+	}
+
+	const char* const last = data + size;
+	const char* p = data;
+	uint64_t pending = 1; // Values that still need to be parsed.
+
+	while (pending > 0) {
+		const char* line_end = detail::find_pair(p, last, '\r', '\n');
+		if (line_end == last) {
+			needed_ = size + 1;
+			return 0;
+		}
+		if (count == max_tokens) {
+			return -1;
+		}
+
+		resp_token& token = tokens[count++];
+		token.type = *p;
+		token.value = 0;
+		token.offset = p + 1 - data;
+		token.length = line_end - (p + 1);
+		--pending;
+
+		switch (token.type) {
+		case '+':
+		case '-':
+			break;
+
+		case ':':
+			if (!detail::parse_resp_integer(p + 1, line_end, token.value)) {
+				return -1;
+			}
+			break;
+
+		case '$': {
+			if (!detail::parse_resp_integer(p + 1, line_end, token.value) || token.value < -1) {
+				return -1;
+			}
+			token.length = 0;
+			if (token.value == -1) {
+				break;
+			}
+
+			const char* payload = line_end + 2;
+			if (static_cast<uint64_t>(token.value) + 2 > static_cast<uint64_t>(last - payload)) {
+				// Don't try again before the whole string can be there.
+				needed_ = (payload - data) + token.value + 2;
+				return 0;
+			}
+			if (payload[token.value] != '\r' || payload[token.value + 1] != '\n') {
+				return -1;
+			}
+			token.offset = payload - data;
+			token.length = token.value;
+			line_end = payload + token.value;
+			break;
+		}
+
+		case '*':
+			if (!detail::parse_resp_integer(p + 1, line_end, token.value) || token.value < -1) {
+				return -1;
+			}
+			token.length = 0;
+			if (token.value > 0) {
+				// Reject early what could never fit, which also keeps
+				// `pending` from overflowing.
+				if (static_cast<uint64_t>(token.value) > max_tokens - count) {
+					return -1;
+				}
+				pending += token.value;
+			}
+			break;
+
+		default:
+			return -1;
+		}
+
+		p = line_end + 2;
+	}
+
+	needed_ = 0;
+	return p - data;
+}
+
+} // namespace bev
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <bev/linear_ringbuffer.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace bev {
+
+// # Ringbuffer Pool
+//
+// A cache of initialized `linear_ringbuffer_` instances of one size, so that
+// buffers that are needed only now and then don't pay for the `mmap()` calls
+// and the page faults of a fresh buffer every time.
+//
+// Buffers are handed over by swapping, so no pointers into a buffer have to
+// change while it is in use.
+//
+//
+// # Usage
+//
+//     bev::ringbuffer_pool pool(64*1024);
+//     bev::linear_ringbuffer rb(bev::linear_ringbuffer::delayed_init {});
+//     if (pool.acquire(rb) == 0) {
+//         [use `rb`]
+//         pool.release(rb); // `rb` is uninitialized again.
+//     }
+//
+//
+// # Errors and Exceptions
+//
+// All operations are noexcept. `acquire()` returns -1 and sets `errno` like
+// `linear_ringbuffer_::initialize()` if a new buffer can't be created. The
+// room for `max_cached` buffers is only allocated by the first `release()`;
+// if that fails, the released buffer is unmapped instead of cached.
+//
+//
+// # Concurrency
+//
+// No concurrent operations are allowed. `thread_ringbuffer_pool()` returns a
+// pool with the default settings that is private to the calling thread.
+//
+
+template<typename SizeT = size_t>
+class ringbuffer_pool_ {
+public:
+	explicit ringbuffer_pool_(SizeT ring_size = 64*1024, size_t max_cached = 64) noexcept;
+
+	// Makes the uninitialized `rb` an empty buffer of `ring_size()` bytes.
+	int acquire(linear_ringbuffer_<SizeT>& rb) noexcept;
+
+	// Takes the buffer back, leaving `rb` uninitialized. Buffers beyond
+	// `max_cached` are unmapped right away.
+	void release(linear_ringbuffer_<SizeT>& rb) noexcept;
+
+	SizeT ring_size() const noexcept;
+	size_t cached() const noexcept;
+
+	ringbuffer_pool_(const ringbuffer_pool_&) = delete;
+	ringbuffer_pool_& operator=(const ringbuffer_pool_&) = delete;
+
+private:
+	typedef typename linear_ringbuffer_<SizeT>::delayed_init delayed_init;
+
+	SizeT ring_size_;
+	size_t max_cached_;
+	std::vector<linear_ringbuffer_<SizeT>> free_;
+};
+
+
+using ringbuffer_pool = ringbuffer_pool_<size_t>;
+
+ringbuffer_pool& thread_ringbuffer_pool() noexcept;
+
+
+// Implementation.
+
+template<typename SizeT>
+ringbuffer_pool_<SizeT>::ringbuffer_pool_(SizeT ring_size, size_t max_cached) noexcept
+  : ring_size_(ring_size)
+  , max_cached_(max_cached)
+{}
+
+
+template<typename SizeT>
+int ringbuffer_pool_<SizeT>::acquire(linear_ringbuffer_<SizeT>& rb) noexcept
+{
+	if (free_.empty()) {
+		return rb.initialize(ring_size_);
+	}
+
+	rb.swap(free_.back());
+	free_.pop_back();
+	return 0;
+}
+
+
+template<typename SizeT>
+void ringbuffer_pool_<SizeT>::release(linear_ringbuffer_<SizeT>& rb) noexcept
+{
+	bool cache = free_.size() < max_cached_;
+	if (cache && free_.capacity() < max_cached_) {
+		// Reserve everything at once, so that this is the only `release()`
+		// that can fail to allocate.
+		try {
+			free_.reserve(max_cached_);
+		} catch (...) {
+			cache = false;
+		}
+	}
+
+	if (cache) {
+		rb.clear();
+		free_.emplace_back(delayed_init {});
+		free_.back().swap(rb);
+	} else {
+		// Unmaps the buffer when the temporary is destroyed.
+		linear_ringbuffer_<SizeT>(delayed_init {}).swap(rb);
+	}
+}
+
+
+template<typename SizeT>
+SizeT ringbuffer_pool_<SizeT>::ring_size() const noexcept
+{
+	return ring_size_;
+}
+
+
+template<typename SizeT>
+size_t ringbuffer_pool_<SizeT>::cached() const noexcept
+{
+	return free_.size();
+}
+
+
+inline ringbuffer_pool& thread_ringbuffer_pool() noexcept
+{
+	// Constructing a pool doesn't allocate or map anything yet.
+	static thread_local ringbuffer_pool pool;
+	return pool;
+}
+
+} // namespace bev
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <bev/io_buffer.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace bev {
+
+// # Slab Pool
+//
+// A pool of fixed-size memory slabs, e.g. for the segments of a
+// `multi_buffer`.
+//
+// Slabs are carved out of larger chunks, each of which is an `io_buffer`
+// allocated with the given `io_buffer_options`, e.g. on huge pages. Released
+// slabs are kept on a free list and handed out again, so after warming up,
+// acquiring and releasing a slab are just a push and pop on a vector.
+//
+// A chunk whose slabs have all been released is idle. The pool keeps up to
+// `max_idle_chunks` idle chunks, 1 by default, to absorb the next burst, and
+// returns the memory of any further chunk to the system as soon as it becomes
+// idle. So a burst doesn't pin its high-water mark for the life of the pool,
+// and a pool that alternates between 0 and a few slabs doesn't map and unmap
+// a chunk every time.
+//
+//
+// # Usage
+//
+//     bev::slab_pool pool(16*1024);
+//     char* slab = pool.acquire();
+//     [use `pool.slab_size()` bytes at `slab`]
+//     pool.release(slab);
+//
+//
+// # Exceptions
+//
+// `acquire()` throws `std::bad_alloc` if a new chunk can not be allocated.
+// All other operations are noexcept.
+//
+//
+// # Multi-threading
+//
+// No concurrent operations are allowed, i.e. a pool should be used by a
+// single thread. All slabs must be released before the pool is destroyed.
+//
+// Rather than one pool shared by all threads, which would need a lock or an
+// atomic free list in every `acquire()` and `release()`, each thread gets its
+// own: `thread_slab_pool()` returns a pool with the default settings that is
+// private to the calling thread and destroyed when the thread exits. Slabs
+// must be released to the pool they came from on the same thread.
+//
+
+class slab_pool
+{
+public:
+    explicit slab_pool(size_t slab_size = 16*1024, size_t slabs_per_chunk = 16,
+        const io_buffer_options& options = io_buffer_options(),
+        size_t max_idle_chunks = 1);
+    ~slab_pool() noexcept;
+
+    char* acquire();
+    void release(char* slab) noexcept;
+
+    size_t slab_size() const noexcept;
+    size_t available() const noexcept; // Slabs on the free list.
+    size_t in_use() const noexcept;    // Slabs handed out.
+    size_t chunks() const noexcept;    // Chunks currently allocated.
+
+    slab_pool(const slab_pool&) = delete;
+    slab_pool& operator=(const slab_pool&) = delete;
+
+private:
+    struct chunk {
+        std::unique_ptr<io_buffer> memory;
+        char* first;
+        size_t free; // Slabs of this chunk on the free list.
+    };
+
+    // The chunk containing `slab`.
+    chunk& owner(char* slab) noexcept;
+
+    // Unmaps an idle chunk and drops its slabs from the free list.
+    void free_chunk(chunk& c) noexcept;
+
+    size_t slab_size_;
+    size_t slabs_per_chunk_;
+    io_buffer_options options_;
+    size_t max_idle_chunks_;
+    std::vector<chunk> chunks_; // Ordered by address.
+    std::vector<char*> free_;
+    size_t in_use_;
+    size_t idle_chunks_;
+};
+
+
+slab_pool& thread_slab_pool() noexcept;
+
+
+// Implementation.
+
+inline slab_pool::slab_pool(size_t slab_size, size_t slabs_per_chunk,
+    const io_buffer_options& options, size_t max_idle_chunks)
+  : slab_size_(slab_size)
+  , slabs_per_chunk_(slabs_per_chunk > 0 ? slabs_per_chunk : 1)
+  , options_(options)
+  , max_idle_chunks_(max_idle_chunks)
+  , in_use_(0)
+  , idle_chunks_(0)
+{
+}
+
+
+inline slab_pool::~slab_pool() noexcept
+{
+    assert(in_use_ == 0);
+}
+
+
+inline char* slab_pool::acquire()
+{
+    if (free_.empty()) {
+        // Make sure that `release()` never needs to allocate.
+        free_.reserve((chunks_.size() + 1) * slabs_per_chunk_);
+        chunks_.reserve(chunks_.size() + 1);
+
+        auto memory = std::make_unique<io_buffer>(slab_size_ * slabs_per_chunk_, options_);
+        char* first = memory->write_head();
+        auto it = std::upper_bound(chunks_.begin(), chunks_.end(), first,
+            [](char* p, const chunk& c) { return p < c.first; });
+        chunks_.insert(it, chunk {std::move(memory), first, slabs_per_chunk_});
+        ++idle_chunks_;
+
+        // In reverse, so that slabs are handed out in address order.
+        for (size_t i = slabs_per_chunk_; i > 0; --i) {
+            free_.push_back(first + (i - 1) * slab_size_);
+        }
+    }
+
+    char* slab = free_.back();
+    free_.pop_back();
+    chunk& c = this->owner(slab);
+    if (c.free-- == slabs_per_chunk_) {
+        --idle_chunks_;
+    }
+    ++in_use_;
+    return slab;
+}
+
+
+inline void slab_pool::release(char* slab) noexcept
+{
+    assert(in_use_ > 0);
+    free_.push_back(slab);
+    --in_use_;
+
+    chunk& c = this->owner(slab);
+    if (++c.free == slabs_per_chunk_ && ++idle_chunks_ > max_idle_chunks_) {
+        this->free_chunk(c);
+    }
+}
+
+
+inline auto slab_pool::owner(char* slab) noexcept -> chunk&
+{
+    auto it = std::upper_bound(chunks_.begin(), chunks_.end(), slab,
+        [](char* p, const chunk& c) { return p < c.first; });
+    assert(it != chunks_.begin());
+    return *(it - 1);
+}
+
+
+inline void slab_pool::free_chunk(chunk& c) noexcept
+{
+    char* const first = c.first;
+    char* const last = first + slab_size_ * slabs_per_chunk_;
+    free_.erase(std::remove_if(free_.begin(), free_.end(), [&](char* slab) {
+        return slab >= first && slab < last;
+    }), free_.end());
+
+    chunks_.erase(chunks_.begin() + (&c - chunks_.data()));
+    --idle_chunks_;
+}
+
+
+inline size_t slab_pool::slab_size() const noexcept
+{
+    return slab_size_;
+}
+
+
+inline size_t slab_pool::available() const noexcept
+{
+    return free_.size();
+}
+
+
+inline size_t slab_pool::in_use() const noexcept
+{
+    return in_use_;
+}
+
+
+inline size_t slab_pool::chunks() const noexcept
+{
+    return chunks_.size();
+}
+
+
+inline slab_pool& thread_slab_pool() noexcept
+{
+    // Constructing a pool doesn't allocate yet.
+    static thread_local slab_pool pool;
+    return pool;
+}
+
+} // namespace bev
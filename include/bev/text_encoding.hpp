@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace bev {
+
+// # Text Encoding
+//
+// Lowercase hex and base64 (RFC 4648, with padding) encoders, usable as
+// `pipeline` stages or on their own.
+//
+// Hex encoding uses SSE2 on x86-64. Base64 encoding uses SSSE3 if the CPU
+// supports it (detected at runtime), and a scalar loop otherwise.
+//
+//
+// # Usage
+//
+//     char out[2 * n];
+//     bev::hex_encode(data, n, out);
+//
+// As stages, the hex encoder transforms as much input as fits into the
+// output. The base64 encoder only handles complete groups of 3 bytes and
+// leaves the rest in the input buffer until either more input arrives or the
+// stream is flushed, which adds the padding.
+//
+
+// Writes `2*n` characters to `out`, returns `2*n`.
+inline size_t hex_encode(const void* in, size_t n, char* out) noexcept;
+
+// Writes `base64_size(n)` characters to `out`, returns `base64_size(n)`.
+inline size_t base64_encode(const void* in, size_t n, char* out) noexcept;
+
+constexpr size_t base64_size(size_t n) noexcept;
+
+
+class hex_encoder {
+public:
+	int transform(const unsigned char*& in, const unsigned char* in_end,
+		unsigned char*& out, unsigned char* out_end, bool flush) noexcept;
+};
+
+
+class base64_encoder {
+public:
+	int transform(const unsigned char*& in, const unsigned char* in_end,
+		unsigned char*& out, unsigned char* out_end, bool flush) noexcept;
+};
+
+
+// Implementation.
+
+namespace detail {
+
+constexpr char HEX_DIGITS[] = "0123456789abcdef";
+constexpr char BASE64_ALPHABET[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+// Encodes complete groups of 3 bytes, returns the number of groups.
+inline size_t base64_encode_scalar(const unsigned char* in, size_t groups, char* out) noexcept
+{
+	for (size_t i = 0; i < groups; ++i, in += 3, out += 4) {
+		uint32_t const v = in[0] << 16 | in[1] << 8 | in[2];
+		out[0] = BASE64_ALPHABET[v >> 18];
+		out[1] = BASE64_ALPHABET[(v >> 12) & 63];
+		out[2] = BASE64_ALPHABET[(v >> 6) & 63];
+		out[3] = BASE64_ALPHABET[v & 63];
+	}
+	return groups;
+}
+
+
+#if defined(__x86_64__)
+// Encodes 4 groups per iteration, see Muła and Lemire, "Faster Base64
+// Encoding and Decoding Using AVX2 Instructions". Each load reads 16 bytes
+// of which 12 are used, so this stops early enough to never read beyond the
+// end of the input.
+__attribute__((target("ssse3")))
+inline size_t base64_encode_ssse3(const unsigned char* in, size_t groups, char* out) noexcept
+{
+	size_t done = 0;
+	for (; groups - done >= 6; done += 4, in += 12, out += 16) {
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+
+		// Bring the 3 bytes of each group into big-endian order within a
+		// 32-bit lane, then move the four 6-bit indices into separate bytes.
+		x = _mm_shuffle_epi8(x, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+		__m128i const t0 = _mm_and_si128(x, _mm_set1_epi32(0x0fc0fc00));
+		__m128i const t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+		__m128i const t2 = _mm_and_si128(x, _mm_set1_epi32(0x003f03f0));
+		__m128i const t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+		__m128i const indices = _mm_or_si128(t1, t3);
+
+		// Map the indices to ASCII by adding an offset that only depends on
+		// which of the five ranges of the alphabet they fall into.
+		__m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+		__m128i const less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+		range = _mm_or_si128(range, _mm_and_si128(less, _mm_set1_epi8(13)));
+		__m128i const offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'+' - 62, '/' - 63, 'A', 0, 0);
+		__m128i const result = _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), result);
+	}
+	return done + base64_encode_scalar(in, groups - done, out);
+}
+#endif
+
+
+inline size_t base64_encode_groups(const unsigned char* in, size_t groups, char* out) noexcept
+{
+#if defined(__x86_64__)
+	if (__builtin_cpu_supports("ssse3")) {
+		return base64_encode_ssse3(in, groups, out);
+	}
+#endif
+	return base64_encode_scalar(in, groups, out);
+}
+
+} // namespace detail
+
+
+inline size_t hex_encode(const void* data, size_t n, char* out) noexcept
+{
+	auto in = static_cast<const unsigned char*>(data);
+	size_t i = 0;
+#if defined(__x86_64__)
+	__m128i const mask = _mm_set1_epi8(0x0f);
+	__m128i const nine = _mm_set1_epi8(9);
+	__m128i const zero = _mm_set1_epi8('0');
+	__m128i const letters = _mm_set1_epi8('a' - '0' - 10);
+	for (; n - i >= 16; i += 16) {
+		__m128i const x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		__m128i const hi = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+		__m128i const lo = _mm_and_si128(x, mask);
+
+		// Nibbles to ASCII: '0' + v, plus the gap to 'a' for v > 9.
+		auto to_ascii = [&](__m128i v) {
+			__m128i const gap = _mm_and_si128(_mm_cmpgt_epi8(v, nine), letters);
+			return _mm_add_epi8(_mm_add_epi8(v, zero), gap);
+		};
+		__m128i const a = to_ascii(_mm_unpacklo_epi8(hi, lo));
+		__m128i const b = to_ascii(_mm_unpackhi_epi8(hi, lo));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2*i), a);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2*i + 16), b);
+	}
+#endif
+	for (; i < n; ++i) {
+		out[2*i] = detail::HEX_DIGITS[in[i] >> 4];
+		out[2*i + 1] = detail::HEX_DIGITS[in[i] & 15];
+	}
+	return 2*n;
+}
+
+
+constexpr size_t base64_size(size_t n) noexcept
+{
+	return (n + 2) / 3 * 4;
+}
+
+
+inline size_t base64_encode(const void* data, size_t n, char* out) noexcept
+{
+	auto in = static_cast<const unsigned char*>(data);
+	size_t const groups = n / 3;
+	detail::base64_encode_groups(in, groups, out);
+
+	in += 3*groups;
+	out += 4*groups;
+	size_t const rest = n - 3*groups;
+	if (rest > 0) {
+		uint32_t const v = in[0] << 16 | (rest == 2 ? in[1] << 8 : 0);
+		out[0] = detail::BASE64_ALPHABET[v >> 18];
+		out[1] = detail::BASE64_ALPHABET[(v >> 12) & 63];
+		out[2] = rest == 2 ? detail::BASE64_ALPHABET[(v >> 6) & 63] : '=';
+		out[3] = '=';
+	}
+	return base64_size(n);
+}
+
+
+inline int hex_encoder::transform(const unsigned char*& in, const unsigned char* in_end,
+	unsigned char*& out, unsigned char* out_end, bool) noexcept
+{
+	size_t const n = std::min<size_t>(in_end - in, (out_end - out) / 2);
+	out += hex_encode(in, n, reinterpret_cast<char*>(out));
+	in += n;
+	return 0;
+}
+
+
+inline int base64_encoder::transform(const unsigned char*& in, const unsigned char* in_end,
+	unsigned char*& out, unsigned char* out_end, bool flush) noexcept
+{
+	size_t const available = in_end - in;
+	size_t const space = (out_end - out) / 4;
+
+	size_t groups = std::min(available / 3, space);
+	size_t n = 3*groups;
+	if (flush && groups == available / 3 && groups < space) {
+		n = available; // Including the final, padded group.
+	}
+
+	out += base64_encode(in, n, reinterpret_cast<char*>(out));
+	in += n;
+	return 0;
+}
+
+} // namespace bev
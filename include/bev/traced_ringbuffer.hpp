@@ -0,0 +1,487 @@
+#pragma once
+
+#include <bev/linear_ringbuffer.hpp>
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// Set to 0 to compile out dwell-time tracing for all `traced_ringbuffer_`s
+// that do not explicitly enable it.
+#ifndef BEV_DWELL_TRACING
+#define BEV_DWELL_TRACING 1
+#endif
+
+namespace bev {
+
+// # Traced Ringbuffer
+//
+// A `linear_ringbuffer_` that measures how long bytes stay in the buffer
+// between `commit()` and `consume()`, the dwell time.
+//
+// Instead of per-byte bookkeeping, each `commit()` records the end offset of
+// the committed bytes together with a TSC timestamp in a small side ring.
+// When `consume()` moves the read head past such an offset, the time since
+// the commit is added to a log-linear histogram with about 6% precision.
+//
+// If the side ring is full because the reader is far behind, the stamp is
+// dropped and its bytes are attributed to the next stamp, i.e. the dwell time
+// of the oldest bytes is under-reported in this case.
+//
+//
+// # Usage
+//
+//     bev::traced_ringbuffer rb;
+//     [use like a `linear_ringbuffer`]
+//     printf("p50 %lu ns, p99 %lu ns, p99.9 %lu ns\n",
+//         rb.dwell_ns(0.5), rb.dwell_ns(0.99), rb.dwell_ns(0.999));
+//
+// `dwell()` returns the histogram itself, in TSC ticks. Converting ticks to
+// nanoseconds calibrates the TSC against `steady_clock` once, which takes a
+// few milliseconds on the first call.
+//
+// When tracing is disabled, either by the second template parameter or for
+// all buffers by compiling with `-DBEV_DWELL_TRACING=0`, the buffer has the
+// same size and cost as a plain `linear_ringbuffer_` and `dwell_ns()` always
+// returns 0.
+//
+//
+// # Errors and Exceptions
+//
+// Initialization behaves exactly like for `linear_ringbuffer_`.
+//
+//
+// # Concurrency
+//
+// Same as `linear_ringbuffer_`. The histogram is updated by the reader, so it
+// should be queried by the reading thread.
+//
+
+class dwell_histogram {
+public:
+	dwell_histogram() noexcept;
+
+	void record(uint64_t value) noexcept;
+	void reset() noexcept;
+
+	uint64_t count() const noexcept;
+	uint64_t max() const noexcept;
+
+	// Upper bound of the bucket holding the `q`-th quantile, 0 if empty.
+	uint64_t percentile(double q) const noexcept;
+
+private:
+	// 16 linear sub-buckets per power of two.
+	static constexpr int SUB_BITS = 4;
+	static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+	static constexpr int BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+	static int bucket(uint64_t value) noexcept;
+	static uint64_t upper_bound(int bucket) noexcept;
+
+	uint64_t buckets_[BUCKETS];
+	uint64_t count_;
+	uint64_t max_;
+};
+
+
+namespace detail {
+
+template<bool Enabled>
+class dwell_state;
+
+} // namespace detail
+
+
+template<typename SizeT = size_t, bool Enabled = BEV_DWELL_TRACING>
+class traced_ringbuffer_ : public detail::dwell_state<Enabled> {
+public:
+	typedef typename linear_ringbuffer_<SizeT>::value_type value_type;
+	typedef typename linear_ringbuffer_<SizeT>::iterator iterator;
+	typedef typename linear_ringbuffer_<SizeT>::const_iterator const_iterator;
+	typedef typename linear_ringbuffer_<SizeT>::delayed_init delayed_init;
+
+	traced_ringbuffer_(SizeT minsize = 640*1024);
+	traced_ringbuffer_(const delayed_init) noexcept;
+	int initialize(SizeT minsize) noexcept;
+
+	void commit(SizeT n) noexcept;
+	void consume(SizeT n) noexcept;
+	iterator read_head() noexcept;
+	iterator write_head() noexcept;
+	void clear() noexcept;
+
+	bool empty() const noexcept;
+	SizeT size() const noexcept;
+	SizeT capacity() const noexcept;
+	SizeT free_size() const noexcept;
+	const_iterator begin() const noexcept;
+	const_iterator end() const noexcept;
+
+	// The underlying buffer. Bytes committed or consumed through it are not
+	// traced.
+	linear_ringbuffer_<SizeT>& buffer() noexcept;
+
+private:
+	linear_ringbuffer_<SizeT> rb_;
+};
+
+
+using traced_ringbuffer = traced_ringbuffer_<size_t>;
+
+
+// Implementation.
+
+namespace detail {
+
+inline uint64_t timestamp() noexcept
+{
+#if defined(__x86_64__)
+	return __rdtsc();
+#else
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+
+inline double nanoseconds_per_tick() noexcept
+{
+#if defined(__x86_64__)
+	static double const ratio = [] {
+		using clock = std::chrono::steady_clock;
+		auto const t0 = clock::now();
+		uint64_t const c0 = __rdtsc();
+		while (clock::now() - t0 < std::chrono::milliseconds(5)) {
+		}
+		auto const t1 = clock::now();
+		uint64_t const c1 = __rdtsc();
+		return std::chrono::duration<double, std::nano>(t1 - t0).count() / (c1 - c0);
+	}();
+	return ratio;
+#else
+	return 1.0;
+#endif
+}
+
+
+template<>
+class dwell_state<false> {
+public:
+	uint64_t dwell_ns(double) const noexcept { return 0; }
+
+protected:
+	void on_commit(uint64_t) noexcept {}
+	void on_consume(uint64_t) noexcept {}
+	void on_clear() noexcept {}
+};
+
+
+template<>
+class dwell_state<true> {
+public:
+	dwell_state() noexcept;
+
+	const dwell_histogram& dwell() const noexcept;
+	uint64_t dwell_ns(double q) const noexcept;
+
+	// Commit stamps that were dropped because the side ring was full.
+	uint64_t dropped() const noexcept;
+
+protected:
+	void on_commit(uint64_t n) noexcept;
+	void on_consume(uint64_t n) noexcept;
+	void on_clear() noexcept;
+
+private:
+	static constexpr uint64_t STAMPS = 1024;
+
+	struct stamp {
+		uint64_t end;
+		uint64_t time;
+	};
+
+	// Written by the producer.
+	uint64_t committed_;
+	uint64_t stamp_tail_;
+	uint64_t dropped_;
+
+	// Written by the consumer.
+	uint64_t consumed_;
+	uint64_t stamp_head_;
+	dwell_histogram histogram_;
+
+	stamp stamps_[STAMPS];
+};
+
+
+inline dwell_state<true>::dwell_state() noexcept
+  : committed_(0)
+  , stamp_tail_(0)
+  , dropped_(0)
+  , consumed_(0)
+  , stamp_head_(0)
+{}
+
+
+inline const dwell_histogram& dwell_state<true>::dwell() const noexcept
+{
+	return histogram_;
+}
+
+
+inline uint64_t dwell_state<true>::dwell_ns(double q) const noexcept
+{
+	return histogram_.percentile(q) * nanoseconds_per_tick();
+}
+
+
+inline uint64_t dwell_state<true>::dropped() const noexcept
+{
+	return dropped_;
+}
+
+
+inline void dwell_state<true>::on_commit(uint64_t n) noexcept
+{
+	committed_ += n;
+
+	uint64_t const head = __atomic_load_n(&stamp_head_, __ATOMIC_ACQUIRE);
+	if (stamp_tail_ - head == STAMPS) {
+		++dropped_;
+		return;
+	}
+
+	stamps_[stamp_tail_ % STAMPS] = stamp {committed_, timestamp()};
+
+	// Must be visible before the committed bytes, otherwise the reader
+	// could consume them without seeing their stamp.
+	__atomic_store_n(&stamp_tail_, stamp_tail_ + 1, __ATOMIC_RELEASE);
+}
+
+
+inline void dwell_state<true>::on_consume(uint64_t n) noexcept
+{
+	consumed_ += n;
+
+	uint64_t const tail = __atomic_load_n(&stamp_tail_, __ATOMIC_ACQUIRE);
+	uint64_t head = stamp_head_;
+	if (head == tail || stamps_[head % STAMPS].end > consumed_) {
+		return;
+	}
+
+	uint64_t const now = timestamp();
+	do {
+		uint64_t const time = stamps_[head % STAMPS].time;
+		histogram_.record(now > time ? now - time : 0);
+		++head;
+	} while (head != tail && stamps_[head % STAMPS].end <= consumed_);
+
+	__atomic_store_n(&stamp_head_, head, __ATOMIC_RELEASE);
+}
+
+
+inline void dwell_state<true>::on_clear() noexcept
+{
+	consumed_ = committed_;
+	stamp_head_ = stamp_tail_;
+}
+
+} // namespace detail
+
+
+inline dwell_histogram::dwell_histogram() noexcept
+{
+	this->reset();
+}
+
+
+inline int dwell_histogram::bucket(uint64_t value) noexcept
+{
+	if (value < SUB_BUCKETS) {
+		return value;
+	}
+	int const exponent = 63 - __builtin_clzll(value);
+	int const sub = (value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1);
+	return (exponent - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+
+inline uint64_t dwell_histogram::upper_bound(int bucket) noexcept
+{
+	if (bucket < SUB_BUCKETS) {
+		return bucket;
+	}
+	int const exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+	uint64_t const sub = bucket % SUB_BUCKETS;
+	uint64_t const width = uint64_t(1) << (exponent - SUB_BITS);
+	return (SUB_BUCKETS + sub + 1) * width - 1;
+}
+
+
+inline void dwell_histogram::record(uint64_t value) noexcept
+{
+	++buckets_[bucket(value)];
+	++count_;
+	if (value > max_) {
+		max_ = value;
+	}
+}
+
+
+inline void dwell_histogram::reset() noexcept
+{
+	for (uint64_t& b : buckets_) {
+		b = 0;
+	}
+	count_ = 0;
+	max_ = 0;
+}
+
+
+inline uint64_t dwell_histogram::count() const noexcept
+{
+	return count_;
+}
+
+
+inline uint64_t dwell_histogram::max() const noexcept
+{
+	return max_;
+}
+
+
+inline uint64_t dwell_histogram::percentile(double q) const noexcept
+{
+	if (count_ == 0) {
+		return 0;
+	}
+
+	// The rank of the quantile, at least the first value.
+	uint64_t rank = q * count_;
+	if (rank < q * count_ || rank == 0) {
+		++rank;
+	}
+
+	uint64_t seen = 0;
+	for (int i = 0; i < BUCKETS; ++i) {
+		seen += buckets_[i];
+		if (seen >= rank) {
+			// The bucket can't be wider than what was actually seen.
+			uint64_t const bound = upper_bound(i);
+			return bound < max_ ? bound : max_;
+		}
+	}
+	return max_;
+}
+
+
+template<typename SizeT, bool Enabled>
+traced_ringbuffer_<SizeT, Enabled>::traced_ringbuffer_(SizeT minsize)
+  : rb_(minsize)
+{}
+
+
+template<typename SizeT, bool Enabled>
+traced_ringbuffer_<SizeT, Enabled>::traced_ringbuffer_(const delayed_init) noexcept
+  : rb_(delayed_init {})
+{}
+
+
+template<typename SizeT, bool Enabled>
+int traced_ringbuffer_<SizeT, Enabled>::initialize(SizeT minsize) noexcept
+{
+	return rb_.initialize(minsize);
+}
+
+
+template<typename SizeT, bool Enabled>
+void traced_ringbuffer_<SizeT, Enabled>::commit(SizeT n) noexcept
+{
+	this->on_commit(n);
+	rb_.commit(n);
+}
+
+
+template<typename SizeT, bool Enabled>
+void traced_ringbuffer_<SizeT, Enabled>::consume(SizeT n) noexcept
+{
+	rb_.consume(n);
+	this->on_consume(n);
+}
+
+
+template<typename SizeT, bool Enabled>
+auto traced_ringbuffer_<SizeT, Enabled>::read_head() noexcept -> iterator
+{
+	return rb_.read_head();
+}
+
+
+template<typename SizeT, bool Enabled>
+auto traced_ringbuffer_<SizeT, Enabled>::write_head() noexcept -> iterator
+{
+	return rb_.write_head();
+}
+
+
+template<typename SizeT, bool Enabled>
+void traced_ringbuffer_<SizeT, Enabled>::clear() noexcept
+{
+	rb_.clear();
+	this->on_clear();
+}
+
+
+template<typename SizeT, bool Enabled>
+bool traced_ringbuffer_<SizeT, Enabled>::empty() const noexcept
+{
+	return rb_.empty();
+}
+
+
+template<typename SizeT, bool Enabled>
+SizeT traced_ringbuffer_<SizeT, Enabled>::size() const noexcept
+{
+	return rb_.size();
+}
+
+
+template<typename SizeT, bool Enabled>
+SizeT traced_ringbuffer_<SizeT, Enabled>::capacity() const noexcept
+{
+	return rb_.capacity();
+}
+
+
+template<typename SizeT, bool Enabled>
+SizeT traced_ringbuffer_<SizeT, Enabled>::free_size() const noexcept
+{
+	return rb_.free_size();
+}
+
+
+template<typename SizeT, bool Enabled>
+auto traced_ringbuffer_<SizeT, Enabled>::begin() const noexcept -> const_iterator
+{
+	return rb_.begin();
+}
+
+
+template<typename SizeT, bool Enabled>
+auto traced_ringbuffer_<SizeT, Enabled>::end() const noexcept -> const_iterator
+{
+	return rb_.end();
+}
+
+
+template<typename SizeT, bool Enabled>
+auto traced_ringbuffer_<SizeT, Enabled>::buffer() noexcept -> linear_ringbuffer_<SizeT>&
+{
+	return rb_;
+}
+
+} // namespace bev
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <bev/linear_ringbuffer.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <numeric>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#if __has_include(<span>)
+#include <span>
+#endif
+
+namespace bev {
+
+// # Typed Ringbuffer
+//
+// A `linear_ringbuffer_` holding elements of a fixed-size, trivially copyable
+// type `T` instead of raw bytes, e.g. ticks, samples or events.
+//
+// The capacity in bytes is rounded up to a multiple of both `sizeof(T)` and
+// the page size, so the read and write heads always point to the start of an
+// element and no element is ever split at the edge of the buffer. All sizes
+// and offsets of the interface are counted in elements.
+//
+//
+// # Usage
+//
+// Single elements:
+//
+//     bev::typed_ringbuffer<tick> rb(1024);
+//     rb.push(t);
+//     rb.emplace(price, qty);
+//
+// Bulk access without any per-element work:
+//
+//     size_t n = rb.pop_n(ticks, 64);  // One `memcpy()` for up to 64 elements.
+//     process(rb.read_head(), rb.size());
+//     rb.consume(rb.size());
+//
+// A consumer on another thread can process everything that is available
+// with one acquire load and one release store:
+//
+//     auto batch = rb.claim_batch(512);
+//     for (SizeT i = 0; i < batch.size; ++i) {
+//         process(batch.data[i]);
+//     }
+//     rb.release_batch(batch.size);
+//
+// In C++20, `readable()` and `writable()` return the respective areas as
+// `std::span<T>`.
+//
+//
+// # Errors and Exceptions
+//
+// Initialization behaves exactly like for `linear_ringbuffer_`. `push()` and
+// `emplace()` return false if the buffer is full. `emplace()` only throws if
+// the constructor of `T` does.
+//
+//
+// # Concurrency
+//
+// Same as `linear_ringbuffer_`.
+//
+
+template<typename T, typename SizeT = size_t>
+class typed_ringbuffer {
+public:
+	static_assert(std::is_trivially_copyable<T>::value,
+		"Elements must be trivially copyable.");
+
+	typedef T value_type;
+	typedef T* iterator;
+	typedef const T* const_iterator;
+	typedef typename linear_ringbuffer_<SizeT>::delayed_init delayed_init;
+
+	typed_ringbuffer(SizeT min_elements = 640*1024 / sizeof(T));
+	typed_ringbuffer(const delayed_init) noexcept;
+	int initialize(SizeT min_elements) noexcept;
+
+	bool push(const T& value) noexcept;
+	template<typename... Args>
+	bool emplace(Args&&... args);
+
+	// Copy up to `n` elements to `out` and consume them. Returns the number
+	// of elements copied.
+	SizeT pop_n(T* out, SizeT n) noexcept;
+
+	void commit(SizeT n) noexcept;
+	void consume(SizeT n) noexcept;
+
+	// Claim up to `max` elements with a single acquire load and release
+	// them with a single store, see `linear_ringbuffer_::claim_batch()`.
+	struct batch {
+		iterator data;
+		SizeT size;
+	};
+	batch claim_batch(SizeT max) noexcept;
+	void release_batch(SizeT n) noexcept;
+
+	iterator read_head() noexcept;
+	iterator write_head() noexcept;
+	void clear() noexcept;
+
+	bool empty() const noexcept;
+	SizeT size() const noexcept;
+	SizeT capacity() const noexcept;
+	SizeT free_size() const noexcept;
+	const_iterator begin() const noexcept;
+	const_iterator end() const noexcept;
+
+#ifdef __cpp_lib_span
+	std::span<T> readable() noexcept;
+	std::span<T> writable() noexcept;
+#endif
+
+	// The underlying byte buffer.
+	linear_ringbuffer_<SizeT>& buffer() noexcept;
+
+private:
+	linear_ringbuffer_<SizeT> rb_;
+};
+
+
+// Implementation.
+
+template<typename T, typename SizeT>
+typed_ringbuffer<T, SizeT>::typed_ringbuffer(SizeT min_elements)
+  : rb_(delayed_init {})
+{
+	int res = this->initialize(min_elements);
+	if (res == -1) {
+		throw std::system_error {errno, std::system_category(), __PRETTY_FUNCTION__};
+	}
+}
+
+
+template<typename T, typename SizeT>
+typed_ringbuffer<T, SizeT>::typed_ringbuffer(const delayed_init) noexcept
+  : rb_(delayed_init {})
+{}
+
+
+template<typename T, typename SizeT>
+int typed_ringbuffer<T, SizeT>::initialize(SizeT min_elements) noexcept
+{
+	size_t const granularity = std::lcm(sizeof(T), linear_ringbuffer_<SizeT>::page_size());
+
+	// Check for overflow of the size in bytes.
+	size_t const bytes = min_elements * sizeof(T);
+	if (bytes / sizeof(T) != min_elements || bytes + granularity < bytes) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Since `granularity` is a multiple of the page size, the ringbuffer
+	// does not need to round up any further.
+	return rb_.initialize((bytes + granularity - 1) / granularity * granularity);
+}
+
+
+template<typename T, typename SizeT>
+bool typed_ringbuffer<T, SizeT>::push(const T& value) noexcept
+{
+	if (rb_.free_size() < sizeof(T)) {
+		return false;
+	}
+
+	::memcpy(rb_.write_head(), &value, sizeof(T));
+	rb_.commit(sizeof(T));
+	return true;
+}
+
+
+template<typename T, typename SizeT>
+template<typename... Args>
+bool typed_ringbuffer<T, SizeT>::emplace(Args&&... args)
+{
+	if (rb_.free_size() < sizeof(T)) {
+		return false;
+	}
+
+	new (rb_.write_head()) T {std::forward<Args>(args)...};
+	rb_.commit(sizeof(T));
+	return true;
+}
+
+
+template<typename T, typename SizeT>
+SizeT typed_ringbuffer<T, SizeT>::pop_n(T* out, SizeT n) noexcept
+{
+	SizeT const count = std::min(n, this->size());
+	::memcpy(out, rb_.read_head(), count * sizeof(T));
+	rb_.consume(count * sizeof(T));
+	return count;
+}
+
+
+template<typename T, typename SizeT>
+void typed_ringbuffer<T, SizeT>::commit(SizeT n) noexcept
+{
+	rb_.commit(n * sizeof(T));
+}
+
+
+template<typename T, typename SizeT>
+void typed_ringbuffer<T, SizeT>::consume(SizeT n) noexcept
+{
+	rb_.consume(n * sizeof(T));
+}
+
+
+template<typename T, typename SizeT>
+auto typed_ringbuffer<T, SizeT>::claim_batch(SizeT max) noexcept -> batch
+{
+	// Saturate instead of overflowing for large `max`, e.g. `SizeT(-1)`.
+	SizeT const max_bytes = max > SizeT(-1) / sizeof(T) ? SizeT(-1) : max * sizeof(T);
+	auto b = rb_.claim_batch(max_bytes);
+	return batch {reinterpret_cast<T*>(b.data), b.size / SizeT(sizeof(T))};
+}
+
+
+template<typename T, typename SizeT>
+void typed_ringbuffer<T, SizeT>::release_batch(SizeT n) noexcept
+{
+	rb_.release_batch(n * sizeof(T));
+}
+
+
+template<typename T, typename SizeT>
+auto typed_ringbuffer<T, SizeT>::read_head() noexcept -> iterator
+{
+	return reinterpret_cast<T*>(rb_.read_head());
+}
+
+
+template<typename T, typename SizeT>
+auto typed_ringbuffer<T, SizeT>::write_head() noexcept -> iterator
+{
+	return reinterpret_cast<T*>(rb_.write_head());
+}
+
+
+template<typename T, typename SizeT>
+void typed_ringbuffer<T, SizeT>::clear() noexcept
+{
+	rb_.clear();
+}
+
+
+template<typename T, typename SizeT>
+bool typed_ringbuffer<T, SizeT>::empty() const noexcept
+{
+	return rb_.empty();
+}
+
+
+template<typename T, typename SizeT>
+SizeT typed_ringbuffer<T, SizeT>::size() const noexcept
+{
+	return rb_.size() / sizeof(T);
+}
+
+
+template<typename T, typename SizeT>
+SizeT typed_ringbuffer<T, SizeT>::capacity() const noexcept
+{
+	return rb_.capacity() / sizeof(T);
+}
+
+
+template<typename T, typename SizeT>
+SizeT typed_ringbuffer<T, SizeT>::free_size() const noexcept
+{
+	return rb_.free_size() / sizeof(T);
+}
+
+
+template<typename T, typename SizeT>
+auto typed_ringbuffer<T, SizeT>::begin() const noexcept -> const_iterator
+{
+	return reinterpret_cast<const T*>(rb_.begin());
+}
+
+
+template<typename T, typename SizeT>
+auto typed_ringbuffer<T, SizeT>::end() const noexcept -> const_iterator
+{
+	return reinterpret_cast<const T*>(rb_.end());
+}
+
+
+#ifdef __cpp_lib_span
+template<typename T, typename SizeT>
+std::span<T> typed_ringbuffer<T, SizeT>::readable() noexcept
+{
+	return std::span<T>(this->read_head(), this->size());
+}
+
+
+template<typename T, typename SizeT>
+std::span<T> typed_ringbuffer<T, SizeT>::writable() noexcept
+{
+	return std::span<T>(this->write_head(), this->free_size());
+}
+#endif
+
+
+template<typename T, typename SizeT>
+auto typed_ringbuffer<T, SizeT>::buffer() noexcept -> linear_ringbuffer_<SizeT>&
+{
+	return rb_;
+}
+
+} // namespace bev
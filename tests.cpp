@@ -1,8 +1,51 @@
 #include <bev/linear_ringbuffer.hpp>
 #include <bev/io_buffer.hpp>
+#include <bev/group_commit_writer.hpp>
+#include <bev/direct_writer.hpp>
+#include <bev/pipe_fanout.hpp>
+#include <bev/adaptive_reader.hpp>
+#include <bev/record_ring.hpp>
+#include <bev/typed_ringbuffer.hpp>
+#include <bev/line_scanner.hpp>
+#include <bev/http_tokenizer.hpp>
+#include <bev/resp_tokenizer.hpp>
+#include <bev/checksummed_ringbuffer.hpp>
+#include <bev/pipeline.hpp>
+#include <bev/lz_codec.hpp>
+#include <bev/chacha20.hpp>
+#include <bev/text_encoding.hpp>
+#include <bev/traced_ringbuffer.hpp>
+#include <bev/flight_ring.hpp>
+#include <bev/binary_logger.hpp>
+#include <bev/multi_buffer.hpp>
+#include <bev/pooled_io_buffer.hpp>
+#include <bev/growable_io_buffer.hpp>
+#include <bev/byte_stream_buffer.hpp>
+#include <bev/hybrid_buffer.hpp>
+#include <bev/bulk_copy.hpp>
+#if __has_include(<asio.hpp>)
+#include <asio.hpp>
+#define BEV_TEST_ASIO 1
+#elif __has_include(<boost/asio.hpp>)
+#define BEV_USE_BOOST_ASIO 1
+#include <boost/asio.hpp>
+#define BEV_TEST_ASIO 1
+#endif
+#if defined(BEV_TEST_ASIO)
+#include <bev/asio_dynamic_buffer.hpp>
+#endif
 
+#include <atomic>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 #include <assert.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
 
 void print_mappings()
 {
@@ -77,6 +120,365 @@ void test_linear_ringbuffer() {
 	for (char c : rb) {
 		std::cout << c;
 	}
+
+	// Test 4: Initialize rings while other threads keep creating and
+	// destroying mappings, which could grab the address range of the
+	// second copy if it was not reserved up front.
+	std::cout << "Test 4..." << std::flush;
+	std::atomic<bool> stop{false};
+	std::vector<std::thread> mappers;
+	for (int t = 0; t < 4; ++t) {
+		mappers.emplace_back([&stop, n] {
+			while (!stop.load(std::memory_order_relaxed)) {
+				void* p = ::mmap(NULL, n, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				assert(p != MAP_FAILED);
+				::munmap(p, n);
+			}
+		});
+	}
+	for (int i = 0; i < 2000; ++i) {
+		bev::linear_ringbuffer ring;
+		assert(ring.initialize(n) == 0);
+		ring.write_head()[n - 1] = 'z';
+		assert(ring.write_head()[2*n - 1] == 'z');
+		ring.commit(n);
+		ring.consume(n - 1);
+		assert(*ring.read_head() == 'z');
+	}
+	stop = true;
+	for (std::thread& t : mappers) {
+		t.join();
+	}
+	std::cout << "success\n";
+	free(sbuf);
+	free(tbuf);
+}
+
+void test_file_backed_ringbuffer()
+{
+	char path[] = "/tmp/bev_tests_XXXXXX";
+	int fd = ::mkstemp(path);
+	assert(fd >= 0);
+
+	// Test 1: Check that committed data survives reopening the file.
+	std::cout << "Test 1..." << std::flush;
+	{
+		bev::linear_ringbuffer rb(fd, 4096);
+		assert(rb.capacity() == 4096);
+		assert(rb.empty());
+		::memcpy(rb.write_head(), "hello", 5);
+		rb.commit(5);
+		assert(rb.sync() == 0);
+	}
+	{
+		bev::linear_ringbuffer rb(fd, 4096);
+		assert(rb.size() == 5);
+		assert(::memcmp(rb.read_head(), "hello", 5) == 0);
+	}
+	std::cout << "success\n";
+
+	// Test 2: Check that data written over the edge is restored.
+	std::cout << "Test 2..." << std::flush;
+	{
+		bev::linear_ringbuffer rb(fd, 4096);
+		rb.consume(5);
+		rb.commit(4000);
+		rb.consume(4000);
+		std::fill_n(rb.write_head(), 1000, 'z');
+		rb.commit(1000);
+		assert(rb.sync() == 0);
+	}
+	{
+		bev::linear_ringbuffer rb(fd, 4096);
+		assert(rb.size() == 1000);
+		for (char c : rb) {
+			assert(c == 'z');
+		}
+	}
+	std::cout << "success\n";
+
+	// Test 3: Check that a mismatching capacity is rejected.
+	std::cout << "Test 3..." << std::flush;
+	{
+		bev::linear_ringbuffer rb(bev::linear_ringbuffer::delayed_init {});
+		assert(rb.initialize(fd, 8192) == -1 && errno == EINVAL);
+	}
+	std::cout << "success\n";
+
+	// Test 4: Check that after a partial sync and a crash, only the synced
+	// prefix is recovered.
+	std::cout << "Test 4..." << std::flush;
+	pid_t pid = ::fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		bev::linear_ringbuffer rb(fd, 4096);
+		rb.consume(rb.size());
+		std::fill_n(rb.write_head(), 100, 'a');
+		rb.commit(100);
+		std::fill_n(rb.write_head(), 200, 'b');
+		rb.commit(200);
+		bool const ok = rb.sync(rb.cbegin() + 1, rb.cend()) == -1 && errno == EINVAL
+			&& rb.sync(rb.cbegin(), rb.cbegin() + 100) == 0;
+		// Exit without running the destructor, like a crash would.
+		::_exit(ok ? 0 : 1);
+	}
+	int status;
+	assert(::waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	{
+		bev::linear_ringbuffer rb(fd, 4096);
+		assert(rb.size() == 100);
+		for (char c : rb) {
+			assert(c == 'a');
+		}
+	}
+	std::cout << "success\n";
+
+	// Test 5: Check that destroying the buffer without a sync does not
+	// record unflushed bytes as readable, but keeps the read position
+	// as long as it is behind the synced write position.
+	std::cout << "Test 5..." << std::flush;
+	pid = ::fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		{
+			bev::linear_ringbuffer rb(fd, 4096);
+			rb.consume(40);
+			std::fill_n(rb.write_head(), 50, 'c');
+			rb.commit(50);
+		}
+		::_exit(0);
+	}
+	assert(::waitpid(pid, &status, 0) == pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	{
+		bev::linear_ringbuffer rb(fd, 4096);
+		assert(rb.size() == 60);
+		for (char c : rb) {
+			assert(c == 'a');
+		}
+		std::fill_n(rb.write_head(), 50, 'd');
+		rb.commit(50);
+		rb.consume(rb.size());
+	}
+	{
+		bev::linear_ringbuffer rb(fd, 4096);
+		assert(rb.empty());
+	}
+	std::cout << "success\n";
+
+	::close(fd);
+	::unlink(path);
+}
+
+void test_group_commit_writer()
+{
+	char path[] = "/tmp/bev_tests_XXXXXX";
+	int fd = ::mkstemp(path);
+	assert(fd >= 0);
+
+	bev::linear_ringbuffer rb(4096);
+	bev::group_commit_writer w(fd, 0, {std::chrono::hours(1), 4096});
+
+	// Test 1: Check that small writes are not flushed immediately.
+	std::cout << "Test 1..." << std::flush;
+	std::fill_n(rb.write_head(), 100, 'a');
+	rb.commit(100);
+	assert(w.drain(rb) == 100);
+	assert(rb.empty());
+	assert(w.written() == 100);
+	assert(w.durable() == 0);
+	std::cout << "success\n";
+
+	// Test 2: Check that exceeding the size budget triggers a flush.
+	std::cout << "Test 2..." << std::flush;
+	std::fill_n(rb.write_head(), 4000, 'b');
+	rb.commit(4000);
+	assert(w.drain(rb) == 4000);
+	assert(w.durable() == 4100);
+	std::cout << "success\n";
+
+	// Test 3: Check that waiters are woken up by a flush.
+	std::cout << "Test 3..." << std::flush;
+	std::thread waiter([&] { w.wait_durable(4200); });
+	std::fill_n(rb.write_head(), 100, 'c');
+	rb.commit(100);
+	assert(w.drain(rb) == 100);
+	assert(w.flush() == 0);
+	waiter.join();
+	assert(w.durable() == 4200);
+	assert(!w.wait_durable(4201, std::chrono::milliseconds(1)));
+
+	char buf[4200];
+	assert(::pread(fd, buf, sizeof buf, 0) == sizeof buf);
+	assert(buf[0] == 'a' && buf[100] == 'b' && buf[4100] == 'c');
+	std::cout << "success\n";
+
+	// Test 4: Check that a write failing after a partial write is resumed
+	// where it stopped.
+	std::cout << "Test 4..." << std::flush;
+	struct rlimit old_limit, limit;
+	::getrlimit(RLIMIT_FSIZE, &old_limit);
+	limit = old_limit;
+	limit.rlim_cur = 4300;
+	::setrlimit(RLIMIT_FSIZE, &limit);
+	auto old_handler = ::signal(SIGXFSZ, SIG_IGN);
+	for (int i = 0; i < 500; ++i) {
+		rb.write_head()[i] = 'd' + i % 10;
+	}
+	rb.commit(500);
+	assert(w.drain(rb) == -1 && errno == EFBIG);
+	assert(w.written() == 4300 && rb.size() == 400);
+	::setrlimit(RLIMIT_FSIZE, &old_limit);
+	::signal(SIGXFSZ, old_handler);
+	assert(w.drain(rb) == 400 && w.written() == 4700);
+
+	char tail[500];
+	assert(::pread(fd, tail, sizeof tail, 4200) == sizeof tail);
+	for (int i = 0; i < 500; ++i) {
+		assert(tail[i] == 'd' + i % 10);
+	}
+	std::cout << "success\n";
+
+	::close(fd);
+	::unlink(path);
+}
+
+void test_direct_writer()
+{
+	char path[] = "/tmp/bev_tests_XXXXXX";
+	int fd = ::mkstemp(path);
+	assert(fd >= 0);
+
+	// Use direct I/O if the file system supports it.
+	int flags = ::fcntl(fd, F_GETFL);
+	::fcntl(fd, F_SETFL, flags | O_DIRECT);
+
+	bev::linear_ringbuffer rb(64*1024);
+	bev::direct_writer w(fd, 0, 4, 8192);
+
+	// Test 1: Check that only the aligned prefix is written.
+	std::cout << "Test 1..." << std::flush;
+	for (int i = 0; i < 50000; ++i) {
+		rb.write_head()[i] = i % 251;
+	}
+	rb.commit(50000);
+	assert(bev::aligned_size(rb, 4096) == 49152);
+	assert(w.submit(rb) == 0);
+	assert(w.in_flight() == 4);
+	assert(w.reap(rb, 4) == 32768);
+	assert(w.submit(rb) == 0);
+	assert(w.reap(rb, w.in_flight()) == 16384);
+	assert(rb.size() == 50000 - 49152);
+	assert(w.offset() == 49152);
+	std::cout << "success\n";
+
+	// Test 2: Check that finishing writes the unaligned tail.
+	std::cout << "Test 2..." << std::flush;
+	assert(w.finish(rb) == 0);
+	assert(rb.empty());
+
+	struct stat st;
+	::fstat(fd, &st);
+	assert(st.st_size == 50000);
+
+	static char buf[50000];
+	int rfd = ::open(path, O_RDONLY);
+	assert(::read(rfd, buf, sizeof buf) == sizeof buf);
+	for (int i = 0; i < 50000; ++i) {
+		assert(static_cast<unsigned char>(buf[i]) == i % 251);
+	}
+	::close(rfd);
+	std::cout << "success\n";
+
+	::close(fd);
+	::unlink(path);
+
+	// Test 3: Failed and short writes are retried without leaving holes.
+	std::cout << "Test 3..." << std::flush;
+	::strcpy(path, "/tmp/bev_tests_XXXXXX");
+	fd = ::mkstemp(path);
+	assert(fd >= 0);
+	bev::direct_writer retrying(fd, 0, 4, 4096);
+
+	// Writes beyond 6000 bytes fail, the one across the limit is short.
+	struct rlimit old_limit, limit;
+	::getrlimit(RLIMIT_FSIZE, &old_limit);
+	limit = old_limit;
+	limit.rlim_cur = 6000;
+	::setrlimit(RLIMIT_FSIZE, &limit);
+	auto old_handler = ::signal(SIGXFSZ, SIG_IGN);
+
+	rb.clear();
+	for (int i = 0; i < 16384; ++i) {
+		rb.write_head()[i] = i % 253;
+	}
+	rb.commit(16384);
+	assert(retrying.submit(rb) == 0 && retrying.in_flight() == 4);
+	assert(retrying.reap(rb, 4) == -1 && (errno == EIO || errno == EFBIG));
+	assert(retrying.in_flight() == 0);
+	assert(retrying.reap(rb, 0) == 4096 && retrying.offset() == 4096);
+	assert(rb.size() == 12288);
+
+	::setrlimit(RLIMIT_FSIZE, &old_limit);
+	::signal(SIGXFSZ, old_handler);
+	assert(retrying.submit(rb) == 0 && retrying.in_flight() == 3);
+	assert(retrying.reap(rb, 3) == 12288 && rb.empty());
+
+	rfd = ::open(path, O_RDONLY);
+	assert(::read(rfd, buf, 16384) == 16384);
+	for (int i = 0; i < 16384; ++i) {
+		assert(static_cast<unsigned char>(buf[i]) == i % 253);
+	}
+	::close(rfd);
+	::close(fd);
+	::unlink(path);
+	std::cout << "success\n";
+}
+
+void test_pipe_fanout()
+{
+	int a[2], b[2];
+	assert(::pipe2(a, O_NONBLOCK) == 0);
+	assert(::pipe2(b, O_NONBLOCK) == 0);
+
+	bev::linear_ringbuffer rb(4096);
+	int outputs[] = {a[1], b[1]};
+	bev::pipe_fanout fanout(outputs, 2, 4096);
+
+	// Test 1: Check that all outputs receive the data.
+	std::cout << "Test 1..." << std::flush;
+	::memcpy(rb.write_head(), "hello", 5);
+	rb.commit(5);
+	assert(fanout.pump(rb) == 5);
+	assert(rb.empty() && fanout.idle());
+
+	char buf[8];
+	assert(::read(a[0], buf, sizeof buf) == 5 && ::memcmp(buf, "hello", 5) == 0);
+	assert(::read(b[0], buf, sizeof buf) == 5 && ::memcmp(buf, "hello", 5) == 0);
+	std::cout << "success\n";
+
+	// Test 2: Check that data is only consumed once every output accepted it.
+	std::cout << "Test 2..." << std::flush;
+	char junk[4096] = {};
+	while (::write(b[1], junk, sizeof junk) > 0) {}
+
+	::memcpy(rb.write_head(), "world", 5);
+	rb.commit(5);
+	assert(fanout.pump(rb) == 0);
+	assert(rb.size() == 5 && !fanout.idle());
+	assert(::read(a[0], buf, sizeof buf) == 5 && ::memcmp(buf, "world", 5) == 0);
+
+	while (::read(b[0], junk, sizeof junk) > 0) {}
+	assert(fanout.pump(rb) == 5);
+	assert(rb.empty() && fanout.idle());
+	assert(::read(b[0], buf, sizeof buf) == 5 && ::memcmp(buf, "world", 5) == 0);
+	std::cout << "success\n";
+
+	for (int fd : {a[0], a[1], b[0], b[1]}) {
+		::close(fd);
+	}
 }
 
 void test_io_buffer()
@@ -157,12 +559,1565 @@ void test_io_buffer()
 
 	assert(deletes == 1);
 	std::cout << "success\n";
+
+	// Test 4: Compaction policy.
+	std::cout << "Test 4..." << std::flush;
+	bev::io_buffer lazy(4096);
+	lazy.set_compaction_policy({0.25, 64});
+	for (int i = 0; i < 4000; ++i) {
+		lazy.write_head()[i] = static_cast<char>(i % 251);
+	}
+	lazy.commit(4000);
+	lazy.consume(100);
+
+	// Too much live data to be worth moving, so only the tail is offered.
+	slab = lazy.prepare(200);
+	assert(slab.size == 96 && lazy.compactions() == 0);
+	for (int i = 0; i < 96; ++i) {
+		slab.data[i] = static_cast<char>((4000 + i) % 251);
+	}
+	lazy.commit(96);
+
+	// Without any free space, moving is unavoidable.
+	slab = lazy.prepare(200);
+	assert(slab.size == 100 && lazy.compactions() == 1 && lazy.bytes_moved() == 3996);
+
+	// Little live data, moved with streaming stores.
+	lazy.consume(3500);
+	slab = lazy.prepare(200);
+	assert(lazy.compactions() == 2 && lazy.bytes_moved() == 3996 + 496);
+	assert(lazy.read_head() == slab.data - 496);
+	for (int i = 0; i < 496; ++i) {
+		assert(lazy.read_head()[i] == static_cast<char>((3600 + i) % 251));
+	}
+	std::cout << "success\n";
+
+	// Test 5: Allocation options and deleters.
+	std::cout << "Test 5..." << std::flush;
+	auto aligned = [](const char* p, uintptr_t alignment) {
+		return reinterpret_cast<uintptr_t>(p) % alignment == 0;
+	};
+	bev::io_buffer page_aligned(10000, {4096, false, false});
+	assert(aligned(page_aligned.write_head(), 4096) && page_aligned.capacity() == 10000);
+	bev::io_buffer mapped(10000, {0, true, false});
+	assert(aligned(mapped.write_head(), 4096));
+	bev::io_buffer huge(3*1024*1024, {0, false, true});
+	assert(aligned(huge.write_head(), 2*1024*1024));
+	::memset(huge.write_head(), 'h', huge.free_size());
+	huge.commit(huge.free_size());
+	assert(huge.read_head()[3*1024*1024 - 1] == 'h');
+
+	// Small stateful deleters are stored inline, larger ones on the heap.
+	int small_deletes = 0;
+	auto small_deleter = [&small_deletes](char* c) { ++small_deletes; delete[] c; };
+	int large_deletes = 0;
+	struct large_deleter {
+		int* counter;
+		char padding[32];
+		void operator()(char* c) { ++*counter; delete[] c; }
+	};
+	{
+		bev::io_buffer a(std::unique_ptr<char, decltype(small_deleter)>(new char[64], small_deleter), 64);
+		bev::io_buffer b(std::unique_ptr<char, large_deleter>(new char[64], large_deleter {&large_deletes, {}}), 64);
+		bev::io_buffer c(std::move(b));
+		assert(large_deletes == 0);
+	}
+	assert(small_deletes == 1 && large_deletes == 1);
+
+	// Small deleters that aren't trivially copyable aren't relocated bytewise.
+	struct counting_deleter {
+		int* counter;
+		counting_deleter(int* counter) : counter(counter) {}
+		counting_deleter(const counting_deleter& other) : counter(other.counter) {}
+		void operator()(char* c) { ++*counter; delete[] c; }
+	};
+	int counted_deletes = 0;
+	{
+		bev::io_buffer a(std::unique_ptr<char, counting_deleter>(new char[64], &counted_deletes), 64);
+		bev::io_buffer b(std::move(a));
+	}
+	assert(counted_deletes == 1);
+
+	// No deleter is kept for null storage, so none is leaked either.
+	struct tracked_deleter {
+		int* live;
+		char padding[32];
+		tracked_deleter(int* live) : live(live) { ++*live; }
+		tracked_deleter(tracked_deleter&& other) : live(other.live) { ++*live; }
+		~tracked_deleter() { --*live; }
+		void operator()(char* c) { delete[] c; }
+	};
+	int live_deleters = 0;
+	{
+		bev::io_buffer a(std::unique_ptr<char, tracked_deleter>(nullptr, &live_deleters), 0);
+		assert(a.capacity() == 0);
+		bev::io_buffer b(std::unique_ptr<char, tracked_deleter>(new char[64], &live_deleters), 64);
+		assert(live_deleters == 1);
+	}
+	assert(live_deleters == 0);
+
+	// Move assignment releases the previous storage.
+	{
+		bev::io_buffer a(64);
+		a = bev::io_buffer(128);
+		assert(a.capacity() == 128);
+		bev::io_buffer b(std::unique_ptr<char, decltype(small_deleter)>(new char[32], small_deleter), 32);
+		b.commit(10);
+		a = std::move(b);
+		assert(a.size() == 10 && a.capacity() == 22 && small_deletes == 1);
+	}
+	assert(small_deletes == 2);
+	static_assert(std::is_nothrow_move_assignable<bev::io_buffer>::value, "");
+
+	bool thrown = false;
+	try {
+		bev::io_buffer odd(100, {48, false, false});
+	} catch (const std::invalid_argument&) {
+		thrown = true;
+	}
+	assert(thrown);
+	std::cout << "success\n";
+
+	// Test 6: Taking back committed data, for both buffers.
+	std::cout << "Test 6..." << std::flush;
+	bev::io_buffer small(100);
+	small.commit(60);
+	small.consume(10);
+	small.uncommit(20);
+	assert(small.size() == 30 && small.free_size() == 60);
+	small.uncommit(30);
+	assert(small.size() == 0 && small.free_size() == 100);
+	bev::linear_ringbuffer rb(4096);
+	rb.commit(100);
+	rb.consume(50);
+	rb.uncommit(20);
+	assert(rb.size() == 30 && rb.write_head() == rb.read_head() + 30);
+	std::cout << "success\n";
+
+	// Test 7: Using the buffer as a ring through the scatter-gather interface.
+	std::cout << "Test 7..." << std::flush;
+	bev::io_buffer ring(1000);
+	ring.commit(700);
+	ring.consume(600);
+	auto free = ring.prepare_iov(500);
+	assert(free.count == 2 && free.iov[0].iov_len == 300 && free.iov[1].iov_len == 200);
+	assert(free.iov[1].iov_base == ring.read_head() - 600);
+	ring.commit(500);
+	assert(ring.wrapped() && ring.size() == 400 && ring.total_size() == 600 && ring.free_size() == 400);
+	auto data = ring.data_iov();
+	assert(data.count == 2 && data.iov[0].iov_len == 400 && data.iov[1].iov_len == 200);
+
+	// Contiguous writes continue the second part, without compaction.
+	auto contiguous = ring.prepare(1000);
+	assert(contiguous.data == static_cast<char*>(data.iov[1].iov_base) + 200 && contiguous.size == 400);
+	ring.commit(100);
+	ring.uncommit(50);
+	assert(ring.total_size() == 650 && ring.compactions() == 0);
+	ring.consume(450);
+	assert(!ring.wrapped() && ring.size() == 200 && ring.read_head() == static_cast<char*>(data.iov[1].iov_base) + 50);
+
+	// A stream through a pipe in odd-sized pieces arrives intact.
+	ring.consume(200);
+	int fds[2];
+	assert(::pipe(fds) == 0);
+	std::string sent, received;
+	for (int i = 0; i < 200; ++i) {
+		std::string chunk(37 + i % 300, 'a' + i % 26);
+		sent += chunk;
+		assert(::write(fds[1], chunk.data(), chunk.size()) == ssize_t(chunk.size()));
+		free = ring.prepare_iov(chunk.size());
+		assert(::readv(fds[0], free.iov, free.count) == ssize_t(chunk.size()));
+		ring.commit(chunk.size());
+
+		// Consume a bit faster than producing, in pieces of another size.
+		for (size_t budget = 400; budget > 0 && ring.total_size() > 0; ) {
+			data = ring.data_iov();
+			size_t const n = std::min<size_t>(data.iov[0].iov_len, std::min<size_t>(budget, 150));
+			received.append(static_cast<char*>(data.iov[0].iov_base), n);
+			ring.consume(n);
+			budget -= n;
+		}
+	}
+	while (ring.total_size() > 0) {
+		data = ring.data_iov();
+		received.append(static_cast<char*>(data.iov[0].iov_base), data.iov[0].iov_len);
+		ring.consume(data.iov[0].iov_len);
+	}
+	assert(received == sent && ring.compactions() == 0);
+	::close(fds[0]);
+	::close(fds[1]);
+
+	struct iovec const v = rb.prepare_iov(10*4096);
+	assert(v.iov_base == rb.write_head() && v.iov_len == rb.free_size());
+	assert(rb.data_iov().iov_base == rb.read_head() && rb.data_iov().iov_len == 30);
+	std::cout << "success\n";
+}
+
+void test_adaptive_reader()
+{
+	int sv[2];
+	assert(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0);
+
+	// Test 1: Check that reads are sized to the pending data.
+	std::cout << "Test 1..." << std::flush;
+	bev::adaptive_reader reader(sv[0], {true, 16, 1024});
+	char data[100] = {};
+	assert(::write(sv[1], data, sizeof data) == sizeof data);
+	assert(reader.read_size(4096) == 100);
+	assert(reader.read_size(50) == 50);
+	std::cout << "success\n";
+
+	// Test 2: Check reading into a linear_ringbuffer.
+	std::cout << "Test 2..." << std::flush;
+	bev::linear_ringbuffer rb(4096);
+	rb.commit(4096 - 512);
+	assert(reader.read(rb) == 100);
+	assert(rb.size() == 4096 - 512 + 100);
+
+	// The low water mark is capped by the remaining free space.
+	int lowat = 0;
+	socklen_t len = sizeof lowat;
+	::getsockopt(sv[0], SOL_SOCKET, SO_RCVLOWAT, &lowat, &len);
+	assert(lowat == 412);
+	std::cout << "success\n";
+
+	// Test 3: Check reading into an io_buffer.
+	std::cout << "Test 3..." << std::flush;
+	bev::io_buffer iob(4096);
+	assert(::write(sv[1], data, 10) == 10);
+	assert(reader.read(iob) == 10);
+	assert(iob.size() == 10);
+	::getsockopt(sv[0], SOL_SOCKET, SO_RCVLOWAT, &lowat, &len);
+	assert(lowat == 1024);
+	std::cout << "success\n";
+
+	// Test 4: Check that nothing pending and no minimum doesn't look like EOF.
+	std::cout << "Test 4..." << std::flush;
+	bev::adaptive_reader eager(sv[0], {true, 0, 0});
+	assert(eager.read_size(4096) == 1);
+	assert(eager.read(iob) == -1 && errno == EAGAIN);
+	assert(::write(sv[1], data, 3) == 3);
+	assert(eager.read_size(4096) == 3 && eager.read(iob) == 3);
+	std::cout << "success\n";
+
+	::close(sv[0]);
+	::close(sv[1]);
+}
+
+void test_record_ring()
+{
+	bev::record_ring rr(4096);
+
+	// Test 1: Check that records are returned in order and in one piece,
+	// also when wrapping around the edge of the buffer many times.
+	std::cout << "Test 1..." << std::flush;
+	char msg[1000];
+	for (int i = 0; i < 100; ++i) {
+		size_t n = (i * 37) % sizeof msg;
+		std::fill_n(msg, n, char('a' + i % 26));
+		assert(rr.try_push(msg, n));
+		assert(!rr.empty());
+
+		bev::record_ring::record r = rr.front();
+		assert(r.size == n);
+		for (size_t j = 0; j < n; ++j) {
+			assert(r.data[j] == 'a' + i % 26);
+		}
+		rr.pop();
+		assert(rr.empty());
+	}
+	std::cout << "success\n";
+
+	// Test 2: Check in-place construction and a full ring.
+	std::cout << "Test 2..." << std::flush;
+	unsigned char* p = rr.reserve(100);
+	assert(p);
+	::memcpy(p, "abc", 3);
+	assert(rr.empty());
+	rr.publish(3);
+	assert(rr.front().size == 3 && ::memcmp(rr.front().data, "abc", 3) == 0);
+
+	std::vector<char> big(4096);
+	assert(!rr.try_push(big.data(), big.size()));
+	while (rr.try_push(msg, 100)) {}
+	assert(rr.buffer().free_size() < bev::record_ring::footprint(100));
+	rr.clear();
+	assert(rr.empty());
+	std::cout << "success\n";
+}
+
+void test_typed_ringbuffer()
+{
+	struct tick {
+		uint64_t timestamp;
+		double price;
+		uint32_t quantity;
+	};
+	static_assert(sizeof(tick) == 24, "unexpected padding");
+
+	bev::typed_ringbuffer<tick> rb(100);
+
+	// Test 1: Check that the capacity is a multiple of the element size.
+	std::cout << "Test 1..." << std::flush;
+	assert(rb.capacity() >= 100);
+	assert(rb.buffer().capacity() % sizeof(tick) == 0);
+	assert(rb.buffer().capacity() % 4096 == 0);
+	std::cout << "success\n";
+
+	// Test 2: Check element-wise and bulk access across the edge.
+	std::cout << "Test 2..." << std::flush;
+	size_t const cap = rb.capacity();
+	rb.commit(cap - 3);
+	rb.consume(cap - 3);
+	for (uint64_t i = 0; i < 8; ++i) {
+		assert(i % 2 ? rb.push(tick {i, 1.5, 2}) : rb.emplace(i, 1.5, 2u));
+	}
+	assert(rb.size() == 8);
+
+	tick out[16];
+	assert(rb.pop_n(out, 5) == 5);
+	assert(rb.pop_n(out + 5, 16) == 3);
+	for (uint64_t i = 0; i < 8; ++i) {
+		assert(out[i].timestamp == i && out[i].quantity == 2);
+	}
+	assert(rb.empty());
+
+	rb.commit(rb.free_size());
+	assert(!rb.push(tick {}));
+	std::cout << "success\n";
+
+	// Test 3: Check batched consumption from another thread.
+	std::cout << "Test 3..." << std::flush;
+	rb.clear();
+	uint64_t const total = 10 * cap;
+	std::thread producer([&] {
+		for (uint64_t i = 0; i < total; ) {
+			if (rb.push(tick {i, 0.0, 0})) {
+				++i;
+			}
+		}
+	});
+	for (uint64_t expected = 0; expected < total; ) {
+		auto batch = rb.claim_batch(64);
+		assert(batch.size <= 64);
+		for (size_t i = 0; i < batch.size; ++i) {
+			assert(batch.data[i].timestamp == expected++);
+		}
+		rb.release_batch(batch.size);
+	}
+	producer.join();
+	assert(rb.empty());
+	std::cout << "success\n";
+}
+
+void test_line_scanner()
+{
+	// Test 1: Check that lines trickling in are found once complete.
+	std::cout << "Test 1..." << std::flush;
+	bev::linear_ringbuffer rb(4096);
+	bev::line_scanner scanner('\r', '\n');
+	const char input[] = "hello\r\nworld\r\n";
+	for (size_t i = 0; i < 7; ++i) {
+		rb.write_head()[0] = input[i];
+		rb.commit(1);
+		assert(scanner.find(rb) == (i == 6 ? 7 : 0));
+	}
+	assert(scanner.find(rb) == 7);
+	scanner.consume(rb, 7);
+	::memcpy(rb.write_head(), input + 7, 7);
+	rb.commit(7);
+	assert(scanner.find(rb) == 7);
+	assert(::memcmp(rb.read_head(), "world", 5) == 0);
+	scanner.consume(rb, 7);
+	assert(rb.empty() && scanner.find(rb) == 0);
+	std::cout << "success\n";
+
+	// Test 2: Compare against a naive search for all delimiter positions,
+	// so that every lane of the vectorized loops is exercised.
+	std::cout << "Test 2..." << std::flush;
+	char data[200];
+	for (size_t pos = 0; pos + 1 < sizeof data; ++pos) {
+		std::fill_n(data, sizeof data, 'x');
+		data[pos] = '\r';
+		data[pos + 1] = '\n';
+		for (size_t size = 0; size <= sizeof data; size += 13) {
+			bev::line_scanner pair('\r', '\n');
+			bev::line_scanner single('\n');
+			size_t expected = pos + 2 <= size ? pos + 2 : 0;
+			// Scan in two steps to exercise resuming.
+			pair.scan(data, size / 2);
+			single.scan(data, size / 2);
+			assert(pair.scan(data, size) == expected);
+			assert(single.scan(data, size) == expected);
+		}
+	}
+	std::cout << "success\n";
+}
+
+void test_tokenizers()
+{
+	// Test 1: Tokenize an HTTP request arriving in pieces.
+	std::cout << "Test 1..." << std::flush;
+	const char request[] =
+		"GET /index.html HTTP/1.1\r\n"
+		"Host: example.com\r\n"
+		"Accept:  text/html \t\r\n"
+		"\r\n"
+		"body";
+	size_t const head = sizeof request - 1 - 4;
+
+	bev::linear_ringbuffer rb(4096);
+	bev::http_tokenizer http;
+	bev::http_request req;
+	for (size_t i = 0; i < head - 1; ++i) {
+		rb.write_head()[0] = request[i];
+		rb.commit(1);
+		assert(http.parse(rb, req) == 0);
+	}
+	::memcpy(rb.write_head(), request + head - 1, 5);
+	rb.commit(5);
+	assert(http.parse(rb, req) == static_cast<ssize_t>(head));
+
+	auto text = [&](bev::http_token t) {
+		return std::string(reinterpret_cast<char*>(rb.read_head()) + t.offset, t.length);
+	};
+	assert(text(req.method) == "GET");
+	assert(text(req.target) == "/index.html");
+	assert(req.minor_version == 1);
+	assert(req.num_headers == 2);
+	assert(text(req.headers[0].name) == "Host" && text(req.headers[0].value) == "example.com");
+	assert(text(req.headers[1].name) == "Accept" && text(req.headers[1].value) == "text/html");
+
+	http.reset();
+	const char bad[] = "GET /\r\n\r\n";
+	assert(http.parse(bad, sizeof bad - 1, req) == -1);
+	std::cout << "success\n";
+
+	// Test 2: Tokenize a RESP command arriving in pieces.
+	std::cout << "Test 2..." << std::flush;
+	const char command[] = "*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n:-42\r\n+OK\r\n";
+	size_t const value = sizeof command - 1 - 5;
+
+	bev::resp_tokenizer resp;
+	bev::resp_token tokens[8];
+	size_t count;
+	for (size_t i = 0; i < value; ++i) {
+		assert(resp.parse(command, i, tokens, 8, count) == 0);
+	}
+	assert(resp.parse(command, sizeof command - 1, tokens, 8, count) == static_cast<ssize_t>(value));
+	assert(count == 4);
+	assert(tokens[0].type == '*' && tokens[0].value == 3);
+	assert(tokens[1].type == '$' && tokens[1].value == 3);
+	assert(::memcmp(command + tokens[1].offset, "SET", 3) == 0);
+	assert(::memcmp(command + tokens[2].offset, "key", tokens[2].length) == 0);
+	assert(tokens[3].type == ':' && tokens[3].value == -42);
+
+	assert(resp.parse(command + value, 5, tokens, 8, count) == 5);
+	assert(count == 1 && tokens[0].type == '+' && tokens[0].length == 2);
+
+	const char invalid[] = "$3\r\nSETX\r\n";
+	assert(resp.parse(invalid, sizeof invalid - 1, tokens, 8, count) == -1);
+	assert(resp.parse(command, sizeof command - 1, tokens, 2, count) == -1);
+	std::cout << "success\n";
+}
+
+void test_checksummed_ringbuffer()
+{
+	// Test 1: Check CRC32C against the standard check value and the
+	// hardware implementation against the table.
+	std::cout << "Test 1..." << std::flush;
+	assert(bev::crc32c(0, "123456789", 9) == 0xe3069283);
+	assert(bev::crc32c(0, "", 0) == 0);
+
+	unsigned char data[1000];
+	for (size_t i = 0; i < sizeof data; ++i) {
+		data[i] = i * 7 + (i >> 3);
+	}
+	for (size_t n = 0; n < 40; ++n) {
+		assert(bev::crc32c(0, data + 3, n) == ~bev::detail::crc32c_sw(~0u, data + 3, n));
+	}
+	uint32_t const a = bev::crc32c(0, data, 123);
+	uint32_t const b = bev::crc32c(0, data + 123, 877);
+	assert(bev::crc32c(a, data + 123, 877) == bev::crc32c(0, data, 1000));
+	assert(bev::crc32c_combine(a, b, 877) == bev::crc32c(0, data, 1000));
+	std::cout << "success\n";
+
+	// Test 2: Digest of committed ranges, also across the edge of the buffer.
+	std::cout << "Test 2..." << std::flush;
+	bev::checksummed_ringbuffer rb(4096);
+	size_t const capacity = rb.capacity();
+	size_t written = 0;
+	while (written < 3 * capacity) {
+		rb.consume(rb.size());
+		auto from = rb.mark();
+		size_t const n = std::min(sizeof data, rb.free_size());
+		::memcpy(rb.write_head(), data, n);
+		rb.commit(n);
+		written += n;
+		assert(decltype(rb)::digest(from, rb.mark()) == bev::crc32c(0, data, n));
+	}
+
+	auto from = rb.mark();
+	rb.consume(rb.size());
+	for (int i = 0; i < 3; ++i) {
+		::memcpy(rb.write_head(), data + 100 * i, 100);
+		rb.commit(100);
+	}
+	assert(decltype(rb)::digest(from, rb.mark()) == bev::crc32c(0, data, 300));
+	assert(decltype(rb)::digest(from, from) == 0);
+	std::cout << "success\n";
+
+	// Test 3: Look up ranges in the checkpoint log by their offsets.
+	std::cout << "Test 3..." << std::flush;
+	bev::checksummed_ringbuffer_<size_t, 8> small(4096);
+	uint32_t crc;
+	assert(small.digest(0, 0, crc) == 0 && crc == 0);
+	for (size_t i = 0; i < 10; ++i) {
+		::memcpy(small.write_head(), data + 10 * i, 10);
+		small.commit(10);
+		small.commit(0);
+	}
+	// The log keeps the last 7 of the 11 checkpoints.
+	assert(small.digest(40, 100, crc) == 0 && crc == bev::crc32c(0, data + 40, 60));
+	assert(small.digest(100, 100, crc) == 0 && crc == 0);
+	assert(small.digest(0, 100, crc) == -1 && errno == ERANGE);
+	assert(small.digest(30, 100, crc) == -1 && errno == ERANGE);
+	assert(small.digest(40, 95, crc) == -1 && errno == EINVAL);
+	assert(small.digest(40, 110, crc) == -1 && errno == EINVAL);
+	assert(small.digest(50, 40, crc) == -1 && errno == EINVAL);
+	std::cout << "success\n";
+
+	// Test 4: A consumer thread gets the digest of everything it reads from
+	// the log while the producer keeps committing.
+	std::cout << "Test 4..." << std::flush;
+	bev::checksummed_ringbuffer shared(4096);
+	size_t const total = 4 * 1024 * 1024;
+	std::thread producer([&] {
+		size_t sent = 0;
+		while (sent < total) {
+			size_t const n = std::min({sent % 97 + 1, shared.free_size(), total - sent});
+			for (size_t i = 0; i < n; ++i) {
+				shared.write_head()[i] = (sent + i) * 13 + ((sent + i) >> 9);
+			}
+			shared.commit(n);
+			sent += n;
+		}
+	});
+	uint64_t offset = 0;
+	size_t matched = 0;
+	while (offset < total) {
+		size_t const n = shared.size();
+		if (n == 0) {
+			continue;
+		}
+		int const res = shared.digest(offset, offset + n, crc);
+		assert(res == 0 || errno == ERANGE);
+		if (res == 0) {
+			assert(crc == bev::crc32c(0, shared.read_head(), n));
+			++matched;
+		}
+		shared.consume(n);
+		offset += n;
+	}
+	producer.join();
+	assert(matched > 0);
+	std::cout << "success\n";
+}
+
+void test_pipeline()
+{
+	// Test 1: Hex and base64 encoding.
+	std::cout << "Test 1..." << std::flush;
+	const char* const inputs[] = {"", "f", "fo", "foo", "foob", "fooba", "foobar"};
+	const char* const expected[] = {"", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy"};
+	char text[512];
+	for (int i = 0; i < 7; ++i) {
+		size_t n = bev::base64_encode(inputs[i], ::strlen(inputs[i]), text);
+		assert(std::string(text, n) == expected[i]);
+	}
+
+	unsigned char bytes[100];
+	for (size_t i = 0; i < sizeof bytes; ++i) {
+		bytes[i] = i * 37 + 11;
+	}
+	for (size_t n : {0, 1, 17, 33, 98, 100}) {
+		size_t k = bev::hex_encode(bytes, n, text);
+		assert(k == 2 * n);
+		for (size_t i = 0; i < n; ++i) {
+			char hex[3];
+			::snprintf(hex, sizeof hex, "%02x", bytes[i]);
+			assert(text[2*i] == hex[0] && text[2*i + 1] == hex[1]);
+		}
+
+		k = bev::base64_encode(bytes, n, text);
+		char scalar[200];
+		bev::detail::base64_encode_scalar(bytes, n / 3, scalar);
+		assert(k == bev::base64_size(n) && ::memcmp(text, scalar, n / 3 * 4) == 0);
+	}
+	std::cout << "success\n";
+
+	// Test 2: ChaCha20 test vectors from RFC 8439, sections 2.3.2 and 2.4.2.
+	std::cout << "Test 2..." << std::flush;
+	unsigned char key[32];
+	for (int i = 0; i < 32; ++i) {
+		key[i] = i;
+	}
+	const unsigned char nonce1[12] = {0, 0, 0, 9, 0, 0, 0, 0x4a, 0, 0, 0, 0};
+	unsigned char block[64];
+	bev::chacha20(key, nonce1, 1).block(block);
+	const unsigned char block_start[] = {0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15};
+	assert(::memcmp(block, block_start, sizeof block_start) == 0);
+
+	const char plaintext[] = "Ladies and Gentlemen of the class of '99: If I could offer you "
+		"only one tip for the future, sunscreen would be it.";
+	size_t const length = sizeof plaintext - 1;
+	const unsigned char nonce2[12] = {0, 0, 0, 0, 0, 0, 0, 0x4a, 0, 0, 0, 0};
+	unsigned char ciphertext[length];
+	bev::chacha20 cipher(key, nonce2, 1);
+	// In odd pieces, to check that the key stream position carries over.
+	for (size_t i = 0; i < length; i += 7) {
+		size_t n = std::min<size_t>(7, length - i);
+		cipher.apply(reinterpret_cast<const unsigned char*>(plaintext) + i, ciphertext + i, n);
+	}
+	bev::hex_encode(ciphertext, 16, text);
+	assert(std::string(text, 32) == "6e2e359a2568f98041ba0728dd0d6981");
+	bev::hex_encode(ciphertext + length - 2, 2, text);
+	assert(std::string(text, 4) == "874d");
+
+	bev::chacha20(key, nonce2, 1).apply(ciphertext, ciphertext, length);
+	assert(::memcmp(ciphertext, plaintext, length) == 0);
+	std::cout << "success\n";
+
+	// Test 3: LZ round trip of compressible and incompressible data, and
+	// rejection of corrupt input.
+	std::cout << "Test 3..." << std::flush;
+	std::string data;
+	for (int i = 0; data.size() < 200000; ++i) {
+		data += "line " + std::to_string(i % 1000) + ": the quick brown fox\n";
+	}
+	unsigned seed = 1;
+	for (int i = 0; i < 5000; ++i) {
+		seed = seed * 1103515245 + 12345;
+		data += static_cast<char>(seed >> 16);
+	}
+
+	auto compressor = std::make_unique<bev::lz_compressor>();
+	bev::lz_decompressor decompressor;
+	bev::linear_ringbuffer plain(256*1024), packed(256*1024), unpacked(256*1024);
+	::memcpy(plain.write_head(), data.data(), data.size());
+	plain.commit(data.size());
+	while (!plain.empty()) {
+		assert(bev::pump(*compressor, plain, packed) == 1);
+	}
+	assert(packed.size() < data.size() / 4);
+	while (!packed.empty()) {
+		assert(bev::pump(decompressor, packed, unpacked, true) == 1);
+	}
+	assert(unpacked.size() == data.size());
+	assert(::memcmp(unpacked.read_head(), data.data(), data.size()) == 0);
+
+	// A block of 16 bytes whose first match refers to offset 0.
+	unpacked.clear();
+	const unsigned char corrupt[] = {16, 0, 0, 0, 3, 0, 0, 0, 0x00, 0x00, 0x00};
+	::memcpy(packed.write_head(), corrupt, sizeof corrupt);
+	packed.commit(sizeof corrupt);
+	errno = 0;
+	int res = bev::pump(decompressor, packed, unpacked, true);
+	assert(res == -1 && errno == EBADMSG && unpacked.empty());
+
+	// A truncated block is only an error when flushing.
+	packed.clear();
+	::memcpy(plain.write_head(), data.data(), 1000);
+	plain.commit(1000);
+	assert(bev::pump(*compressor, plain, packed) == 1);
+	packed.uncommit(1);
+	assert(bev::pump(decompressor, packed, unpacked) == 0);
+	errno = 0;
+	res = bev::pump(decompressor, packed, unpacked, true);
+	assert(res == -1 && errno == EBADMSG);
+	packed.clear();
+
+	// The buffers can also be `io_buffer`s, which use `char`.
+	bev::io_buffer plain_iob(64*1024), packed_iob(64*1024), unpacked_iob(64*1024);
+	::memcpy(plain_iob.write_head(), data.data(), 50000);
+	plain_iob.commit(50000);
+	while (plain_iob.size() > 0) {
+		assert(bev::pump(*compressor, plain_iob, packed_iob) == 1);
+	}
+	while (packed_iob.size() > 0) {
+		assert(bev::pump(decompressor, packed_iob, unpacked_iob, true) == 1);
+	}
+	assert(unpacked_iob.size() == 50000 && ::memcmp(unpacked_iob.read_head(), data.data(), 50000) == 0);
+	std::cout << "success\n";
+
+	// Test 4: Compress, encrypt and encode on three threads, then invert
+	// the first two stages inline.
+	std::cout << "Test 4..." << std::flush;
+	bev::linear_ringbuffer source(64*1024), compressed(128*1024), encrypted(128*1024), encoded(256*1024);
+	bev::chacha20 encrypt_cipher(key, nonce2);
+	bev::base64_encoder base64;
+	std::string output;
+	{
+		bev::stage_thread compress(*compressor, source, compressed);
+		bev::stage_thread encrypt(encrypt_cipher, compressed, encrypted);
+		bev::stage_thread encode(base64, encrypted, encoded);
+
+		size_t written = 0;
+		while (written < data.size() || !encode.done()) {
+			size_t n = std::min(source.free_size(), data.size() - written);
+			::memcpy(source.write_head(), data.data() + written, n);
+			source.commit(n);
+			compress.notify();
+			written += n;
+			if (written == data.size()) {
+				compress.close();
+			}
+			if (compress.done()) {
+				encrypt.close();
+			}
+			if (encrypt.done()) {
+				encode.close();
+			}
+
+			output.append(reinterpret_cast<char*>(encoded.read_head()), encoded.size());
+			encoded.consume(encoded.size());
+			std::this_thread::yield();
+		}
+		output.append(reinterpret_cast<char*>(encoded.read_head()), encoded.size());
+		assert(compress.error() == 0 && encrypt.error() == 0 && encode.error() == 0);
+	}
+	assert(output.size() % 4 == 0);
+
+	// Re-encrypt the decoded base64 with a fresh cipher and decompress.
+	static const std::string alphabet = bev::detail::BASE64_ALPHABET;
+	std::string binary;
+	for (size_t i = 0; i < output.size(); i += 4) {
+		uint32_t v = 0;
+		int pad = 0;
+		for (int j = 0; j < 4; ++j) {
+			char c = output[i + j];
+			pad += c == '=';
+			v = v << 6 | (c == '=' ? 0 : alphabet.find(c));
+		}
+		binary += static_cast<char>(v >> 16);
+		if (pad < 2) binary += static_cast<char>(v >> 8);
+		if (pad < 1) binary += static_cast<char>(v);
+	}
+
+	bev::chacha20 decrypt_cipher(key, nonce2);
+	bev::linear_ringbuffer ciphered(512*1024), deciphered(512*1024);
+	unpacked.clear();
+	::memcpy(ciphered.write_head(), binary.data(), binary.size());
+	ciphered.commit(binary.size());
+	while (bev::pump(decrypt_cipher, ciphered, deciphered, true) == 1) {}
+	while (!deciphered.empty()) {
+		assert(bev::pump(decompressor, deciphered, unpacked, true) == 1);
+	}
+	assert(unpacked.size() == data.size());
+	assert(::memcmp(unpacked.read_head(), data.data(), data.size()) == 0);
+	std::cout << "success\n";
+
+	// Test 5: An idle stage sleeps instead of spinning, and wakes up when
+	// notified.
+	std::cout << "Test 5..." << std::flush;
+	bev::linear_ringbuffer idle_in(4096), idle_out(16384);
+	bev::hex_encoder hex;
+	{
+		bev::stage_thread idle(hex, idle_in, idle_out);
+		struct rusage before, after;
+		::getrusage(RUSAGE_SELF, &before);
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+		::getrusage(RUSAGE_SELF, &after);
+		auto const cpu_us = [](const struct rusage& r) {
+			return (r.ru_utime.tv_sec + r.ru_stime.tv_sec) * 1000000L
+				+ r.ru_utime.tv_usec + r.ru_stime.tv_usec;
+		};
+		assert(cpu_us(after) - cpu_us(before) < 100000);
+
+		::memcpy(idle_in.write_head(), "abc", 3);
+		idle_in.commit(3);
+		idle.notify();
+		while (idle_out.size() < 6) {
+			std::this_thread::yield();
+		}
+		assert(::memcmp(idle_out.read_head(), "616263", 6) == 0);
+		idle.close();
+		idle.join();
+		assert(idle.done());
+	}
+	std::cout << "success\n";
+}
+
+void test_traced_ringbuffer()
+{
+	// Test 1: Histogram percentiles.
+	std::cout << "Test 1..." << std::flush;
+	bev::dwell_histogram h;
+	assert(h.percentile(0.5) == 0);
+	for (uint64_t i = 1; i <= 1000; ++i) {
+		h.record(i * 1000);
+	}
+	assert(h.count() == 1000 && h.max() == 1000000);
+	uint64_t const p50 = h.percentile(0.5);
+	uint64_t const p99 = h.percentile(0.99);
+	assert(p50 >= 500000 && p50 <= 500000 * 107 / 100);
+	assert(p99 >= 990000 && p99 <= 1000000);
+	assert(h.percentile(1.0) == 1000000);
+	assert(h.percentile(0.0) >= 1000 && h.percentile(0.0) < 1100);
+	std::cout << "success\n";
+
+	// Test 2: Dwell time is recorded when the read head passes the end
+	// of a commit.
+	std::cout << "Test 2..." << std::flush;
+	bev::traced_ringbuffer_<size_t, true> rb(4096);
+	rb.commit(100);
+	rb.commit(100);
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	rb.consume(150);
+	assert(rb.dwell().count() == 1);
+	rb.consume(50);
+	assert(rb.dwell().count() == 2);
+	uint64_t const dwell = rb.dwell_ns(0.5);
+	assert(dwell >= 15000000 && dwell < 1000000000);
+
+	rb.commit(10);
+	rb.clear();
+	rb.commit(10);
+	rb.consume(10);
+	assert(rb.dwell().count() == 3 && rb.dwell_ns(0.0) < 15000000);
+	std::cout << "success\n";
+
+	// Test 3: Disabled tracing costs nothing.
+	std::cout << "Test 3..." << std::flush;
+	static_assert(sizeof(bev::traced_ringbuffer_<size_t, false>) == sizeof(bev::linear_ringbuffer),
+		"Disabled tracing must not add any state.");
+	bev::traced_ringbuffer_<size_t, false> untraced(4096);
+	untraced.commit(10);
+	untraced.consume(10);
+	assert(untraced.dwell_ns(0.5) == 0);
+	std::cout << "success\n";
+}
+
+void test_flight_ring()
+{
+	// Test 1: The oldest records are overwritten, and a reader that was
+	// overrun resyncs to the oldest intact one.
+	std::cout << "Test 1..." << std::flush;
+	bev::flight_ring fr(4096);
+	bev::flight_ring::reader early(fr);
+	size_t const capacity = fr.capacity();
+	size_t const record = bev::flight_ring::footprint(sizeof(uint64_t) + 20);
+	char payload[64] = {};
+	uint64_t const count = 3 * capacity / record;
+	for (uint64_t i = 0; i < count; ++i) {
+		::memcpy(payload, &i, sizeof i);
+		assert(fr.push(payload, sizeof i + 20));
+	}
+	assert(fr.tail() == count * record);
+	assert(fr.tail() - fr.head() <= capacity);
+	assert(!fr.push(payload, capacity));
+
+	char out[64];
+	size_t n;
+	uint64_t expected = (fr.head()) / record;
+	assert(early.read(out, 8, n) == -1 && errno == EMSGSIZE);
+	while (early.read(out, sizeof out, n) == 1) {
+		uint64_t seq;
+		::memcpy(&seq, out, sizeof seq);
+		assert(n == sizeof seq + 20 && seq == expected++);
+	}
+	assert(expected == count);
+	assert(early.overruns() == 1 && early.lost_bytes() == fr.head());
+	std::cout << "success\n";
+
+	// Test 2: A concurrent reader only ever sees intact records.
+	std::cout << "Test 2..." << std::flush;
+	bev::flight_ring shared(4096);
+	uint64_t const total = 200000;
+	std::thread producer([&] {
+		uint64_t buf[16];
+		for (uint64_t i = 0; i < total; ++i) {
+			size_t const words = 1 + i % 16;
+			for (size_t j = 0; j < words; ++j) {
+				buf[j] = i;
+			}
+			shared.push(buf, words * sizeof(uint64_t));
+		}
+	});
+
+	bev::flight_ring::reader r(shared);
+	uint64_t last = 0, received = 0;
+	uint64_t buf[16];
+	while (last + 1 < total) {
+		if (r.read(buf, sizeof buf, n) != 1) {
+			continue;
+		}
+		size_t const words = n / sizeof(uint64_t);
+		assert(words == 1 + buf[0] % 16);
+		for (size_t j = 1; j < words; ++j) {
+			assert(buf[j] == buf[0]);
+		}
+		assert(received == 0 || buf[0] > last);
+		last = buf[0];
+		++received;
+	}
+	producer.join();
+	assert(received > 0 && received <= total);
+	std::cout << "success\n";
+}
+
+void test_binary_logger()
+{
+	// Test 1: Records are formatted later, with the original arguments.
+	std::cout << "Test 1..." << std::flush;
+	bev::binary_logger logger;
+	std::string name = "bob";
+	const char* greeting = "hello";
+	BEV_LOG(logger, "%s %s, %d items at %.2f (%5u%%) %c", greeting, name, -3, 2.5, 42u, 'x');
+	BEV_LOG(logger, "no arguments");
+	BEV_LOG(logger, "%08x|%-4s|%lld", 0xbeefu, "ab", -(int64_t(1) << 40));
+
+	std::vector<std::string> lines;
+	const bev::log_site* first = nullptr;
+	size_t n = logger.drain([&](const bev::log_site& site, uint64_t, const std::string& text) {
+		first = first ? first : &site;
+		lines.push_back(text);
+	});
+	assert(n == 3 && lines.size() == 3);
+	assert(lines[0] == "hello bob, -3 items at 2.50 (   42%) x");
+	assert(lines[1] == "no arguments");
+	assert(lines[2] == "0000beef|ab  |-1099511627776");
+	assert(::strcmp(first->file, __FILE__) == 0);
+	assert(logger.drain([](const bev::log_site&, uint64_t, const std::string&) {}) == 0);
+	std::cout << "success\n";
+
+	// Test 2: Threads log into their own buffers, which are merged in
+	// timestamp order. Full buffers drop records instead of blocking.
+	std::cout << "Test 2..." << std::flush;
+	bev::binary_logger small(4096);
+	auto work = [&](int thread) {
+		for (int i = 0; i < 1000; ++i) {
+			BEV_LOG(small, "thread %d message %d", thread, i);
+		}
+	};
+	std::thread a(work, 1), b(work, 2);
+	a.join();
+	b.join();
+
+	int next[3] = {0, 0, 0};
+	uint64_t last = 0;
+	size_t count = small.drain([&](const bev::log_site&, uint64_t tsc, const std::string& text) {
+		int thread, i;
+		assert(::sscanf(text.c_str(), "thread %d message %d", &thread, &i) == 2);
+		assert(i == next[thread]++);
+		assert(tsc >= last);
+		last = tsc;
+	});
+	assert(count + small.dropped() == 2000);
+	assert(small.dropped() > 0);
+
+	// The buffers of the exited threads are freed by draining.
+	assert(small.buffers() == 0);
+	std::cout << "success\n";
+
+	// Test 3: A thread alternating between loggers keeps one buffer each.
+	std::cout << "Test 3..." << std::flush;
+	bev::binary_logger other(4096);
+	for (int i = 0; i < 100; ++i) {
+		BEV_LOG(logger, "first %d", i);
+		BEV_LOG(other, "second %d", i);
+	}
+	assert(logger.buffers() == 1 && other.buffers() == 1);
+	assert(logger.drain([](const bev::log_site&, uint64_t, const std::string&) {}) == 100);
+	assert(other.drain([](const bev::log_site&, uint64_t, const std::string&) {}) == 100);
+	std::thread t([&] { BEV_LOG(other, "from another thread"); });
+	t.join();
+	assert(other.buffers() == 2);
+	assert(other.drain([](const bev::log_site&, uint64_t, const std::string&) {}) == 1);
+	assert(other.buffers() == 1 && logger.buffers() == 1);
+	std::cout << "success\n";
+
+	// Test 4: Draining only takes the records that were there when it
+	// started, even if more keep coming.
+	std::cout << "Test 4..." << std::flush;
+	for (int i = 0; i < 3; ++i) {
+		BEV_LOG(logger, "initial %d", i);
+	}
+	for (int round = 0; round < 3; ++round) {
+		size_t const drained = logger.drain([&](const bev::log_site&, uint64_t, const std::string&) {
+			BEV_LOG(logger, "logged while draining");
+		});
+		assert(drained == 3);
+	}
+
+	std::atomic<bool> stop {false};
+	std::thread busy([&] {
+		while (!stop.load(std::memory_order_relaxed)) {
+			BEV_LOG(logger, "busy");
+		}
+	});
+	for (int round = 0; round < 10; ++round) {
+		logger.drain([](const bev::log_site&, uint64_t, const std::string&) {});
+	}
+	stop.store(true, std::memory_order_relaxed);
+	busy.join();
+	std::cout << "success\n";
+}
+
+void test_multi_buffer()
+{
+	std::cout << "Test 1..." << std::flush;
+	bev::slab_pool pool(4096, 4);
+	char* a = pool.acquire();
+	char* b = pool.acquire();
+	assert(b == a + 4096);
+	assert(pool.in_use() == 2 && pool.available() == 2);
+	pool.release(a);
+	pool.release(b);
+	assert(pool.in_use() == 0 && pool.available() == 4);
+	std::cout << "success\n";
+
+	std::cout << "Test 2..." << std::flush;
+	{
+		bev::multi_buffer mb(pool);
+		auto free = mb.prepare(10000);
+		assert(free.count == 3 && free.size == 10000);
+		assert(mb.capacity() == 3*4096);
+		char c = 0;
+		for (int i = 0; i < free.count; ++i) {
+			char* p = static_cast<char*>(free.iov[i].iov_base);
+			for (size_t j = 0; j < free.iov[i].iov_len; ++j) {
+				p[j] = c++;
+			}
+		}
+		mb.commit(10000);
+		assert(mb.size() == 10000);
+		assert(mb.contiguous_size() == 4096);
+
+		// Consuming the first slab releases it.
+		mb.consume(5000);
+		assert(pool.in_use() == 2);
+		assert(mb.contiguous_size() == 3192);
+		assert(*mb.read_head() == char(5000));
+		auto data = mb.data();
+		assert(data.count == 2 && data.size == 5000);
+
+		// Growing appends to the partially filled last slab.
+		free = mb.prepare(3000);
+		assert(free.count == 2 && free.size == 3000);
+		assert(free.iov[0].iov_len == 3*4096 - 10000);
+		mb.commit(3000);
+		assert(mb.size() == 8000);
+	}
+	assert(pool.in_use() == 0);
+	std::cout << "success\n";
+
+	std::cout << "Test 3..." << std::flush;
+	{
+		// `readv()` and `writev()` through a pipe, and the size limit.
+		int fds[2];
+		assert(::pipe(fds) == 0);
+		std::string msg(9000, 'x');
+		for (size_t i = 0; i < msg.size(); ++i) {
+			msg[i] = 'a' + i % 26;
+		}
+
+		bev::multi_buffer in(pool, 9000);
+		bev::multi_buffer out(pool);
+		size_t copied = 0;
+		while (copied < msg.size()) {
+			auto free = in.prepare(msg.size() - copied);
+			for (int i = 0; i < free.count; ++i) {
+				::memcpy(free.iov[i].iov_base, msg.data() + copied, free.iov[i].iov_len);
+				copied += free.iov[i].iov_len;
+			}
+			in.commit(free.size);
+		}
+		assert(in.prepare(100).size == 0);
+
+		auto data = in.data();
+		assert(::writev(fds[1], data.iov, data.count) == 9000);
+		in.consume(9000);
+		assert(in.capacity() == 0);
+
+		auto free = out.prepare(9000);
+		assert(::readv(fds[0], free.iov, free.count) == 9000);
+		out.commit(9000);
+		std::string result;
+		data = out.data();
+		for (int i = 0; i < data.count; ++i) {
+			result.append(static_cast<char*>(data.iov[i].iov_base), data.iov[i].iov_len);
+		}
+		assert(result == msg);
+		::close(fds[0]);
+		::close(fds[1]);
+	}
+	assert(pool.in_use() == 0);
+	std::cout << "success\n";
+
+	std::cout << "Test 4..." << std::flush;
+	{
+		// After a burst, the pool only keeps one idle chunk.
+		bev::slab_pool burst(4096, 4);
+		std::vector<char*> slabs;
+		for (int i = 0; i < 20; ++i) {
+			slabs.push_back(burst.acquire());
+		}
+		assert(burst.chunks() == 5 && burst.available() == 0);
+		for (size_t i = 0; i < slabs.size(); i += 2) {
+			burst.release(slabs[i]);
+		}
+		assert(burst.chunks() == 5 && burst.available() == 10);
+		for (size_t i = 1; i < slabs.size(); i += 2) {
+			burst.release(slabs[i]);
+		}
+		assert(burst.chunks() == 1 && burst.available() == 4 && burst.in_use() == 0);
+
+		// The remaining slabs are still valid and handed out again.
+		char* slab = burst.acquire();
+		::memset(slab, 'x', 4096);
+		assert(burst.chunks() == 1 && burst.available() == 3);
+		burst.release(slab);
+	}
+	std::cout << "success\n";
+}
+
+void test_pooled_io_buffer()
+{
+	std::cout << "Test 1..." << std::flush;
+	bev::slab_pool pool(4096, 8);
+	{
+		std::vector<std::unique_ptr<bev::pooled_io_buffer>> buffers;
+		for (int i = 0; i < 1000; ++i) {
+			buffers.push_back(std::make_unique<bev::pooled_io_buffer>(pool));
+		}
+		assert(pool.in_use() == 0 && pool.available() == 0);
+		assert(buffers[0]->capacity() == 4096);
+
+		// A read that returns nothing doesn't keep the slab.
+		auto slab = buffers[0]->prepare(100);
+		assert(slab.size == 100 && pool.in_use() == 1);
+		buffers[0]->commit(0);
+		assert(!buffers[0]->holds_memory() && pool.in_use() == 0);
+
+		for (int i = 0; i < 10; ++i) {
+			slab = buffers[i]->prepare(100);
+			::memset(slab.data, 'a' + i, 100);
+			buffers[i]->commit(100);
+		}
+		assert(pool.in_use() == 10 && pool.available() == 6);
+
+		buffers[3]->consume(50);
+		assert(buffers[3]->holds_memory());
+		assert(buffers[3]->read_head()[0] == 'd' && buffers[3]->size() == 50);
+		buffers[3]->consume(50);
+		assert(!buffers[3]->holds_memory() && pool.in_use() == 9);
+	}
+	assert(pool.in_use() == 0);
+	std::cout << "success\n";
+
+	std::cout << "Test 2..." << std::flush;
+	{
+		bev::pooled_io_buffer iob;
+		assert(&bev::thread_slab_pool() == &bev::thread_slab_pool());
+		size_t const in_use = bev::thread_slab_pool().in_use();
+		auto slab = iob.prepare(SIZE_MAX);
+		assert(slab.size == bev::thread_slab_pool().slab_size());
+		iob.commit(slab.size);
+		assert(iob.free_size() == 0);
+		assert(bev::thread_slab_pool().in_use() == in_use + 1);
+		iob.clear();
+		assert(bev::thread_slab_pool().in_use() == in_use);
+	}
+	std::cout << "success\n";
+}
+
+void test_growable_io_buffer()
+{
+	size_t const page = ::getpagesize();
+
+	std::cout << "Test 1..." << std::flush;
+	bev::growable_io_buffer iob(page, 16*page, std::chrono::milliseconds(0));
+	assert(iob.capacity() == page);
+
+	// Growing keeps the contents in place.
+	auto slab = iob.prepare(100);
+	::memset(slab.data, 'x', 100);
+	iob.commit(100);
+	iob.consume(10);
+	slab = iob.prepare(3*page);
+	assert(slab.size == 3*page);
+	assert(iob.grows() == 1 && iob.compactions() == 0);
+	assert(iob.size() == 90 && iob.read_head()[0] == 'x' && iob.read_head()[89] == 'x');
+	::memset(slab.data, 'y', slab.size);
+	iob.commit(slab.size);
+	assert(iob.read_head()[90] == 'y');
+	std::cout << "success\n";
+
+	std::cout << "Test 2..." << std::flush;
+	// The maximum is never exceeded.
+	slab = iob.prepare(100*page);
+	assert(iob.max_size() == 16*page);
+	assert(slab.size == 16*page - iob.size());
+	assert(iob.capacity() == slab.size);
+	std::cout << "success\n";
+
+	std::cout << "Test 3..." << std::flush;
+	// Running empty shrinks back, once the quiet period is over.
+	iob.consume(iob.size());
+	assert(iob.shrinks() == 1 && iob.capacity() == page);
+
+	bev::growable_io_buffer patient(page, 16*page, std::chrono::hours(1));
+	patient.commit(patient.prepare(2*page).size);
+	assert(patient.grows() == 1);
+	patient.consume(patient.size());
+	assert(patient.shrinks() == 0 && patient.capacity() >= 2*page);
+	std::cout << "success\n";
+
+	std::cout << "Test 4..." << std::flush;
+	// Going idle right after a large message shrinks once the period is
+	// over, either by the next small `prepare()` or by `trim()`.
+	bev::growable_io_buffer a(page, 16*page, std::chrono::milliseconds(20));
+	bev::growable_io_buffer b(page, 16*page, std::chrono::milliseconds(20));
+	for (bev::growable_io_buffer* iob : {&a, &b}) {
+		iob->commit(iob->prepare(8*page).size);
+		iob->consume(iob->size());
+		assert(iob->grows() == 1 && iob->shrinks() == 0 && !iob->trim());
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(30));
+	slab = a.prepare(100);
+	assert(a.shrinks() == 1 && a.capacity() == page && slab.size == 100);
+	assert(b.trim() && b.shrinks() == 1 && b.capacity() == page);
+	assert(!b.trim());
+	std::cout << "success\n";
+
+	std::cout << "Test 5..." << std::flush;
+	// With no further traffic, a timer armed for `next_trim_deadline()`
+	// shrinks the mapping.
+	typedef bev::growable_io_buffer::clock clock;
+	bev::growable_io_buffer idle(page, 16*page, std::chrono::milliseconds(20));
+	assert(idle.next_trim_deadline() == clock::time_point::max());
+	idle.commit(idle.prepare(8*page).size);
+	assert(idle.next_trim_deadline() == clock::time_point::max());
+	idle.consume(idle.size());
+	assert(idle.capacity() == 8*page);
+	auto const deadline = idle.next_trim_deadline();
+	assert(deadline != clock::time_point::max());
+	assert(deadline <= clock::now() + std::chrono::milliseconds(20));
+	std::this_thread::sleep_until(deadline);
+	assert(idle.trim() && idle.capacity() == page);
+	assert(idle.next_trim_deadline() == clock::time_point::max());
+	std::cout << "success\n";
+}
+
+// Written once for all buffers.
+template<typename Buffer>
+std::string echo_through(Buffer& b, const std::string& msg)
+{
+	int fds[2];
+	assert(::pipe(fds) == 0);
+	assert(::write(fds[1], msg.data(), msg.size()) == ssize_t(msg.size()));
+	::close(fds[1]);
+
+	std::string result;
+	while (bev::read_some(fds[0], b, 1000) > 0) {
+		bev::bytes data = bev::data(b);
+		result.append(reinterpret_cast<char*>(data.data), data.size);
+		bev::consume(b, data.size);
+	}
+	::close(fds[0]);
+	return result;
+}
+
+void test_byte_stream_buffer()
+{
+	std::cout << "Test 1..." << std::flush;
+	static_assert(bev::is_byte_stream_buffer<bev::linear_ringbuffer>::value, "");
+	static_assert(bev::is_byte_stream_buffer<bev::linear_ringbuffer_<uint32_t>>::value, "");
+	static_assert(bev::is_byte_stream_buffer<bev::io_buffer_view>::value, "");
+	static_assert(bev::is_byte_stream_buffer<bev::io_buffer>::value, "");
+	static_assert(bev::is_byte_stream_buffer<bev::pooled_io_buffer>::value, "");
+	static_assert(bev::is_byte_stream_buffer<bev::growable_io_buffer>::value, "");
+	static_assert(!bev::is_byte_stream_buffer<bev::typed_ringbuffer<int>>::value, "");
+	static_assert(!bev::is_byte_stream_buffer<std::string>::value, "");
+#if defined(BEV_HAS_BYTE_STREAM_CONCEPT)
+	static_assert(bev::byte_stream_buffer<bev::linear_ringbuffer>);
+	static_assert(!bev::byte_stream_buffer<std::string>);
+#endif
+
+	bev::linear_ringbuffer rb(4096);
+	rb.commit(4000);
+	auto slab = rb.prepare(1000);
+	assert(slab.data == rb.write_head() && slab.size == rb.capacity() - 4000);
+	rb.consume(4000);
+	slab = rb.prepare(1000);
+	assert(slab.data == rb.write_head() && slab.size == 1000);
+	std::cout << "success\n";
+
+	std::cout << "Test 2..." << std::flush;
+	std::string msg(20000, '\0');
+	for (size_t i = 0; i < msg.size(); ++i) {
+		msg[i] = 'a' + i % 26;
+	}
+	rb.clear();
+	assert(echo_through(rb, msg) == msg);
+	bev::io_buffer iob(4096);
+	assert(echo_through(iob, msg) == msg);
+	bev::slab_pool pool(4096);
+	bev::pooled_io_buffer pooled(pool);
+	assert(echo_through(pooled, msg) == msg);
+	assert(pool.in_use() == 0);
+	bev::growable_io_buffer growable;
+	assert(echo_through(growable, msg) == msg);
+	std::cout << "success\n";
+	std::cout << "Test 3..." << std::flush;
+	// A wrapped view is written in two steps, first the part at `read_head()`.
+	char storage[16];
+	bev::io_buffer_view view(storage, sizeof storage);
+	::memcpy(bev::prepare(view, 12).data, "0123456789ab", 12);
+	view.commit(12);
+	view.consume(8);
+	auto free = view.prepare_iov(10);
+	assert(free.count == 2 && free.iov[0].iov_len == 4 && free.iov[1].iov_len == 6);
+	::memcpy(free.iov[0].iov_base, "cdef", 4);
+	::memcpy(free.iov[1].iov_base, "ghijkl", 6);
+	view.commit(10);
+	assert(view.wrapped() && view.size() == 8 && view.total_size() == 14);
+	assert(bev::data(view).data == reinterpret_cast<unsigned char*>(view.read_head()) && bev::data(view).size == 8);
+
+	int fds[2];
+	assert(::pipe(fds) == 0);
+	assert(bev::write_some(fds[1], view) == 8);
+	assert(!view.wrapped() && view.size() == 6);
+	assert(bev::write_some(fds[1], view) == 6);
+	assert(view.total_size() == 0);
+	char out[32];
+	assert(::read(fds[0], out, sizeof out) == 14 && std::string(out, 14) == "89abcdefghijkl");
+	::close(fds[0]);
+	::close(fds[1]);
+	std::cout << "success\n";
+}
+
+void test_hybrid_buffer()
+{
+	std::cout << "Test 1..." << std::flush;
+	bev::ringbuffer_pool pool(64*1024, 1);
+	bev::linear_ringbuffer rb(bev::linear_ringbuffer::delayed_init {});
+	assert(pool.acquire(rb) == 0 && rb.capacity() == 64*1024);
+	unsigned char* mapping = rb.write_head();
+	rb.commit(10);
+	pool.release(rb);
+	assert(pool.cached() == 1 && rb.capacity() == 0);
+	assert(pool.acquire(rb) == 0 && rb.write_head() == mapping && rb.empty());
+	bev::linear_ringbuffer moved(std::move(rb));
+	assert(moved.write_head() == mapping && rb.capacity() == 0);
+	pool.release(moved);
+
+	// A pool that can't allocate its cache unmaps released buffers.
+	bev::ringbuffer_pool huge(4096, SIZE_MAX);
+	assert(huge.acquire(rb) == 0);
+	huge.release(rb);
+	assert(huge.cached() == 0 && rb.capacity() == 0);
+	std::cout << "success\n";
+
+	std::cout << "Test 2..." << std::flush;
+	{
+		bev::hybrid_buffer<256> b(pool);
+		auto slab = b.prepare(100);
+		assert(!b.upgraded() && slab.data == b.write_head() && slab.size == 100);
+		::memset(slab.data, 'a', 100);
+		b.commit(100);
+		b.consume(40);
+
+		// Anything that doesn't fit at the end migrates the data.
+		slab = b.prepare(200);
+		assert(b.upgraded() && pool.cached() == 0);
+		assert(b.size() == 60 && b.read_head()[0] == 'a' && b.read_head()[59] == 'a');
+		assert(slab.data == b.read_head() + 60 && slab.size == 200);
+		::memset(slab.data, 'b', 200);
+		b.commit(200);
+		assert(b.size() == 260 && b.read_head()[60] == 'b');
+
+		b.consume(260);
+		assert(!b.upgraded() && pool.cached() == 1);
+		assert(b.free_size() == 256 && b.capacity() == 64*1024);
+
+		b.prepare(1000);
+		assert(b.upgraded());
+		b.commit(0);
+		assert(!b.upgraded());
+	}
+	assert(pool.cached() == 1);
+	std::cout << "success\n";
+}
+
+void test_bulk_copy()
+{
+	std::cout << "Test 1..." << std::flush;
+	// Every kernel, at odd sizes and alignments.
+	std::vector<char> src(300*1000 + 100);
+	for (size_t i = 0; i < src.size(); ++i) {
+		src[i] = static_cast<char>(i * 7 + i / 256);
+	}
+	for (auto kernel : {bev::copy_kernel::libc, bev::copy_kernel::erms,
+			bev::copy_kernel::avx2, bev::copy_kernel::stream}) {
+		for (size_t n : {0, 1, 63, 64, 127, 1000, 300*1000 + 3}) {
+			std::vector<char> dst(n + 64, 'z');
+			bev::copy_with(kernel, dst.data() + 3, src.data() + 5, n);
+			assert(::memcmp(dst.data() + 3, src.data() + 5, n) == 0);
+			assert(dst[2] == 'z' && dst[n + 3] == 'z');
+		}
+	}
+	assert(bev::select_copy_kernel(100) == bev::copy_kernel::libc);
+	assert(bev::select_copy_kernel(SIZE_MAX) != bev::copy_kernel::libc
+		|| !bev::copy_kernel_supported(bev::copy_kernel::stream));
+	std::cout << "success\n";
+
+	std::cout << "Test 2..." << std::flush;
+	// `put()` and `get()` stop at the free resp. used size.
+	bev::linear_ringbuffer rb(256*1024);
+	assert(bev::put(rb, src.data(), 200*1000) == 200*1000);
+	assert(bev::put(rb, src.data() + 200*1000, 100*1000) == rb.capacity() - 200*1000);
+	assert(rb.free_size() == 0);
+	std::vector<char> out(rb.capacity() + 1000);
+	assert(bev::get(rb, out.data(), 150*1000) == 150*1000);
+	assert(bev::put(rb, src.data(), 1000) == 1000);
+	size_t const rest = rb.size();
+	assert(bev::get(rb, out.data() + 150*1000, out.size()) == rest);
+	assert(rb.empty());
+	assert(::memcmp(out.data(), src.data(), rb.capacity()) == 0);
+	assert(::memcmp(out.data() + rb.capacity(), src.data(), 1000) == 0);
+	std::cout << "success\n";
+}
+
+#if defined(BEV_TEST_ASIO)
+void test_asio_dynamic_buffer()
+{
+	namespace net = bev::detail::net;
+
+	std::cout << "Test 1..." << std::flush;
+	bev::linear_ringbuffer rb(4096);
+	bev::io_buffer iob(4096);
+	static_assert(net::is_dynamic_buffer_v2<decltype(bev::dynamic_buffer(rb))>::value, "");
+	static_assert(net::is_dynamic_buffer_v2<decltype(bev::dynamic_buffer(iob))>::value, "");
+
+	auto db = bev::dynamic_buffer(iob);
+	iob.commit(100);
+	iob.consume(100 - 10);
+	assert(db.size() == 10 && db.max_size() == 4096);
+	db.grow(4000);
+	assert(iob.size() == 4010 && iob.read_head() == iob.write_head() - 4010);
+	db.shrink(4000);
+	assert(db.size() == 10 && net::buffer_size(db.data(5, 100)) == 5);
+	bool thrown = false;
+	try {
+		db.grow(5000);
+	} catch (const std::length_error&) {
+		thrown = true;
+	}
+	assert(thrown && db.size() == 10);
+	db.consume(100);
+	assert(iob.size() == 0);
+	std::cout << "success\n";
+
+	std::cout << "Test 2..." << std::flush;
+	// Reading across the edge of the ringbuffer arrives contiguously.
+	net::io_context ctx;
+	int fds[2];
+	assert(::pipe(fds) == 0);
+	net::posix::stream_descriptor in(ctx, fds[0]);
+	net::posix::stream_descriptor out(ctx, fds[1]);
+	rb.commit(4000);
+	rb.consume(4000);
+	std::string msg = "GET / HTTP/1.1\r\nHost: example.com\r\n\r\nbody";
+	net::write(out, net::buffer(msg));
+
+	size_t header = 0;
+	net::async_read_until(in, bev::dynamic_buffer(rb), "\r\n\r\n",
+		[&](const auto& ec, size_t n) {
+			assert(!ec);
+			header = n;
+		});
+	ctx.run();
+	assert(header == msg.size() - 4);
+	assert(std::string(reinterpret_cast<char*>(rb.read_head()), rb.size()) == msg);
+	std::cout << "success\n";
+
+	std::cout << "Test 3..." << std::flush;
+	// A wrapped view is exposed as two buffers, and grows after the second.
+	char storage[16];
+	bev::io_buffer_view view(storage, sizeof storage);
+	::memcpy(view.prepare(12).data, "0123456789ab", 12);
+	view.commit(12);
+	view.consume(8);
+	auto free = view.prepare_iov(10);
+	::memcpy(free.iov[0].iov_base, "cdef", 4);
+	::memcpy(free.iov[1].iov_base, "ghijkl", 6);
+	view.commit(10);
+	auto wrapped = bev::dynamic_buffer(view);
+	assert(view.wrapped() && wrapped.size() == 14 && wrapped.max_size() == 16);
+	auto range = wrapped.data(2, 100);
+	assert(net::buffer_size(range) == 12 && range[0].size() == 6 && range[1].size() == 6);
+	std::string contents(net::buffer_size(range), '\0');
+	net::buffer_copy(net::buffer(contents), range);
+	assert(contents == "abcdefghijkl");
+	wrapped.grow(2);
+	assert(wrapped.size() == 16 && view.data_iov().iov[1].iov_len == 8);
+	wrapped.shrink(3);
+	wrapped.consume(9);
+	assert(!view.wrapped() && view.size() == 4 && std::string(view.read_head(), 4) == "hijk");
+	std::cout << "success\n";
 }
+#endif
 
 int main()
 {
 	std::cout << "Testing linear_ringbuffer...\n";
 	test_linear_ringbuffer();
+	std::cout << "Testing file-backed linear_ringbuffer...\n";
+	test_file_backed_ringbuffer();
+	std::cout << "Testing group_commit_writer...\n";
+	test_group_commit_writer();
+	std::cout << "Testing direct_writer...\n";
+	test_direct_writer();
+	std::cout << "Testing pipe_fanout...\n";
+	test_pipe_fanout();
 	std::cout << "Testing io_ringbuffer...\n";
 	test_io_buffer();
+	std::cout << "Testing adaptive_reader...\n";
+	test_adaptive_reader();
+	std::cout << "Testing record_ring...\n";
+	test_record_ring();
+	std::cout << "Testing typed_ringbuffer...\n";
+	test_typed_ringbuffer();
+	std::cout << "Testing line_scanner...\n";
+	test_line_scanner();
+	std::cout << "Testing http_tokenizer and resp_tokenizer...\n";
+	test_tokenizers();
+	std::cout << "Testing checksummed_ringbuffer...\n";
+	test_checksummed_ringbuffer();
+	std::cout << "Testing pipeline stages...\n";
+	test_pipeline();
+	std::cout << "Testing traced_ringbuffer...\n";
+	test_traced_ringbuffer();
+	std::cout << "Testing flight_ring...\n";
+	test_flight_ring();
+	std::cout << "Testing binary_logger...\n";
+	test_binary_logger();
+	std::cout << "Testing multi_buffer...\n";
+	test_multi_buffer();
+	std::cout << "Testing pooled_io_buffer...\n";
+	test_pooled_io_buffer();
+	std::cout << "Testing growable_io_buffer...\n";
+	test_growable_io_buffer();
+	std::cout << "Testing byte_stream_buffer...\n";
+	test_byte_stream_buffer();
+	std::cout << "Testing hybrid_buffer...\n";
+	test_hybrid_buffer();
+	std::cout << "Testing bulk_copy...\n";
+	test_bulk_copy();
+#if defined(BEV_TEST_ASIO)
+	std::cout << "Testing asio_dynamic_buffer...\n";
+	test_asio_dynamic_buffer();
+#endif
 }